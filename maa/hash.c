@@ -30,9 +30,33 @@
  * collision resolution. The hash table automatically grows as necessary to
  * preserve efficient access.
  *
+ * A table may also be grown incrementally (see |hsh_create2|): the old
+ * array of lists is then kept alongside the new one, and a few lists are
+ * moved at each insertion or deletion.
+ *
+ * Alternatively, a table may be created with an open addressing layout
+ * (see |hsh_create2|), in which entries are stored directly in a flat
+ * array of slots, and a byte of each hash value is kept in a separate tag
+ * array that is searched 16 slots at a time.  An ordered table keeps the
+ * slots packed in insertion order instead, and the tag array is paired
+ * with an index into them, as in the compact dictionaries of Python.
+ *
+ * A table of lists may also be shared by threads (see |hsh_create2|).
+ * Lookups in such a table never store into it: a new array of lists is
+ * built aside and published when the table grows, and buckets that
+ * lookups in progress may still see are freed only after those lookups
+ * have finished (epoch-based reclamation).
+ *
  */
 
 #include "maaP.h"
+#include "hshdef.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
 
 typedef struct bucket {
 	const void    *key;
@@ -41,6 +65,119 @@ typedef struct bucket {
 	struct bucket *next;
 } *bucketType;
 
+				/* A bucket of an HSH_SIZED_KEYS table */
+typedef struct sized_bucket {
+	struct bucket bucket;
+	size_t        length;
+} *sizedBucketType;
+
+				/* The |key| argument of the internal
+				   functions for an HSH_SIZED_KEYS table */
+typedef struct sized_key {
+	const void *key;
+	size_t     length;
+} *sizedKeyType;
+
+				/* A slot of an open addressing table.  The
+				   leading members are the same as in
+				   struct bucket, so that either can be
+				   used as an |hsh_Position|. */
+typedef struct slot {
+	const void    *key;
+	unsigned long hash;
+	const void    *datum;
+} *slotType;
+
+				/* The probing scheme is shared with the
+				   tables generated by hshdef.h */
+#define HSH_GROUP       HSH_DEF_GROUP
+#define HSH_TAG_EMPTY   HSH_DEF_EMPTY
+#define HSH_TAG_DELETED HSH_DEF_DELETED
+#define HSH_TAG_FULL(c) HSH_DEF_FULL(c)
+
+				/* The key of a slot deleted from an
+				   HSH_ORDERED table, which stays in the
+				   dense array until the next resize */
+static const char _hsh_removed[1];
+#define HSH_REMOVED ((const void *)_hsh_removed)
+
+				/* An array of lists as published to
+				   lookups in a concurrent table */
+typedef struct lists {
+	unsigned long prime;
+	int           shift;
+	bucketType    buckets[1];
+} *listsType;
+
+				/* Memory unlinked from a concurrent
+				   table, but maybe seen by lookups that
+				   started in |epoch| */
+typedef struct retired {
+	void          *pt;
+	int           lists;	/* |pt| is a listsType, not a bucketType */
+	unsigned long epoch;
+} *retiredType;
+
+				/* The index of a long list of an
+				   HSH_SORTED_LISTS table.  The list is
+				   kept sorted by hash, and |nodes| holds
+				   its buckets in the same order, so that
+				   a lookup is a binary search, and the
+				   bucket before any other is known. */
+typedef struct sorted {
+	unsigned long count;
+	unsigned long room;
+	bucketType    nodes[1];
+} *sortedType;
+
+				/* The entries of a span of a table, as
+				   they were when a snapshot was taken */
+typedef struct saved_entry {
+	const void    *key;
+	const void    *datum;
+} *savedEntryType;
+
+typedef struct saved {
+	unsigned long      count;
+	struct saved_entry entries[1];
+} *savedType;
+
+				/* A view of a table as it was when
+				   |hsh_snapshot| was called.  Each span of
+				   HSH_SNAPSHOT_SPAN lists (or tags) is
+				   read from the table itself until it is
+				   first changed, which saves a copy of
+				   it beforehand. */
+typedef struct snapshot {
+#if MAA_MAGIC
+	int             magic;
+#endif
+	pthread_mutex_t lock;		/* Serializes saving with reading */
+	struct table    *table;	/* "NULL" once every span is saved */
+	struct snapshot *next;		/* Other snapshots of |table| */
+	unsigned long   spans;
+	unsigned long   unsaved;	/* Spans still read from |table| */
+	savedType       *saved;	/* The copy of each span, once saved */
+} *snapshotType;
+
+typedef struct concurrent {
+	pthread_mutex_t lock;		/* Serializes insertions and deletions */
+	listsType       lists;		/* What lookups search */
+	retiredType     retired;
+	unsigned long   retired_count;
+	unsigned long   retired_max;
+} *concurrentType;
+
+				/* What lookups count.  A shared table
+				   counts in a page of its own, so that
+				   lookups store nothing into the table. */
+typedef struct counters {
+	unsigned long retrievals;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long long_chains;	/* See HSH_LONG_CHAIN */
+} *countersType;
+
 typedef struct table {
 #if MAA_MAGIC
 	int           magic;
@@ -49,14 +186,72 @@ typedef struct table {
 	unsigned long entries;
 	bucketType    *buckets;
 	unsigned long resizings;
-	unsigned long retrievals;
-	unsigned long hits;
-	unsigned long misses;
+	countersType  counters;		/* &own, unless the table is shared */
+	struct counters own;
 	unsigned long (*hash)(const void *);
 	int           (*compare)(const void *, const void *);
 	int           readonly;
+	int           flags;
+	unsigned char *tags;		/* Open addressing only */
+	slotType      slots;		/* Open addressing only */
+	unsigned long *order;		/* HSH_ORDERED: slot of each tag */
+	unsigned long used;		/* HSH_ORDERED: slots filled so far */
+	unsigned long deleted;	/* Number of HSH_TAG_DELETED tags */
+	mem_Object    nodes;		/* Buckets are allocated from here */
+	bucketType    *old_buckets;	/* Lists not yet moved by a resize */
+	unsigned long old_prime;
+	unsigned long migrated;	/* Lists of old_buckets already moved */
+	int           shift;		/* See HSH_INDEX */
+	int           old_shift;
+	concurrentType concurrent;	/* HSH_CONCURRENT only */
+	double        max_load;	/* Grow when entries exceed |limit|, */
+	unsigned long limit;		/* which is prime * max_load */
+	double        growth;
+	unsigned long seed;		/* Non-zero only for the default hash */
+	void          *(*allocate)(size_t size, void *arg);
+	void          (*deallocate)(void *pt, void *arg);
+	void          *allocator_arg;
+	int           threads;		/* Used to rebuild large tables of lists */
+	unsigned long mapped;		/* HSH_HUGE_PAGES: bytes of mappings */
+	unsigned char *small;		/* HSH_SMALL: inline arrays, while used */
+	unsigned long min_size;	/* Never shrink below this many lists or tags */
+	int           iterating;	/* Calls of hsh_iterate under way */
+	hsh_Profile   *profile;	/* HSH_PROFILE only */
+	unsigned long walked;		/* Entries examined by this lookup */
+	int           timing;		/* A resize is being timed */
+	sortedType    *sorted;		/* HSH_SORTED_LISTS: index of each list */
+	int           shared;		/* See hsh_shared */
+	hsh_Profile   *parked;		/* The profile, while the table is shared */
+	snapshotType  snapshots;	/* Those still reading from the table */
 } *tableType;
 
+#define HSH_MIGRATE_STEP 32	/* Old lists moved per insertion or deletion */
+#define HSH_LONG_CHAIN   32	/* Entries of a list, or */
+#define HSH_LONG_PROBE   16	/* groups of tags, that a lookup examining
+				   more is counted in |long_chains| */
+#define HSH_SORTED_MIN   16	/* Lists this long are sorted, and they are
+				   unsorted again below half of it */
+#define HSH_SNAPSHOT_SPAN 64	/* Lists, or tags, saved at once */
+#define HSH_PARALLEL_MIN 65536	/* Fewer entries are not worth threads */
+#define HSH_BULK_NODES   256	/* Buckets taken at once by a bulk loader */
+#define HSH_THREADS_MAX  256	/* More threads are reduced to this many */
+
+				/* An HSH_SMALL table starts as one group
+				   of open addressing, whose tags, order
+				   and slots follow the table in memory.
+				   With no more than HSH_SMALL_MAX entries
+				   in a group of 16 tags, deletions never
+				   leave HSH_TAG_DELETED tags and new
+				   entries always go to the first free
+				   tag, so only that many slots are
+				   needed. */
+#define HSH_SMALL_MAX   8
+#define HSH_SMALL_BYTES (HSH_GROUP + HSH_SMALL_MAX * (sizeof(unsigned long) \
+													  + sizeof(struct slot)))
+
+#define HSH_PUT_INSERT   1	/* Insert an absent key */
+#define HSH_PUT_REPLACE  2	/* Replace the datum of a present key */
+
 static void _hsh_check(tableType t, const char *function)
 {
 	if (!t) err_internal(function, "table is null");
@@ -67,561 +262,4904 @@ static void _hsh_check(tableType t, const char *function)
 					 t->magic,
 					 HSH_MAGIC);
 #endif
-	if (!t->buckets)
+	if (!t->concurrent && !t->buckets && !t->slots)
 		err_internal(function, "no buckets");
 }
 
-static hsh_HashTable _hsh_create(
-	unsigned long seed,
-	unsigned long (*hash)(const void *),
-	int (*compare)(const void *,
-				   const void *))
+/* The arrays of a table come from the allocator given to
+   |hsh_create_ex|, if any. */
+
+static void *_hsh_alloc(tableType t, size_t size)
 {
-	tableType     t;
-	unsigned long i;
-	unsigned long prime = prm_next_prime(seed);
-   
-	t             = xmalloc(sizeof(struct table));
-#if MAA_MAGIC
-	t->magic      = HSH_MAGIC;
-#endif
-	t->prime      = prime;
-	t->entries    = 0;
-	t->buckets    = xmalloc(prime * sizeof(struct bucket));
-	t->resizings  = 0;
-	t->retrievals = 0;
-	t->hits       = 0;
-	t->misses     = 0;
-	t->hash       = hash ? hash : hsh_string_hash;
-	t->compare    = compare ? compare : hsh_string_compare;
-	t->readonly   = 0;
+	void *pt;
 
-	for (i = 0; i < prime; i++) t->buckets[i] = NULL;
+	if (!t->allocate) return xmalloc(size);
+	if (!(pt = t->allocate(size, t->allocator_arg)))
+		err_fatal(__func__, "Out of memory for %lu bytes",
+				  (unsigned long)size);
+	return pt;
+}
 
-	return t;
+static void _hsh_free(tableType t, void *pt)
+{
+	if (t->deallocate) t->deallocate(pt, t->allocator_arg);
+	else               xfree(pt);
 }
 
-/* \doc The |hsh_create| function initilizes a generic hash table.  Keys
-   and data are pointers to "void".
+static unsigned long _hsh_hash(tableType t, const void *key)
+{
+	if (!t->seed) return t->hash(key);
+	if (!key) err_internal(__func__, "String-valued keys may not be NULL");
+	return _hsh_hash_bytes(key, strlen((const char *)key), t->seed);
+}
 
-   The internal representation of the hash table will grow automatically
-   when an insertion is performed and the table is more than half full.
+/* Return the number of slots of an open addressing table with |size|
+   tags.  Unordered tables have a slot for each tag.  Ordered tables are
+   never more than 7/8 full, so only that many slots are ever needed. */
 
-   The |hash| function should take a pointer to a |key| and return an
-   "unsigned long".  If |hash| is "NULL", then the |key| is assumed to be a
-   pointer to a null-terminated string, and the function shown in
-   \grind{hsh_string_hash} will be used for |hash| (the algorithm for this
-   function is from \cite[p.~435]{faith:Aho88}).
+static unsigned long _hsh_oa_capacity(tableType t, unsigned long size)
+{
+	return t->flags & HSH_ORDERED ? size / 8 * 7 : size;
+}
 
-   The |compare| function should take a pair of pointers to keys and return
-   zero if the keys are equal and non-zero if the keys are not equal.  If
-   |compare| is "NULL", then the keys are assumed to point to
-   null-terminated strings, and the |strcmp| function will be used for
-   |compare|.
+static void _hsh_oa_alloc(tableType t, unsigned long size)
+{
+	t->prime   = size;
+	t->deleted = 0;
+	t->used    = 0;
+	t->tags    = _hsh_alloc(t, size);
+	t->slots   = _hsh_alloc(t, _hsh_oa_capacity(t, size)
+							* sizeof(struct slot));
+	if (t->flags & HSH_ORDERED)
+		t->order = _hsh_alloc(t, size * sizeof(unsigned long));
+	memset(t->tags, HSH_TAG_EMPTY, size);
+}
 
-   Additionally, the |hsh_pointer_hash| and |hsh_pointer_compare| functions
-   are available and can be used to treat the \emph{value} of the "void"
-   pointer as the key.  These functions are often useful for maintaining
-   sets of objects. */
+/* Return the slot of tag |i| of an open addressing table. */
 
-hsh_HashTable hsh_create(
-	unsigned long (*hash)(const void *),
-	int (*compare)(const void *,
-				   const void *))
+static slotType _hsh_oa_slot(tableType t, unsigned long i)
 {
-	return _hsh_create(0, hash, compare);
+	return t->order ? t->slots + t->order[i] : t->slots + i;
 }
 
-static void _hsh_destroy_buckets(hsh_HashTable table)
+/* Return the slot following |s| in the order of iteration, or the first
+   one if |s| is "NULL".  Returns "NULL" after the last slot. */
+
+static slotType _hsh_oa_next(tableType t, slotType s)
 {
-	unsigned long i;
-	tableType     t    = (tableType)table;
+	unsigned long i = s ? s - t->slots + 1 : 0;
 
-	_hsh_check(t, __func__);
-	for (i = 0; i < t->prime; i++) {
-		bucketType b = t->buckets[i];
+	if (t->order) {
+		for (; i < t->used; i++)
+			if (t->slots[i].key != HSH_REMOVED) return t->slots + i;
+	} else {
+		for (; i < t->prime; i++)
+			if (HSH_TAG_FULL(t->tags[i])) return t->slots + i;
+	}
+	return NULL;
+}
 
-		while (b) {
-			bucketType next = b->next;
+/* Return the number of lists to use when a table of lists grows. */
 
-			xfree(b);		/* terminal */
-			b = next;
-		}
-	}
+static unsigned long _hsh_grow_size(tableType t)
+{
+	unsigned long size = t->prime * t->growth;
 
-	xfree(t->buckets);		/* terminal */
-	t->buckets = NULL;
+	return _hsh_next_size(t->flags, max(size, t->prime + 1));
 }
 
-static void _hsh_destroy_table(hsh_HashTable table)
+static void _hsh_set_limit(tableType t)
 {
-	tableType t = (tableType)table;
-   
-#if MAA_MAGIC
-	t->magic = HSH_MAGIC_FREED;
-#endif
-	xfree(t);			/* terminal */
+	t->limit = t->prime * t->max_load;
 }
 
-/* \doc |hsh_destroy| frees all of the memory associated with the hash
-   table.
+/* Lookups in a concurrent table load shared pointers with acquire
+   semantics, and writers publish them with release semantics, so that a
+   bucket is always seen fully initialized. */
 
-   The memory used by keys and data is \emph{not} freed---this memory is
-   the responsibility of the user.  However, a call to |hsh_iterate|
-   can be used to free this memory \emph{immediately} before a call to
-   |hsh_destroy|. */
+#if defined(__GNUC__)
+#define HSH_CONCURRENT_SUPPORTED 1
+#define HSH_THREAD      __thread
+#define HSH_LOAD(p)     __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define HSH_STORE(p,v)  __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define HSH_FENCE()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define HSH_CAS(p,o,n)  __atomic_compare_exchange_n(&(p), &(o), (n), 0, \
+							__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#else
+#define HSH_CONCURRENT_SUPPORTED 0
+#define HSH_THREAD
+#define HSH_LOAD(p)     (p)
+#define HSH_STORE(p,v)  ((p) = (v))
+#define HSH_FENCE()
+#define HSH_CAS(p,o,n)  ((p) == (o) ? ((p) = (n), 1) : 0)
+#endif
 
-void hsh_destroy(hsh_HashTable table)
+#define HSH_CACHE_LINE 64
+
+/* Every thread that looks up keys in a concurrent table gets a reader
+   record, aligned to a cache line of its own.  While the thread is inside
+   |hsh_retrieve|, |state| holds the global epoch it observed, shifted
+   left, with the low bit set.  Writers advance the global epoch only when
+   every active reader has observed its current value, so memory retired
+   in epoch $e$ is unreachable once the epoch is $e+2$.  Records are
+   reused after their threads exit, but are never freed. */
+
+typedef struct reader {
+	unsigned long state;
+	unsigned long depth;		/* Nested lookups (from |compare|) */
+	struct reader *next;
+	int           used;
+} *readerType;
+
+static readerType             _hsh_readers;
+static pthread_mutex_t        _hsh_readers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t         _hsh_readers_once = PTHREAD_ONCE_INIT;
+static pthread_key_t          _hsh_reader_key;
+static unsigned long          _hsh_epoch        = 1;
+static HSH_THREAD readerType  _hsh_reader;
+
+static void _hsh_reader_release(void *reader)
 {
-	_hsh_check(table, __func__);
-	if (((tableType)table)->readonly)
-		err_internal(__func__, "Attempt to destroy readonly table");
-	_hsh_destroy_buckets(table);
-	_hsh_destroy_table(table);
+	HSH_STORE(((readerType)reader)->used, 0);
 }
 
-static void _hsh_insert(
-	hsh_HashTable table,
-	unsigned long hash,
-	const void *key,
-	const void *datum)
+static void _hsh_reader_key_create(void)
 {
-	tableType     t = (tableType)table;
-	unsigned long h = hash % t->prime;
-	bucketType    b;
+	if (pthread_key_create(&_hsh_reader_key, _hsh_reader_release))
+		err_fatal(__func__, "Cannot create a thread-specific key");
+}
 
-	_hsh_check(t, __func__);
-   
-	b        = xmalloc(sizeof(struct bucket));
-	b->key   = key;
-	b->hash  = hash;
-	b->datum = datum;
-	b->next  = NULL;
-   
-	if (t->buckets[h]) b->next = t->buckets[h];
-	t->buckets[h] = b;
-	++t->entries;
+static readerType _hsh_reader_register(void)
+{
+	readerType r;
+
+	pthread_once(&_hsh_readers_once, _hsh_reader_key_create);
+	pthread_mutex_lock(&_hsh_readers_lock);
+	for (r = _hsh_readers; r && HSH_LOAD(r->used); r = r->next);
+	if (!r) {
+		void *pt;
+
+		if (posix_memalign(&pt, HSH_CACHE_LINE,
+						   max(sizeof(struct reader), HSH_CACHE_LINE)))
+			err_fatal(__func__, "Out of memory for a reader record");
+		r        = pt;
+		r->state = 0;
+		r->next  = _hsh_readers;
+		HSH_STORE(_hsh_readers, r);
+	}
+	r->depth = 0;
+	r->used  = 1;
+	pthread_mutex_unlock(&_hsh_readers_lock);
+	pthread_setspecific(_hsh_reader_key, r);
+
+	return _hsh_reader = r;
 }
 
-/* \doc |hsh_insert| inserts a new |key| into the |table|.  If the
-   insertion is successful, zero is returned.  If the |key| already exists,
-   1 is returned.  Hence, the way to change the |datum| associated with a
-   |key| is first to call |hsh_delete|.
+static readerType _hsh_reader_enter(void)
+{
+	readerType r = _hsh_reader;
 
-   If the internal representation of the hash table becomes more than half
-   full, its size is increased automatically.  At present, this requires
-   that all of the key pointers are copied into a new table.  Rehashing is
-   not required, however, since the hash values are stored for each key. */
+	if (!r) r = _hsh_reader_register();
+	if (!r->depth++) {
+		HSH_STORE(r->state, HSH_LOAD(_hsh_epoch) << 1 | 1);
+		HSH_FENCE();		/* Before any shared pointer is loaded */
+	}
+	return r;
+}
 
-int hsh_insert(
-	hsh_HashTable table,
-	const void *key,
-	const void *datum)
+static void _hsh_reader_leave(readerType r)
 {
-	tableType     t         = (tableType)table;
-	unsigned long hashValue = t->hash(key);
-	unsigned long h;
+	if (!--r->depth) HSH_STORE(r->state, 0);
+}
 
-	_hsh_check(t, __func__);
-	if (t->readonly)
-		err_internal(__func__, "Attempt to insert into readonly table");
-   
-	/* Keep table less than half full */
-	if (t->entries * 2 > t->prime) {
-		tableType     new = _hsh_create(t->prime * 3, t->hash, t->compare);
-		unsigned long i;
+/* Advance the global epoch if every active reader has observed it, and
+   return its value. */
 
-		for (i = 0; i < t->prime; i++) {
-			if (t->buckets[i]) {
-				bucketType pt;
+static unsigned long _hsh_epoch_advance(void)
+{
+	unsigned long epoch = HSH_LOAD(_hsh_epoch);
+	readerType    r;
 
-				for (pt = t->buckets[i]; pt; pt = pt->next)
-					_hsh_insert(new, pt->hash, pt->key, pt->datum);
-			}
-		}
+	HSH_FENCE();
+	for (r = HSH_LOAD(_hsh_readers); r; r = r->next) {
+		unsigned long state = HSH_LOAD(r->state);
 
-		/* fixup values */
-		_hsh_destroy_buckets(t);
-		t->prime   = new->prime;
-		t->buckets = new->buckets;
-		_hsh_destroy_table(new);
-		++t->resizings;
+		if ((state & 1) && state >> 1 != epoch) return epoch;
 	}
+	HSH_CAS(_hsh_epoch, epoch, epoch + 1);
+	return HSH_LOAD(_hsh_epoch);
+}
 
-	h = hashValue % t->prime;
+static listsType _hsh_cc_alloc(tableType t, unsigned long prime)
+{
+	listsType     l = _hsh_alloc(t, offsetof(struct lists, buckets)
+								 + prime * sizeof(bucketType));
+	unsigned long i;
 
-	if (t->buckets[h]) {		/* Assert uniqueness */
-		bucketType pt;
-	  
-		for (pt = t->buckets[h]; pt; pt = pt->next)
-			if (!t->compare(pt->key, key)) return 1;
-	}
+	l->prime = prime;
+	l->shift = (t->flags & HSH_POWER_OF_TWO) ? _hsh_shift(prime) : 0;
+	for (i = 0; i < prime; i++) l->buckets[i] = NULL;
 
-	_hsh_insert(t, hashValue, key, datum);
-	return 0;
+	return l;
 }
 
-/* \doc |hsh_delete| removes a |key| and the associated datum from the
-   |table|.  Zero is returned if the |key| was present.  Otherwise, 1 is
-   returned. */
+/* Make |l| the array of lists of a concurrent table. */
 
-int hsh_delete(hsh_HashTable table, const void *key)
+static void _hsh_cc_publish(tableType t, listsType l)
 {
-	tableType     t = (tableType)table;
-	unsigned long h = t->hash(key) % t->prime;
-
-	_hsh_check(t, __func__);
-	if (t->readonly)
-		err_internal(__func__, "Attempt to delete from readonly table");
+	HSH_STORE(t->concurrent->lists, l);
+	t->buckets = l->buckets;
+	t->prime   = l->prime;
+	t->shift   = l->shift;
+	_hsh_set_limit(t);
+}
 
-	if (t->buckets[h]) {
-		bucketType pt;
-		bucketType prev;
-  
-		for (prev = NULL, pt = t->buckets[h]; pt; prev = pt, pt = pt->next)
-			if (!t->compare(pt->key, key)) {
-				--t->entries;
-	       
-				if (!prev) t->buckets[h] = pt->next;
-				else       prev->next = pt->next;
-	       
-				xfree(pt);
-				return 0;
-			}
-	}
-   
-	return 1;
+static size_t _hsh_node_size(tableType t)
+{
+	return (t->flags & HSH_SIZED_KEYS)
+		? sizeof(struct sized_bucket) : sizeof(struct bucket);
 }
 
+/* With HSH_PROFILE, the list and probe loops add the entries they
+   examine to |t->walked|, which is recorded in the histogram once for each
+   lookup. */
 
-/* \doc |hsh_retrieve| retrieves the datum associated with a |key|.  If the
-   |key| is not present in the |table|, then "NULL" is returned. */
+static void _hsh_profile_lookup(tableType t)
+{
+	hsh_Profile *p = t->profile;
 
-const void *hsh_retrieve(hsh_HashTable table,
-						 const void *key)
+	++p->lookups;
+	++p->walks[t->walked < HSH_PROFILE_WALKS
+			   ? t->walked : HSH_PROFILE_WALKS - 1];
+	t->walked = 0;
+}
+
+static double _hsh_profile_time(void)
 {
-	tableType     t = (tableType)table;
-	unsigned long h = t->hash(key) % t->prime;
+	struct timeval tv;
 
-	_hsh_check(t, __func__);
-   
-	++t->retrievals;
-	if (t->buckets[h]) {
-		bucketType pt;
-		bucketType prev;
-
-		for (prev = NULL, pt = t->buckets[h]; pt; prev = pt, pt = pt->next)
-			if (!t->compare(pt->key, key)) {
-				if (!prev) {
-					++t->hits;
-				} else if (!t->readonly) {
-					/* Self organize */
-					prev->next    = pt->next;
-					pt->next      = t->buckets[h];
-					t->buckets[h] = pt;
-				}
-				return pt->datum;
-			}
-	}
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
 
-	++t->misses;
-	return NULL;
+/* Return the start time of a resize, or zero if it is not timed (because
+   it is part of a resize already being timed). */
+
+static double _hsh_profile_begin(tableType t)
+{
+	if (!t->profile || t->timing) return 0;
+	t->timing = 1;
+	return _hsh_profile_time();
 }
 
-/* \doc |hsh_iterate| is used to iterate a function over every value in the
-   |table|.  The function, |iterator|, is passed the |key| and |datum| pair
-   for each entry in the table.  If |iterator| returns a non-zero value,
-   the iterations stop, and |hsh_iterate| returns non-zero.  Note that the
-   keys are in some arbitrary order, and that this order may change between
-   two successive calls to |hsh_iterate|. */
+static void _hsh_profile_end(tableType t, double start)
+{
+	if (!start) return;
+	t->profile->resize_seconds += _hsh_profile_time() - start;
+	t->timing = 0;
+}
 
-int hsh_iterate(hsh_HashTable table,
-				int (*iterator)(const void *key,
-								const void *datum))
+/* Return non-zero if bucket |pt| holds |key|, whose hash value is
+   |hash|.  The stored hash value (and length) are checked before the key
+   itself is examined. */
+
+static int _hsh_equal(
+	tableType t,
+	bucketType pt,
+	unsigned long hash,
+	const void *key)
 {
-	tableType     t = (tableType)table;
-	unsigned long i;
-	bucketType    pt;
-	bucketType    next;		/* Save, because pt might vanish. */
+	if (pt->hash != hash) return 0;
+	if (t->profile) ++t->profile->compares;
+	if (t->flags & HSH_SIZED_KEYS) {
+		sizedKeyType k = (sizedKeyType)key;
 
-	_hsh_check(t, __func__);
-   
-	for (i = 0; i < t->prime; i++) {
-		if (t->buckets[i]) {
-			for (pt = t->buckets[i]; pt; pt = next) {
-				next = pt->next;
-				if (iterator(pt->key, pt->datum))
-					return 1;
-			}
-		}
+		return ((sizedBucketType)pt)->length == k->length
+			&& !memcmp(pt->key, k->key, k->length);
 	}
-	return 0;
+	return !t->compare(pt->key, key);
 }
 
-/* \doc |hsh_iterate_arg| is used to iterate a function over every value in
-   the |table|.  The function, |iterator|, is passed the |key| and |datum|
-   pair for each entry in the table.  If |iterator| returns a non-zero
-   value, the iterations stop, and |hsh_iterate| returns non-zero.  Note
-   that the keys are in some arbitrary order, and that this order may
-   change between two successive calls to |hsh_iterate|. */
+static void _hsh_set_key(tableType t, bucketType b, const void *key)
+{
+	if (t->flags & HSH_SIZED_KEYS) {
+		b->key                        = ((sizedKeyType)key)->key;
+		((sizedBucketType)b)->length = ((sizedKeyType)key)->length;
+	} else {
+		b->key = key;
+	}
+}
 
-int hsh_iterate_arg(hsh_HashTable table,
-					int (*iterator)(const void *key,
-									const void *datum,
-									void *arg),
-					void *arg)
+/* Give a table of lists an array of lists for at least |seed| lists, and
+   a pool for its buckets. */
+
+static void _hsh_lists_alloc(tableType t, unsigned long seed)
 {
-	tableType     t = (tableType)table;
 	unsigned long i;
-	bucketType    pt;
-	bucketType    next;		/* Save, because pt might vanish. */
 
-	_hsh_check(t, __func__);
+	t->prime    = _hsh_next_size(t->flags, seed);
+	t->buckets  = _hsh_alloc(t, t->prime * sizeof(bucketType));
+	t->nodes    = mem_create_objects2(_hsh_node_size(t), t->allocate,
+									  t->deallocate, t->allocator_arg);
+	t->min_size = t->prime;
+	if (t->flags & HSH_POWER_OF_TWO) t->shift = _hsh_shift(t->prime);
+	_hsh_set_limit(t);
 
-	for (i = 0; i < t->prime; i++) {
-		if (t->buckets[i]) {
-			for (pt = t->buckets[i]; pt; pt = next) {
-				next = pt->next;
-				if (iterator(pt->key, pt->datum, arg))
-					return 1;
-			}
-		}
-	}
-	return 0;
+	for (i = 0; i < t->prime; i++) t->buckets[i] = NULL;
 }
 
-/* a function callable from hsh_iterate() to print key values */
-static int _hsh_key_strings(const void *k, const void *d) {
-	const char *s;
-	static int i = 0;
-   
-	if (k == NULL) { i=0; return 0; }
-   
-	s = k;
-	printf("%s  ",s);
-	if ((i += strlen(s)+2) >= 60) { i=0; printf("\n"); }
-	return 0;
-}
+/* Make an HSH_SMALL table use the arrays that follow it in memory. */
 
-/* print all keys in table t as strings */
-void hsh_key_strings(hsh_HashTable t) {
-	_hsh_key_strings(NULL,NULL);
-	hsh_iterate(t,_hsh_key_strings);
-	printf("\n");
+static void _hsh_small_alloc(tableType t)
+{
+	t->small    = (unsigned char *)(t + 1);
+	t->prime    = HSH_GROUP;
+	t->min_size = HSH_GROUP;
+	t->deleted  = 0;
+	t->used     = 0;
+	t->tags     = t->small;
+	t->order    = (unsigned long *)(t->small + HSH_GROUP);
+	t->slots    = (slotType)(t->order + HSH_SMALL_MAX);
+	if (!(t->flags & HSH_ORDERED)) t->order = NULL;
+	memset(t->tags, HSH_TAG_EMPTY, HSH_GROUP);
 }
 
-/* \doc |hsh_get_stats| returns statistics about the |table|.  The
+static hsh_HashTable _hsh_create(const hsh_Options *o)
+{
+	tableType     t;
+	unsigned long seed    = 0;	/* Initial size */
+	int           flags   = o->flags;
+	unsigned long (*hash)(const void *) = o->hash;
+	int           (*compare)(const void *, const void *) = o->compare;
+   
+	t             = xmalloc(sizeof(struct table)
+							+ (flags & HSH_SMALL ? HSH_SMALL_BYTES : 0));
+#if MAA_MAGIC
+	t->magic      = HSH_MAGIC;
+#endif
+	t->entries    = 0;
+	t->buckets    = NULL;
+	t->resizings  = 0;
+	t->counters   = &t->own;
+	memset(&t->own, 0, sizeof(t->own));
+	t->hash       = hash ? hash : hsh_string_hash_fast;
+	t->compare    = compare ? compare : hsh_string_compare;
+	t->readonly   = 0;
+	t->flags      = flags;
+	t->tags       = NULL;
+	t->slots      = NULL;
+	t->order      = NULL;
+	t->used       = 0;
+	t->deleted    = 0;
+	t->nodes       = NULL;
+	t->old_buckets = NULL;
+	t->old_prime   = 0;
+	t->migrated    = 0;
+	t->shift       = 0;
+	t->old_shift   = 0;
+	t->concurrent  = NULL;
+	t->max_load    = o->max_load > 0 ? o->max_load : 0.5;
+	t->growth      = o->growth > 0 ? o->growth : 3;
+	t->seed        = hash ? 0 : o->seed;
+	t->allocate      = o->allocate;
+	t->deallocate    = o->deallocate;
+	t->allocator_arg = o->allocator_arg;
+	t->threads       = o->threads > 1 ? o->threads : 1;
+	if (t->threads > HSH_THREADS_MAX) t->threads = HSH_THREADS_MAX;
+	t->mapped        = 0;
+	t->small         = NULL;
+	t->min_size      = 0;
+	t->iterating     = 0;
+	t->profile       = NULL;
+	t->walked        = 0;
+	t->timing        = 0;
+	t->sorted        = NULL;
+	t->shared        = 0;
+	t->parked        = NULL;
+	t->snapshots     = NULL;
+
+	if (flags & HSH_ORDERED) t->flags = flags |= HSH_OPEN_ADDRESSING;
+	if (!o->allocate != !o->deallocate)
+		err_fatal(__func__, "Both allocate and deallocate must be given");
+	if (t->growth <= 1)
+		err_fatal(__func__, "Growth factor %g is too small", t->growth);
+	if ((flags & HSH_OPEN_ADDRESSING) && (flags & HSH_INCREMENTAL_RESIZE))
+		err_fatal(__func__,
+				  "HSH_INCREMENTAL_RESIZE requires a table of lists");
+	if ((flags & HSH_CONCURRENT)
+		&& (flags & (HSH_OPEN_ADDRESSING | HSH_INCREMENTAL_RESIZE)))
+		err_fatal(__func__,
+				  "HSH_CONCURRENT requires a table of lists resized at once");
+	if ((flags & HSH_SIZED_KEYS) && (flags & HSH_OPEN_ADDRESSING))
+		err_fatal(__func__, "HSH_SIZED_KEYS requires a table of lists");
+	if ((flags & HSH_SIZED_KEYS) && (hash || compare))
+		err_fatal(__func__,
+				  "HSH_SIZED_KEYS tables hash and compare keys themselves");
+	if ((flags & HSH_CONCURRENT) && !HSH_CONCURRENT_SUPPORTED)
+		err_fatal(__func__,
+				  "HSH_CONCURRENT is not supported by this compiler");
+	if ((flags & HSH_CONCURRENT) && (flags & HSH_PROFILE))
+		err_fatal(__func__, "HSH_PROFILE is not supported by HSH_CONCURRENT");
+	if ((flags & HSH_SMALL) && (flags & (HSH_CONCURRENT | HSH_SIZED_KEYS)))
+		err_fatal(__func__,
+				  "HSH_SMALL is not supported by HSH_CONCURRENT"
+				  " or HSH_SIZED_KEYS");
+	if ((flags & HSH_HUGE_PAGES) && o->allocate)
+		err_fatal(__func__,
+				  "HSH_HUGE_PAGES tables cannot have their own allocator");
+	if ((flags & HSH_RANDOM_SEED) && hash)
+		err_fatal(__func__, "HSH_RANDOM_SEED requires the default hash");
+	if ((flags & HSH_SORTED_LISTS)
+		&& (flags & (HSH_OPEN_ADDRESSING | HSH_CONCURRENT)))
+		err_fatal(__func__,
+				  "HSH_SORTED_LISTS requires a table of lists"
+				  " that is not concurrent");
+
+	if ((flags & HSH_RANDOM_SEED) && !t->seed)
+		t->seed = _hsh_random_seed();
+
+	if (flags & HSH_HUGE_PAGES) {
+		t->allocate      = mem_alloc_pages;
+		t->deallocate    = mem_free_pages;
+		t->allocator_arg = &t->mapped;
+	}
+
+	if (flags & HSH_PROFILE) {
+		t->profile = xmalloc(sizeof(hsh_Profile));
+		memset(t->profile, 0, sizeof(hsh_Profile));
+	}
+
+	if (o->entries && (flags & HSH_OPEN_ADDRESSING))
+		seed = o->entries + o->entries / 7 + 1;
+	else if (o->entries)
+		seed = o->entries / t->max_load + 1;
+
+	if ((flags & HSH_SMALL) && o->entries <= HSH_SMALL_MAX) {
+		_hsh_small_alloc(t);
+	} else if (flags & HSH_OPEN_ADDRESSING) {
+		unsigned long size = HSH_GROUP;
+
+		while (size < seed) size <<= 1;
+		_hsh_oa_alloc(t, size);
+		t->min_size = size;
+	} else if (flags & HSH_CONCURRENT) {
+		t->concurrent = xmalloc(sizeof(struct concurrent));
+		t->concurrent->retired       = NULL;
+		t->concurrent->retired_count = 0;
+		t->concurrent->retired_max   = 0;
+		t->nodes = mem_create_objects2(_hsh_node_size(t), t->allocate,
+									   t->deallocate, t->allocator_arg);
+		pthread_mutex_init(&t->concurrent->lock, NULL);
+		_hsh_cc_publish(t, _hsh_cc_alloc(t, _hsh_next_size(t->flags, seed)));
+		t->min_size = t->prime;
+	} else {
+		_hsh_lists_alloc(t, seed);
+	}
+
+	return t;
+}
+
+/* \doc The |hsh_create| function initilizes a generic hash table.  Keys
+   and data are pointers to "void".
+
+   The internal representation of the hash table will grow automatically
+   when an insertion is performed and the table is more than half full, and
+   shrink again when most of the entries are deleted (see |hsh_compact|).
+
+   The |hash| function should take a pointer to a |key| and return an
+   "unsigned long".  If |hash| is "NULL", then the |key| is assumed to be a
+   pointer to a null-terminated string, and |hsh_string_hash_fast| will be
+   used for |hash|.  The older \grind{hsh_string_hash}, which hashes one
+   byte at a time (the algorithm for this function is from
+   \cite[p.~435]{faith:Aho88}), is still available.
+
+   The |compare| function should take a pair of pointers to keys and return
+   zero if the keys are equal and non-zero if the keys are not equal.  If
+   |compare| is "NULL", then the keys are assumed to point to
+   null-terminated strings, and the |strcmp| function will be used for
+   |compare|.
+
+   Additionally, the |hsh_pointer_hash| (or |hsh_pointer_hash_fast|) and
+   |hsh_pointer_compare| functions are available and can be used to treat
+   the \emph{value} of the "void" pointer as the key.  These functions are
+   often useful for maintaining sets of objects. */
+
+hsh_HashTable hsh_create(
+	unsigned long (*hash)(const void *),
+	int (*compare)(const void *,
+				   const void *))
+{
+	return hsh_create2(hash, compare, 0);
+}
+
+/* \doc |hsh_create2| acts like |hsh_create|, but the internal
+   representation of the table is selected by |flags|.  If |flags| is
+   zero, the table is identical to the one created by |hsh_create|.
+
+   If |HSH_OPEN_ADDRESSING| is set, the keys, hash values and data are
+   stored in a flat array of slots instead of separately allocated
+   overflow lists, and a 7-bit tag taken from each hash value is stored in
+   a parallel array of bytes.  A lookup compares the tags of 16 slots at
+   once (using SSE2 instructions when available) and calls |compare| only
+   for slots whose tag and stored hash value match.  The table is kept no
+   more than 7/8 full.  Such tables are never self-organizing, but
+   otherwise support all of the |hsh_| functions and macros.
+
+   If |HSH_ORDERED| is set, the table uses open addressing, but the tags
+   are paired with an array of indices into a second array, in which the
+   slots are packed in the order of their insertion.  Iteration (with
+   |hsh_iterate| or |HSH_ITERATE|) then visits the entries in that order,
+   reading the packed array sequentially, and takes time proportional to
+   the number of entries rather than to the size of the table.  A deleted
+   entry leaves a hole in the packed array until the table is next
+   rebuilt; lookups follow one more index than in other open addressing
+   tables.
+
+   If |HSH_INCREMENTAL_RESIZE| is set, growing the table does not move
+   all of the entries at once.  Instead, the old array of lists is kept,
+   and each later insertion or deletion moves a few of its lists (without
+   reallocating any bucket) until it is empty.  Meanwhile, lookups search
+   both arrays.  This bounds the time of any single insertion.
+
+   If |HSH_POWER_OF_TWO| is set, the number of lists is a power of two,
+   and the list for a key is selected by the top bits of the product of
+   its hash value and a constant near $\frac{\sqrt{5}-1}{2}2^{64}$
+   (Fibonacci hashing) rather than by the remainder of a division by a
+   prime.  The multiplication also mixes all of the bits of the hash
+   value, so poor hash functions are tolerated.
+
+   If |HSH_CONCURRENT| is set, |hsh_retrieve| may be called by any number
+   of threads at once, and concurrently with |hsh_insert| and
+   |hsh_delete|, without locking.  Lookups never store into the table: the
+   lists are not self-organizing, and the retrieval counters of
+   |hsh_get_stats| stay zero.  Insertions and deletions are serialized by
+   a mutex inside the table.  When the table grows, the new array of lists
+   is filled with copies of the buckets before it replaces the old one,
+   and memory removed from the table is freed only after every lookup that
+   could have seen it has returned.  Iteration, statistics and
+   |hsh_destroy| must not run concurrently with any other call on the
+   table.
+
+   If |HSH_SIZED_KEYS| is set, |hash| and |compare| must be "NULL".  Each
+   key is a string of bytes with an explicit length (see |hsh_insert_n|),
+   which need not be null-terminated.  Keys are hashed with the function
+   used by |hsh_string_hash_fast| and compared by length and |memcmp|.
+   |hsh_insert|, |hsh_delete| and |hsh_retrieve| may still be used with
+   null-terminated keys.  Such tables cannot use open addressing.
+
+   If |HSH_HUGE_PAGES| is set, the arrays and buckets of the table come
+   from |mem_alloc_pages|, so that those of a large table are backed by
+   huge pages, and each pool page of buckets fills a huge page.  Random
+   lookups in a table of many gigabytes then miss in the TLB far less
+   often.  |hsh_get_stats| reports the bytes mapped, and the numbers of
+   small and huge pages that span them.
+
+   If |HSH_SMALL| is set, a table that was not asked for more entries (see
+   |hsh_create_ex|) holds its first 8 entries in a single group of open
+   addressing whose arrays are part of the table's own allocation, so that
+   a small table costs one allocation, and a lookup compares 16 tags at
+   once and then at most a few slots.  At its 9th entry (or when
+   |hsh_reserve| asks for more), the table moves to the layout selected by
+   the other flags, which it keeps even if most entries are deleted later.
+   Tables with many entries are unaffected, except that each carries the
+   unused inline arrays.  |HSH_SMALL| cannot be used with |HSH_CONCURRENT|
+   or |HSH_SIZED_KEYS|.
+
+   If |HSH_SORTED_LISTS| is set, a list that a lookup finds to hold 16
+   buckets or more (because the keys collide, or the hash function is
+   poor) is sorted by hash value and indexed by an array of its buckets,
+   so that later lookups in it are binary searches, and take logarithmic
+   rather than linear time.  Insertions and deletions keep the list
+   sorted, and the index is dropped when the list falls below 8 buckets,
+   or when the table is resized.  Sorted lists are not self-organized.
+   Keys whose hash values are identical are still compared one by one.
+   |HSH_SORTED_LISTS| cannot be used with |HSH_OPEN_ADDRESSING| or
+   |HSH_CONCURRENT|.
+
+   If |HSH_RANDOM_SEED| is set, |hash| must be "NULL" (or |HSH_SIZED_KEYS|
+   given), and the keys are hashed with a seed drawn for the table (see
+   |hsh_create_ex|).  The seeds of different tables are unrelated, and
+   cannot be guessed from outside the process, so that keys cannot be
+   chosen to collide, and the time taken by a lookup does not depend on
+   who supplied the keys.  Iterating over such a table visits the entries
+   in an order that differs from run to run.
+
+   Only one of |HSH_OPEN_ADDRESSING| (or |HSH_ORDERED|),
+   |HSH_INCREMENTAL_RESIZE| and |HSH_CONCURRENT| may be given.  Open
+   addressing tables always have a power-of-two size. */
+
+hsh_HashTable hsh_create2(
+	unsigned long (*hash)(const void *),
+	int (*compare)(const void *,
+				   const void *),
+	int flags)
+{
+	hsh_Options o;
+
+	memset(&o, 0, sizeof(o));
+	o.hash    = hash;
+	o.compare = compare;
+	o.flags   = flags;
+	return _hsh_create(&o);
+}
+
+/* \doc |hsh_create_ex| creates a table as described by the |options|
+   structure, shown in \grind{hsh_Options}.  Fields that are zero (or
+   "NULL") select the behavior of |hsh_create2|, so a structure cleared
+   with |memset| is a good start.
+
+   |hash|, |compare| and |flags| are as for |hsh_create2|.
+
+   If |entries| is set, the table is created large enough to hold that
+   many entries without growing.
+
+   A table of lists grows when it holds more than |max_load| entries per
+   list (by default, 0.5), and then has |growth| times as many lists (by
+   default, 3).  |growth| must be greater than one.  Open addressing
+   tables ignore these two fields.
+
+   If |seed| is non-zero and |hash| is "NULL", the keys are hashed with
+   the function of |hsh_string_hash_fast| perturbed by |seed|, so that the
+   layout of the table cannot be predicted without knowing the seed.
+   |HSH_RANDOM_SEED| in |flags| draws a seed if |seed| is zero.
+
+   If |allocate| and |deallocate| are given, the arrays and buckets of the
+   table are obtained from |allocate(size, allocator_arg)| and returned
+   with |deallocate(pointer, allocator_arg)|.  |allocate| should return
+   memory suitably aligned for any object.
+
+   If |threads| is greater than one, a table of lists holding many
+   entries (and not resized incrementally) grows with that many threads:
+   the buckets are grouped by the range of new lists that they move to,
+   and each range is then filled by one thread.  The allocator is never
+   called by two threads at once.  No more than 256 threads are used. */
+
+hsh_HashTable hsh_create_ex(const hsh_Options *options)
+{
+	hsh_Options o;
+
+	if (options) return _hsh_create(options);
+	memset(&o, 0, sizeof(o));
+	return _hsh_create(&o);
+}
+
+/* Lists of HSH_SORTED_LISTS tables.  A list is sorted when a lookup that
+   may reorganize the table walks at least HSH_SORTED_MIN of its buckets,
+   and all of the indices are dropped whenever the buckets are relinked
+   into a new array. */
+
+static int _hsh_sortable(tableType t, unsigned long walked)
+{
+	return walked >= HSH_SORTED_MIN && (t->flags & HSH_SORTED_LISTS)
+		&& !t->readonly && !t->iterating && !t->old_buckets
+		&& !t->snapshots;
+}
+
+static sortedType _hsh_sorted_alloc(tableType t, unsigned long room)
+{
+	sortedType s = _hsh_alloc(t, sizeof(struct sorted)
+							  + (room - 1) * sizeof(bucketType));
+
+	s->count = 0;
+	s->room  = room;
+	return s;
+}
+
+static int _hsh_sorted_compare(const void *a, const void *b)
+{
+	unsigned long x = (*(const bucketType *)a)->hash;
+	unsigned long y = (*(const bucketType *)b)->hash;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sort list |h| of |t| by hash, and index it. */
+
+static void _hsh_sort_list(tableType t, unsigned long h)
+{
+	sortedType    s;
+	bucketType    pt;
+	unsigned long n;
+	unsigned long i;
+
+	if (!t->sorted) {
+		t->sorted = _hsh_alloc(t, t->prime * sizeof(sortedType));
+		memset(t->sorted, 0, t->prime * sizeof(sortedType));
+	}
+
+	for (n = 0, pt = t->buckets[h]; pt; pt = pt->next) ++n;
+	s        = _hsh_sorted_alloc(t, 2 * n);
+	s->count = n;
+	for (i = 0, pt = t->buckets[h]; pt; pt = pt->next) s->nodes[i++] = pt;
+	qsort(s->nodes, n, sizeof(bucketType), _hsh_sorted_compare);
+
+	for (i = 0; i + 1 < n; i++) s->nodes[i]->next = s->nodes[i + 1];
+	s->nodes[n - 1]->next = NULL;
+	t->buckets[h] = s->nodes[0];
+	t->sorted[h]  = s;
+}
+
+/* Return the index of the first bucket of |s| whose hash is not below
+   |hash|. */
+
+static unsigned long _hsh_sorted_bound(sortedType s, unsigned long hash)
+{
+	unsigned long lo = 0;
+	unsigned long hi = s->count;
+
+	while (lo < hi) {
+		unsigned long mid = lo + (hi - lo) / 2;
+
+		if (s->nodes[mid]->hash < hash) lo = mid + 1;
+		else                            hi = mid;
+	}
+	return lo;
+}
+
+/* Return the bucket of |key| in the sorted list |s|, or "NULL".  If
+   |index| is not "NULL", the index of the bucket in |s| is stored
+   there. */
+
+static bucketType _hsh_sorted_find(
+	tableType t,
+	sortedType s,
+	unsigned long hash,
+	const void *key,
+	unsigned long *index)
+{
+	unsigned long first = _hsh_sorted_bound(s, hash);
+	unsigned long i;
+	int           found;
+
+	for (i = first; i < s->count && s->nodes[i]->hash == hash; i++)
+		if (_hsh_equal(t, s->nodes[i], hash, key)) break;
+	found = i < s->count && s->nodes[i]->hash == hash;
+
+	if (t->profile) t->walked += i - first + 1;
+	if (i - first + found > HSH_LONG_CHAIN) ++t->counters->long_chains;
+	if (index) *index = i;
+	return found ? s->nodes[i] : NULL;
+}
+
+/* Link the new bucket |b| into the sorted list |h|. */
+
+static void _hsh_sorted_link(tableType t, unsigned long h, bucketType b)
+{
+	sortedType    s = t->sorted[h];
+	unsigned long i = _hsh_sorted_bound(s, b->hash);
+
+	if (s->count == s->room) {
+		sortedType bigger = _hsh_sorted_alloc(t, 2 * s->room);
+
+		bigger->count = s->count;
+		memcpy(bigger->nodes, s->nodes, s->count * sizeof(bucketType));
+		_hsh_free(t, s);
+		t->sorted[h] = s = bigger;
+	}
+
+	b->next = i < s->count ? s->nodes[i] : NULL;
+	if (i) s->nodes[i - 1]->next = b;
+	else   t->buckets[h]         = b;
+	memmove(s->nodes + i + 1, s->nodes + i,
+			(s->count - i) * sizeof(bucketType));
+	s->nodes[i] = b;
+	++s->count;
+}
+
+/* Unlink the bucket with index |i| from the sorted list |h|, and return
+   it.  A list that has become short is no longer indexed. */
+
+static bucketType _hsh_sorted_unlink(tableType t, unsigned long h,
+									 unsigned long i)
+{
+	sortedType s = t->sorted[h];
+	bucketType b = s->nodes[i];
+
+	if (i) s->nodes[i - 1]->next = b->next;
+	else   t->buckets[h]         = b->next;
+	memmove(s->nodes + i, s->nodes + i + 1,
+			(s->count - i - 1) * sizeof(bucketType));
+	if (--s->count < HSH_SORTED_MIN / 2) {
+		_hsh_free(t, s);
+		t->sorted[h] = NULL;
+	}
+	return b;
+}
+
+/* Drop the indices of all sorted lists, before the buckets are relinked
+   or freed. */
+
+static void _hsh_sorted_drop(tableType t)
+{
+	unsigned long i;
+
+	if (!t->sorted) return;
+	for (i = 0; i < t->prime; i++)
+		if (t->sorted[i]) _hsh_free(t, t->sorted[i]);
+	_hsh_free(t, t->sorted);
+	t->sorted = NULL;
+}
+
+/* Snapshots.  While a snapshot is attached to a table, the table keeps
+   its arrays, and each change to a span of lists or tags first saves a
+   copy of the span in every attached snapshot that has none yet.  Lists
+   are not reorganized by lookups, nor is the table shrunk, meanwhile.  A
+   change to the whole table (a resize, for instance) saves all of the
+   spans first, and so detaches the snapshots from it. */
+
+static struct saved _hsh_saved_none;	/* A span without entries */
+
+/* Return a copy of the entries of span |n| of |t|. */
+
+static savedType _hsh_snapshot_copy(tableType t, unsigned long n)
+{
+	unsigned long first = n * HSH_SNAPSHOT_SPAN;
+	unsigned long last  = first + HSH_SNAPSHOT_SPAN;
+	unsigned long count = 0;
+	unsigned long i;
+	bucketType    pt;
+	savedType     s;
+
+	if (last > t->prime) last = t->prime;
+	for (i = first; i < last; i++) {
+		if (t->slots) count += HSH_TAG_FULL(t->tags[i]);
+		else for (pt = t->buckets[i]; pt; pt = pt->next) ++count;
+	}
+	if (!count) return &_hsh_saved_none;
+
+	s        = xmalloc(offsetof(struct saved, entries)
+					   + count * sizeof(struct saved_entry));
+	s->count = 0;
+	for (i = first; i < last; i++) {
+		if (t->slots) {
+			if (!HSH_TAG_FULL(t->tags[i])) continue;
+			s->entries[s->count].key     = t->slots[i].key;
+			s->entries[s->count++].datum = t->slots[i].datum;
+		} else {
+			for (pt = t->buckets[i]; pt; pt = pt->next) {
+				s->entries[s->count].key     = pt->key;
+				s->entries[s->count++].datum = pt->datum;
+			}
+		}
+	}
+	return s;
+}
+
+static void _hsh_saved_free(savedType s)
+{
+	if (s && s != &_hsh_saved_none) xfree(s);
+}
+
+/* Save the span holding list (or tag) |index| of |t| in the snapshots
+   attached to |t|, before it is changed.  Snapshots that have every span
+   saved are detached. */
+
+static void _hsh_snapshot_save(tableType t, unsigned long index)
+{
+	unsigned long n = index / HSH_SNAPSHOT_SPAN;
+	snapshotType  *prev;
+	snapshotType  s;
+
+	for (prev = &t->snapshots; (s = *prev);) {
+		pthread_mutex_lock(&s->lock);
+		if (!s->saved[n]) {
+			s->saved[n] = _hsh_snapshot_copy(t, n);
+			if (!--s->unsaved) s->table = NULL;
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		if (s->table) prev = &s->next;
+		else          *prev = s->next;
+	}
+}
+
+/* Save every span of |t| in the snapshots attached to it, and detach
+   them, before the arrays of |t| are rebuilt or freed. */
+
+static void _hsh_snapshot_detach(tableType t)
+{
+	snapshotType  s;
+	unsigned long n;
+
+	for (s = t->snapshots; s; s = s->next) {
+		pthread_mutex_lock(&s->lock);
+		for (n = 0; n < s->spans; n++)
+			if (!s->saved[n]) s->saved[n] = _hsh_snapshot_copy(t, n);
+		s->unsaved = 0;
+		s->table   = NULL;
+		pthread_mutex_unlock(&s->lock);
+	}
+	t->snapshots = NULL;
+}
+
+static void _hsh_destroy_buckets(hsh_HashTable table)
+{
+	tableType     t    = (tableType)table;
+
+	_hsh_check(t, __func__);
+	if (t->concurrent) {
+		concurrentType c = t->concurrent;
+		unsigned long  i;
+
+		for (i = 0; i < c->retired_count; i++)
+			if (c->retired[i].lists) _hsh_free(t, c->retired[i].pt);
+		if (c->retired) xfree(c->retired); /* terminal */
+		_hsh_free(t, c->lists);	/* terminal */
+		pthread_mutex_destroy(&c->lock);
+		xfree(c);			/* terminal */
+		mem_destroy_objects(t->nodes); /* terminal */
+		t->concurrent = NULL;
+		t->nodes      = NULL;
+		t->buckets    = NULL;
+		return;
+	}
+	if (t->slots) {
+		if (!t->small) {
+			_hsh_free(t, t->tags);	/* terminal */
+			_hsh_free(t, t->slots);	/* terminal */
+			if (t->order) _hsh_free(t, t->order); /* terminal */
+		}
+		t->tags  = NULL;
+		t->slots = NULL;
+		t->order = NULL;
+		return;
+	}
+
+	_hsh_sorted_drop(t);
+	mem_destroy_objects(t->nodes);	/* terminal */
+	_hsh_free(t, t->buckets);	/* terminal */
+	if (t->old_buckets) _hsh_free(t, t->old_buckets); /* terminal */
+	t->nodes       = NULL;
+	t->buckets     = NULL;
+	t->old_buckets = NULL;
+}
+
+static void _hsh_destroy_table(hsh_HashTable table)
+{
+	tableType t = (tableType)table;
+   
+	if (t->profile) xfree(t->profile); /* terminal */
+#if MAA_MAGIC
+	t->magic = HSH_MAGIC_FREED;
+#endif
+	xfree(t);			/* terminal */
+}
+
+/* \doc |hsh_destroy| frees all of the memory associated with the hash
+   table.
+
+   The memory used by keys and data is \emph{not} freed---this memory is
+   the responsibility of the user.  However, a call to |hsh_iterate|
+   can be used to free this memory \emph{immediately} before a call to
+   |hsh_destroy|. */
+
+void hsh_destroy(hsh_HashTable table)
+{
+	_hsh_check(table, __func__);
+	hsh_shared(table, 0);
+	if (((tableType)table)->readonly)
+		err_internal(__func__, "Attempt to destroy readonly table");
+	if (((tableType)table)->snapshots) _hsh_snapshot_detach(table);
+	_hsh_destroy_buckets(table);
+	_hsh_destroy_table(table);
+}
+
+/* Return the slot to be used for a new entry with the given |hash| in an
+   open addressing table.  The caller fills in the slot. */
+
+static slotType _hsh_oa_place(tableType t, unsigned long hash)
+{
+	unsigned long mix  = _hsh_def_mix(hash);
+	unsigned long mask = t->prime / HSH_GROUP - 1;
+	unsigned long g    = (mix >> 7) & mask;
+	unsigned long step = 0;
+	unsigned      free;
+	unsigned long i;
+
+	while (!(free = _hsh_def_free(t->tags + g * HSH_GROUP)))
+		g = (g + ++step) & mask;
+	if (t->snapshots) _hsh_snapshot_save(t, g * HSH_GROUP);
+
+	i = g * HSH_GROUP + _hsh_def_first_bit(free);
+	if (t->tags[i] == HSH_TAG_DELETED) --t->deleted;
+	t->tags[i] = mix & 0x7f;
+
+	if (t->order) t->order[i] = t->used++;
+	return _hsh_oa_slot(t, i);
+}
+
+/* Return the slot holding |key| in an open addressing table, or "NULL".
+   If |probes| is not "NULL", it is set to the number of groups examined
+   after the first one.  If |index| is not "NULL", it is set to the index
+   of the tag of the slot. */
+
+static slotType _hsh_oa_find(
+	tableType t,
+	unsigned long hash,
+	const void *key,
+	unsigned long *probes,
+	unsigned long *index)
+{
+	unsigned long mix  = _hsh_def_mix(hash);
+	unsigned char tag  = mix & 0x7f;
+	unsigned long mask = t->prime / HSH_GROUP - 1;
+	unsigned long g    = (mix >> 7) & mask;
+	unsigned long step;
+
+	for (step = 0; step <= mask; g = (g + ++step) & mask) {
+		const unsigned char *tags  = t->tags + g * HSH_GROUP;
+		unsigned            match = _hsh_def_match(tags, tag);
+
+		while (match) {
+			unsigned long i = g * HSH_GROUP + _hsh_def_first_bit(match);
+			slotType      s = _hsh_oa_slot(t, i);
+
+			if (s->hash == hash) {
+				if (t->profile) ++t->profile->compares;
+				if (!t->compare(s->key, key)) {
+					if (t->profile) t->walked += step + 1;
+					if (step >= HSH_LONG_PROBE) ++t->counters->long_chains;
+					if (probes) *probes = step;
+					if (index) *index = i;
+					return s;
+				}
+			}
+			match &= match - 1;
+		}
+
+		/* An entry is never placed beyond a group with an empty slot */
+		if (_hsh_def_match(tags, HSH_TAG_EMPTY)) break;
+	}
+
+	if (t->profile) t->walked += step + 1;
+	if (step >= HSH_LONG_PROBE) ++t->counters->long_chains;
+	return NULL;
+}
+
+/* Rebuild an open addressing table with |size| tags.  The slots of an
+   ordered table are moved in order, leaving out the deleted ones. */
+
+static void _hsh_oa_resize(tableType t, unsigned long size)
+{
+	unsigned char *tags  = t->tags;
+	slotType      slots  = t->slots;
+	unsigned long *order = t->order;
+	unsigned long prime  = t->prime;
+	unsigned long used   = t->used;
+	unsigned long i;
+	double        start;
+
+	if (t->snapshots) _hsh_snapshot_detach(t);
+	start = _hsh_profile_begin(t);
+	_hsh_oa_alloc(t, size);
+	if (order) {
+		for (i = 0; i < used; i++)
+			if (slots[i].key != HSH_REMOVED)
+				*_hsh_oa_place(t, slots[i].hash) = slots[i];
+	} else {
+		for (i = 0; i < prime; i++)
+			if (HSH_TAG_FULL(tags[i]))
+				*_hsh_oa_place(t, slots[i].hash) = slots[i];
+	}
+
+	if (tags == t->small) {
+		t->small = NULL;	/* The inline arrays are left unused */
+	} else {
+		_hsh_free(t, tags);
+		_hsh_free(t, slots);
+		if (order) _hsh_free(t, order);
+	}
+	++t->resizings;
+	_hsh_profile_end(t, start);
+}
+
+/* Add an entry for |key|, which is known to be absent, to an open
+   addressing table, and return its slot. */
+
+static slotType _hsh_oa_add(
+	tableType t,
+	unsigned long hash,
+	const void *key)
+{
+	slotType s;
+
+	/* Keep table no more than 7/8 full, counting deleted slots (and, in
+	   an ordered table, the deleted entries of the dense array).  If most
+	   of those are deleted, rebuilding at the same size is enough. */
+	if ((t->entries + t->deleted + 1) * 8 > t->prime * 7
+		|| t->used == _hsh_oa_capacity(t, t->prime))
+		_hsh_oa_resize(t, (t->entries + 1) * 16 > t->prime * 7
+					   ? t->prime * 2 : t->prime);
+
+	s        = _hsh_oa_place(t, hash);
+	s->key   = key;
+	s->hash  = hash;
+	s->datum = NULL;
+	++t->entries;
+
+	return s;
+}
+
+/* Remove the entry whose tag has index |i| from an open addressing
+   table. */
+
+static void _hsh_oa_erase(tableType t, unsigned long i)
+{
+	unsigned char *tags = t->tags + i / HSH_GROUP * HSH_GROUP;
+
+	if (t->snapshots) _hsh_snapshot_save(t, i);
+	if (t->order) {
+		slotType s = t->slots + t->order[i];
+
+		s->key = HSH_REMOVED;
+		if (s == t->slots + t->used - 1) --t->used;
+	}
+
+	/* If the group still has an empty slot, no probe sequence continues
+	   past it, so the slot can become empty too. */
+	if (_hsh_def_match(tags, HSH_TAG_EMPTY)) {
+		t->tags[i] = HSH_TAG_EMPTY;
+	} else {
+		t->tags[i] = HSH_TAG_DELETED;
+		++t->deleted;
+	}
+	--t->entries;
+}
+
+static bucketType _hsh_insert(
+	hsh_HashTable table,
+	unsigned long hash,
+	const void *key,
+	const void *datum)
+{
+	tableType     t = (tableType)table;
+	unsigned long h = HSH_INDEX(hash, t->prime, t->shift);
+	bucketType    b;
+
+	_hsh_check(t, __func__);
+   
+	b        = mem_get_object(t->nodes);
+	b->hash  = hash;
+	b->datum = datum;
+	b->next  = NULL;
+	_hsh_set_key(t, b, key);
+   
+	if (t->snapshots) _hsh_snapshot_save(t, h);
+	if (t->sorted && t->sorted[h]) {
+		_hsh_sorted_link(t, h, b);
+	} else {
+		if (t->buckets[h]) b->next = t->buckets[h];
+		t->buckets[h] = b;
+	}
+	++t->entries;
+
+	return b;
+}
+
+/* Move up to |count| lists from the old array of a table being resized
+   to the current array.  The buckets themselves are relinked, not
+   copied. */
+
+static void _hsh_migrate(tableType t, unsigned long count)
+{
+	double start = _hsh_profile_begin(t);
+
+	for (; count && t->migrated < t->old_prime; --count, ++t->migrated) {
+		bucketType pt;
+		bucketType next;
+
+		for (pt = t->old_buckets[t->migrated]; pt; pt = next) {
+			unsigned long h = HSH_INDEX(pt->hash, t->prime, t->shift);
+
+			next          = pt->next;
+			pt->next      = t->buckets[h];
+			t->buckets[h] = pt;
+		}
+		t->old_buckets[t->migrated] = NULL;
+	}
+
+	if (t->migrated == t->old_prime) {
+		_hsh_free(t, t->old_buckets);
+		t->old_buckets = NULL;
+		t->old_prime   = 0;
+		t->migrated    = 0;
+	}
+	_hsh_profile_end(t, start);
+}
+
+/* Call |work(arg + i * size)| for each |i| below |threads|, in as many
+   threads, and wait for them to finish. */
+
+static void _hsh_parallel(
+	void *(*work)(void *),
+	void *arg,
+	size_t size,
+	int threads)
+{
+	pthread_t *id = xmalloc(threads * sizeof(pthread_t)); /* id[0] unused */
+	int       i;
+
+	for (i = 1; i < threads; i++)
+		if (pthread_create(&id[i], NULL, work, (char *)arg + i * size))
+			err_fatal_errno(__func__, "Cannot create thread");
+	work(arg);
+	for (i = 1; i < threads; i++) pthread_join(id[i], NULL);
+	xfree(id);
+}
+
+				/* Entries of a table of lists divided
+				   among threads, each of which then fills
+				   a range of lists alone */
+typedef struct partition {
+	tableType     t;
+	int           threads;
+	unsigned long width;		/* Lists in each range */
+	unsigned long *counts;	/* Entries of each thread for each range */
+	unsigned long *ranges;	/* Start of the entries of each range */
+	void          **items;	/* Entries grouped by range */
+} *partitionType;
+
+typedef struct worker {
+	partitionType p;
+	int           id;
+	void          *arg;		/* Private to the caller */
+} *workerType;
+
+/* Allocate the counts of |p|, and return the workers for its threads. */
+
+static workerType _hsh_partition_init(partitionType p, tableType t,
+									  int threads, void *arg)
+{
+	workerType w = xmalloc(threads * sizeof(struct worker));
+	int        i;
+
+	p->t       = t;
+	p->threads = threads;
+	p->width   = (t->prime + threads - 1) / threads;
+	p->counts  = xcalloc(threads * threads, sizeof(unsigned long));
+	p->ranges  = xmalloc((threads + 1) * sizeof(unsigned long));
+	p->items   = NULL;
+	for (i = 0; i < threads; i++) {
+		w[i].p   = p;
+		w[i].id  = i;
+		w[i].arg = arg;
+	}
+	return w;
+}
+
+/* Turn the counts of |p| into the positions at which each thread stores
+   its entries for each range, in an array grouped by range, and
+   allocate that array. */
+
+static void _hsh_partition_group(partitionType p)
+{
+	unsigned long total = 0;
+	int           range;
+	int           id;
+
+	for (range = 0; range < p->threads; range++) {
+		p->ranges[range] = total;
+		for (id = 0; id < p->threads; id++) {
+			unsigned long count = p->counts[id * p->threads + range];
+
+			p->counts[id * p->threads + range] = total;
+			total += count;
+		}
+	}
+	p->ranges[p->threads] = total;
+	p->items = xmalloc((total + 1) * sizeof(void *));
+}
+
+static void _hsh_partition_free(partitionType p, workerType w)
+{
+	if (p->items) xfree(p->items);
+	xfree(p->counts);
+	xfree(p->ranges);
+	xfree(w);
+}
+
+/* Count (or, once |p->items| exists, store) the buckets of the old lists
+   given to thread |id| of a parallel rebuild, by new range. */
+
+static void *_hsh_rehash_scan(void *arg)
+{
+	workerType    w      = (workerType)arg;
+	partitionType p      = w->p;
+	tableType     t      = p->t;
+	unsigned long *count = p->counts + w->id * p->threads;
+	unsigned long step   = t->old_prime / p->threads;
+	unsigned long from   = step * w->id;
+	unsigned long to     = w->id == p->threads - 1 ? t->old_prime
+		: from + step;
+	unsigned long i;
+	bucketType    pt;
+
+	for (i = from; i < to; i++)
+		for (pt = t->old_buckets[i]; pt; pt = pt->next) {
+			unsigned long range = HSH_INDEX(pt->hash, t->prime, t->shift)
+				/ p->width;
+
+			if (p->items) p->items[count[range]] = pt;
+			++count[range];
+		}
+	return NULL;
+}
+
+/* Link the buckets of range |id| into the new lists. */
+
+static void *_hsh_rehash_link(void *arg)
+{
+	workerType    w = (workerType)arg;
+	partitionType p = w->p;
+	tableType     t = p->t;
+	unsigned long i;
+
+	for (i = p->ranges[w->id]; i < p->ranges[w->id + 1]; i++) {
+		bucketType    pt = p->items[i];
+		unsigned long h  = HSH_INDEX(pt->hash, t->prime, t->shift);
+
+		pt->next      = t->buckets[h];
+		t->buckets[h] = pt;
+	}
+	return NULL;
+}
+
+/* Move all of the buckets of the old array of lists to the current one
+   with |t->threads| threads.  The buckets are first grouped by the range
+   of new lists that they go to, and then each range is filled by one
+   thread. */
+
+static void _hsh_migrate_parallel(tableType t)
+{
+	struct partition p;
+	workerType       w = _hsh_partition_init(&p, t, t->threads, NULL);
+
+	_hsh_parallel(_hsh_rehash_scan, w, sizeof(struct worker), p.threads);
+	_hsh_partition_group(&p);
+	_hsh_parallel(_hsh_rehash_scan, w, sizeof(struct worker), p.threads);
+	_hsh_parallel(_hsh_rehash_link, w, sizeof(struct worker), p.threads);
+	_hsh_partition_free(&p, w);
+
+	t->migrated = t->old_prime;
+	_hsh_migrate(t, 0);
+}
+
+/* Switch to a new array of |prime| lists (which should come from
+   |_hsh_next_size|).  Unless the table is resized incrementally, all of
+   the buckets are moved at once. */
+
+static void _hsh_resize(tableType t, unsigned long prime)
+{
+	unsigned long i;
+	double        start;
+
+	if (t->snapshots) _hsh_snapshot_detach(t);
+	start = _hsh_profile_begin(t);
+	if (t->old_buckets) _hsh_migrate(t, t->old_prime);
+	_hsh_sorted_drop(t);
+
+	t->old_buckets = t->buckets;
+	t->old_prime   = t->prime;
+	t->old_shift   = t->shift;
+	t->migrated    = 0;
+	t->buckets     = _hsh_alloc(t, prime * sizeof(bucketType));
+	t->prime       = prime;
+	t->shift       = t->shift ? _hsh_shift(prime) : 0;
+	++t->resizings;
+	_hsh_set_limit(t);
+
+	for (i = 0; i < prime; i++) t->buckets[i] = NULL;
+
+	if (t->flags & HSH_INCREMENTAL_RESIZE)
+		;
+	else if (t->threads > 1 && t->entries >= HSH_PARALLEL_MIN)
+		_hsh_migrate_parallel(t);
+	else
+		_hsh_migrate(t, t->old_prime);
+	_hsh_profile_end(t, start);
+}
+
+/* Make an HSH_SMALL table that uses its inline arrays ready for
+   |entries| entries.  If they still fit, the table is only an ordered
+   one with holes in its packed array, which are closed.  Otherwise, the
+   table is rebuilt in the layout selected by its flags. */
+
+static void _hsh_small_grow(tableType t, unsigned long entries)
+{
+	struct slot   live[HSH_SMALL_MAX];
+	unsigned long n = 0;
+	unsigned long i;
+	unsigned long size;
+	slotType      s;
+	double        start;
+
+	if (entries > HSH_SMALL_MAX && (t->flags & HSH_OPEN_ADDRESSING)) {
+		for (size = 2 * HSH_GROUP; entries * 8 > size * 7; size <<= 1);
+		_hsh_oa_resize(t, size);
+		return;
+	}
+
+	start = _hsh_profile_begin(t);
+	for (s = _hsh_oa_next(t, NULL); s; s = _hsh_oa_next(t, s)) live[n++] = *s;
+
+	if (entries <= HSH_SMALL_MAX) {
+		memset(t->tags, HSH_TAG_EMPTY, HSH_GROUP);
+		t->used = 0;
+		for (i = 0; i < n; i++) *_hsh_oa_place(t, live[i].hash) = live[i];
+	} else {
+		t->small   = NULL;
+		t->tags    = NULL;
+		t->slots   = NULL;
+		t->entries = 0;
+		_hsh_lists_alloc(t, entries / t->max_load + 1);
+		for (i = 0; i < n; i++)
+			_hsh_insert(t, live[i].hash, live[i].key, live[i].datum);
+		++t->resizings;
+	}
+	_hsh_profile_end(t, start);
+}
+
+/* Return the bucket of |key| in the list |pt|, or "NULL".  If |walked|
+   is not "NULL", it is set to the number of buckets examined. */
+
+static bucketType _hsh_find_list(
+	tableType t,
+	bucketType pt,
+	unsigned long hash,
+	const void *key,
+	unsigned long *walked)
+{
+	unsigned long n;
+
+	for (n = 1; pt; pt = pt->next, n++)
+		if (_hsh_equal(t, pt, hash, key)) break;
+	if (pt) {
+		if (t->profile) t->walked += n;
+		if (n > HSH_LONG_CHAIN) ++t->counters->long_chains;
+		if (walked) *walked = n;
+		return pt;
+	}
+	if (t->profile) t->walked += n - 1;
+	if (n > HSH_LONG_CHAIN + 1) ++t->counters->long_chains;
+	if (walked) *walked = n - 1;
+	return NULL;
+}
+
+/* Return the address of the datum of |key|, or "NULL", without
+   reorganizing the lists.  Concurrent tables are only searched by their
+   writers.  Since the datum may be changed through the address, the span
+   holding it is saved in the snapshots of the table. */
+
+static const void **_hsh_find_slot(
+	tableType t,
+	unsigned long hash,
+	const void *key)
+{
+	slotType      s;
+	bucketType    pt;
+	unsigned long h;
+	unsigned long walked;
+
+	if (t->slots) {
+		s = _hsh_oa_find(t, hash, key, NULL, NULL);
+		if (t->profile) _hsh_profile_lookup(t);
+		if (s && t->snapshots) _hsh_snapshot_save(t, s - t->slots);
+		return s ? &s->datum : NULL;
+	}
+
+	h = HSH_INDEX(hash, t->prime, t->shift);
+	if (t->sorted && t->sorted[h]) {
+		pt = _hsh_sorted_find(t, t->sorted[h], hash, key, NULL);
+	} else {
+		pt = _hsh_find_list(t, t->buckets[h], hash, key, &walked);
+		if (_hsh_sortable(t, walked)) _hsh_sort_list(t, h);
+	}
+	if (!pt && t->old_buckets)
+		pt = _hsh_find_list(t, t->old_buckets[HSH_INDEX(hash,
+														t->old_prime,
+														t->old_shift)],
+							hash, key, NULL);
+	if (t->profile) _hsh_profile_lookup(t);
+	if (pt && t->snapshots) _hsh_snapshot_save(t, h);
+	return pt ? &pt->datum : NULL;
+}
+
+/* Writers to a concurrent table hold its lock while calling the
+   following functions. */
+
+static void _hsh_cc_retire(tableType t, void *pt, int lists)
+{
+	concurrentType c = t->concurrent;
+	retiredType    r;
+
+	if (c->retired_count == c->retired_max) {
+		c->retired_max = c->retired_max ? c->retired_max * 2 : 16;
+		c->retired     = xrealloc(c->retired,
+								  c->retired_max * sizeof(struct retired));
+	}
+	r        = c->retired + c->retired_count++;
+	r->pt    = pt;
+	r->lists = lists;
+	HSH_FENCE();			/* The unlinking comes first */
+	r->epoch = HSH_LOAD(_hsh_epoch);
+}
+
+/* Free the retired memory that no lookup can reach any more.  The
+   buckets of a retired array of lists were replaced by copies, so they
+   are freed with the array. */
+
+static void _hsh_cc_reclaim(tableType t)
+{
+	concurrentType c     = t->concurrent;
+	unsigned long  epoch = _hsh_epoch_advance();
+	unsigned long  i;
+	unsigned long  j;
+
+	for (i = j = 0; i < c->retired_count; i++) {
+		retiredType r = c->retired + i;
+
+		if (r->epoch + 2 > epoch) {
+			c->retired[j++] = *r;
+		} else if (r->lists) {
+			listsType     l = r->pt;
+			unsigned long k;
+			bucketType    pt;
+			bucketType    next;
+
+			for (k = 0; k < l->prime; k++)
+				for (pt = l->buckets[k]; pt; pt = next) {
+					next = pt->next;
+					mem_free_object(t->nodes, pt);
+				}
+			_hsh_free(t, l);
+		} else {
+			mem_free_object(t->nodes, r->pt);
+		}
+	}
+	c->retired_count = j;
+}
+
+static void _hsh_cc_resize(tableType t, unsigned long prime)
+{
+	listsType     old = t->concurrent->lists;
+	listsType     l   = _hsh_cc_alloc(t, prime);
+	unsigned long i;
+	bucketType    pt;
+
+	for (i = 0; i < old->prime; i++)
+		for (pt = old->buckets[i]; pt; pt = pt->next) {
+			unsigned long h = HSH_INDEX(pt->hash, l->prime, l->shift);
+			bucketType    b = mem_get_object(t->nodes);
+
+			memcpy(b, pt, _hsh_node_size(t));
+			b->next       = l->buckets[h];
+			l->buckets[h] = b;
+		}
+
+	_hsh_cc_publish(t, l);
+	_hsh_cc_retire(t, old, 1);
+	++t->resizings;
+}
+
+/* Rebuild a table that has become less than a quarter as full as it may
+   get, so that it is about half as full as it may get.  The gap between
+   the two loads keeps a table from shrinking and growing again in turn.
+   Tables are never shrunk below their |min_size|, nor while |hsh_iterate|
+   walks them (its |iterator| may delete entries). */
+
+static void _hsh_shrink(tableType t)
+{
+	unsigned long size;
+
+	if (t->iterating || t->snapshots || t->prime <= t->min_size) return;
+
+	if (t->slots) {
+		if (t->entries * 32 >= t->prime * 7) return;
+		for (size = t->prime;
+			 size > t->min_size && t->entries * 16 <= size / 2 * 7;
+			 size >>= 1);
+		_hsh_oa_resize(t, size);
+		return;
+	}
+
+	if (t->entries >= t->limit / 4) return;
+	size = _hsh_next_size(t->flags, t->entries * 2 / t->max_load + 1);
+	size = max(size, t->min_size);
+	if (size >= t->prime) return;
+
+	if (t->concurrent) _hsh_cc_resize(t, size);
+	else               _hsh_resize(t, size);
+}
+
+/* Return non-zero if |key| was present in the concurrent table, in which
+   case its datum is replaced if |how| contains HSH_PUT_REPLACE.  An absent
+   |key| is inserted if |how| contains HSH_PUT_INSERT. */
+
+static int _hsh_cc_put(
+	tableType t,
+	unsigned long hash,
+	const void *key,
+	const void *datum,
+	int how)
+{
+	unsigned long h;
+	bucketType    pt;
+
+	pthread_mutex_lock(&t->concurrent->lock);
+
+	/* Keep table less than half full */
+	if ((how & HSH_PUT_INSERT) && t->entries > t->limit)
+		_hsh_cc_resize(t, _hsh_grow_size(t));
+
+	h  = HSH_INDEX(hash, t->prime, t->shift);
+	pt = _hsh_find_list(t, t->buckets[h], hash, key, NULL);
+	if (pt) {
+		if (how & HSH_PUT_REPLACE) HSH_STORE(pt->datum, datum);
+	} else if (how & HSH_PUT_INSERT) {
+		bucketType b = mem_get_object(t->nodes);
+
+		_hsh_set_key(t, b, key);
+		b->hash  = hash;
+		b->datum = datum;
+		b->next  = t->buckets[h];
+		HSH_STORE(t->buckets[h], b);
+		++t->entries;
+	}
+
+	if (t->concurrent->retired_count) _hsh_cc_reclaim(t);
+	pthread_mutex_unlock(&t->concurrent->lock);
+
+	return pt != NULL;
+}
+
+static int _hsh_cc_delete(tableType t, unsigned long hash, const void *key)
+{
+	bucketType *link;
+	bucketType pt;
+
+	pthread_mutex_lock(&t->concurrent->lock);
+
+	/* The unlinked bucket keeps its |next|, for lookups standing on it */
+	for (link = &t->buckets[HSH_INDEX(hash, t->prime, t->shift)];
+		 (pt = *link);
+		 link = &pt->next)
+		if (_hsh_equal(t, pt, hash, key)) {
+			HSH_STORE(*link, pt->next);
+			_hsh_cc_retire(t, pt, 0);
+			--t->entries;
+			_hsh_shrink(t);
+			break;
+		}
+
+	if (t->concurrent->retired_count) _hsh_cc_reclaim(t);
+	pthread_mutex_unlock(&t->concurrent->lock);
+
+	return !pt;
+}
+
+static const void *_hsh_cc_retrieve(
+	tableType t,
+	unsigned long hash,
+	const void *key)
+{
+	readerType    reader = _hsh_reader_enter();
+	listsType     l      = HSH_LOAD(t->concurrent->lists);
+	const void    *datum = NULL;
+	bucketType    pt;
+
+	for (pt = HSH_LOAD(l->buckets[HSH_INDEX(hash, l->prime, l->shift)]);
+		 pt;
+		 pt = HSH_LOAD(pt->next))
+		if (_hsh_equal(t, pt, hash, key)) {
+			datum = HSH_LOAD(pt->datum);
+			break;
+		}
+
+	_hsh_reader_leave(reader);
+	return datum;
+}
+
+/* Return the address of the datum of |key|, after inserting |key| with
+   a "NULL" datum if it was absent.  |*inserted| tells which happened.
+   Not for concurrent tables. */
+
+static const void **_hsh_find_or_insert_hash(
+	tableType t,
+	unsigned long hashValue,
+	const void *key,
+	int *inserted)
+{
+	const void **slot;
+
+	if (t->old_buckets) _hsh_migrate(t, HSH_MIGRATE_STEP);
+
+	/* Keep table less than half full */
+	if (!t->slots && t->entries > t->limit)
+		_hsh_resize(t, _hsh_grow_size(t));
+
+	*inserted = 0;
+	if ((slot = _hsh_find_slot(t, hashValue, key))) return slot;
+
+	*inserted = 1;
+	if (t->small && (t->order ? t->used : t->entries) == HSH_SMALL_MAX)
+		_hsh_small_grow(t, t->entries + 1);
+	if (t->slots) return &_hsh_oa_add(t, hashValue, key)->datum;
+	return &_hsh_insert(t, hashValue, key, NULL)->datum;
+}
+
+static int _hsh_put_hash(
+	tableType t,
+	unsigned long hashValue,
+	const void *key,
+	const void *datum,
+	int how)
+{
+	const void **slot;
+	int        inserted;
+
+	if (t->concurrent) return _hsh_cc_put(t, hashValue, key, datum, how);
+
+	if (how & HSH_PUT_INSERT) {
+		slot = _hsh_find_or_insert_hash(t, hashValue, key, &inserted);
+		if (inserted || (how & HSH_PUT_REPLACE)) *slot = datum;
+		return !inserted;
+	}
+
+	if (!(slot = _hsh_find_slot(t, hashValue, key))) return 0;
+	*slot = datum;
+	return 1;
+}
+
+static int _hsh_insert_hash(
+	tableType t,
+	unsigned long hashValue,
+	const void *key,
+	const void *datum)
+{
+	return _hsh_put_hash(t, hashValue, key, datum, HSH_PUT_INSERT);
+}
+
+/* \doc |hsh_reserve| grows the |table|, if necessary, so that it can hold
+   |entries| entries without growing again.  Calling it before a bulk load
+   avoids all of the intermediate resizings.  The |table| also stops
+   shrinking below that size when entries are deleted, until
+   |hsh_compact| is called. */
+
+void hsh_reserve(hsh_HashTable table, unsigned long entries)
+{
+	tableType     t = (tableType)table;
+	unsigned long size;
+
+	_hsh_check(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to resize readonly table");
+
+	if (t->small) {
+		if (entries <= HSH_SMALL_MAX) return;
+		_hsh_small_grow(t, entries);
+	}
+
+	if (t->slots) {
+		for (size = HSH_GROUP; entries * 8 > size * 7; size <<= 1);
+		t->min_size = max(t->min_size, size);
+		if (size > t->prime) _hsh_oa_resize(t, size);
+		return;
+	}
+
+	size        = _hsh_next_size(t->flags, entries / t->max_load + 1);
+	t->min_size = max(t->min_size, size);
+	if (size <= t->prime) return;
+
+	if (t->concurrent) {
+		pthread_mutex_lock(&t->concurrent->lock);
+		_hsh_cc_resize(t, size);
+		_hsh_cc_reclaim(t);
+		pthread_mutex_unlock(&t->concurrent->lock);
+	} else {
+		_hsh_resize(t, size);
+		if (t->old_buckets) _hsh_migrate(t, t->old_prime);
+	}
+}
+
+/* \doc |hsh_compact| rebuilds the |table| at the size that its current
+   entries call for, giving back the memory left over by deletions.  A
+   table of lists gets a right-sized array of lists, and its buckets are
+   copied to a fresh pool, so that pool pages that held deleted buckets
+   are freed.  An open addressing table is rebuilt without its deleted
+   slots.  Only the array of an |HSH_CONCURRENT| table is rebuilt, since
+   lookups may still be reading the old buckets.
+
+   Deletions shrink a table automatically once it is less than a quarter
+   as full as it may get, but never below the size requested with
+   |hsh_create_ex| or |hsh_reserve|.  |hsh_compact| ignores (and forgets)
+   those requests. */
+
+void hsh_compact(hsh_HashTable table)
+{
+	tableType     t = (tableType)table;
+	unsigned long size;
+	int           shift;
+	bucketType    *buckets;
+	mem_Object    nodes;
+	unsigned long i;
+	bucketType    pt;
+	double        start;
+
+	_hsh_check(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to compact readonly table");
+	if (t->iterating)
+		err_internal(__func__, "Attempt to compact table being iterated");
+	if (t->small) return;
+	if (t->snapshots) _hsh_snapshot_detach(t);
+
+	if (t->slots) {
+		for (size = HSH_GROUP; t->entries * 16 > size * 7; size <<= 1);
+		t->min_size = HSH_GROUP;
+		_hsh_oa_resize(t, size);
+		return;
+	}
+
+	size        = _hsh_next_size(t->flags, t->entries * 2 / t->max_load + 1);
+	t->min_size = _hsh_next_size(t->flags, 0);
+
+	if (t->concurrent) {
+		pthread_mutex_lock(&t->concurrent->lock);
+		_hsh_cc_resize(t, size);
+		_hsh_cc_reclaim(t);
+		pthread_mutex_unlock(&t->concurrent->lock);
+		return;
+	}
+
+	start = _hsh_profile_begin(t);
+	if (t->old_buckets) _hsh_migrate(t, t->old_prime);
+	_hsh_sorted_drop(t);
+
+	shift   = t->shift ? _hsh_shift(size) : 0;
+	buckets = _hsh_alloc(t, size * sizeof(bucketType));
+	nodes   = mem_create_objects2(_hsh_node_size(t), t->allocate,
+								  t->deallocate, t->allocator_arg);
+	for (i = 0; i < size; i++) buckets[i] = NULL;
+
+	for (i = 0; i < t->prime; i++)
+		for (pt = t->buckets[i]; pt; pt = pt->next) {
+			unsigned long h = HSH_INDEX(pt->hash, size, shift);
+			bucketType    b = mem_get_object(nodes);
+
+			memcpy(b, pt, _hsh_node_size(t));
+			b->next    = buckets[h];
+			buckets[h] = b;
+		}
+
+	mem_destroy_objects(t->nodes);
+	_hsh_free(t, t->buckets);
+	t->nodes   = nodes;
+	t->buckets = buckets;
+	t->prime   = size;
+	t->shift   = shift;
+	++t->resizings;
+	_hsh_set_limit(t);
+	_hsh_profile_end(t, start);
+}
+
+typedef struct bulk {
+	const void      **keys;
+	const void      **data;
+	size_t          n;
+	unsigned long   *hashes;
+	unsigned long   *lists;	/* List of each key, if partitioned */
+	unsigned long   *present;	/* Keys found by each thread */
+	pthread_mutex_t lock;		/* Serializes the taking of buckets */
+} *bulkType;
+
+/* Pass |key| to the internal functions of |t| as |k| */
+
+static const void *_hsh_bulk_key(tableType t, const void *key,
+								 sizedKeyType k)
+{
+	if (!(t->flags & HSH_SIZED_KEYS)) return key;
+	k->key    = key;
+	k->length = strlen((const char *)key);
+	return k;
+}
+
+/* Hash the keys given to thread |id|, and, if the table is partitioned,
+   count (or, once |p->items| exists, store) their indices by range. */
+
+static void *_hsh_bulk_hash(void *arg)
+{
+	workerType    w    = (workerType)arg;
+	partitionType p    = w->p;
+	bulkType      b    = (bulkType)w->arg;
+	tableType     t    = p->t;
+	size_t        step = b->n / p->threads;
+	size_t        from = step * w->id;
+	size_t        to   = w->id == p->threads - 1 ? b->n : from + step;
+	size_t        i;
+
+	for (i = from; i < to; i++) {
+		unsigned long range;
+
+		if (!p->items) {
+			const void *key = b->keys[i];
+
+			b->hashes[i] = t->flags & HSH_SIZED_KEYS
+				? _hsh_hash_bytes(key, strlen((const char *)key), t->seed)
+				: _hsh_hash(t, key);
+			if (!b->lists) continue;
+			b->lists[i] = HSH_INDEX(b->hashes[i], t->prime, t->shift);
+		}
+		range = b->lists[i] / p->width;
+		if (p->items) p->items[p->counts[w->id * p->threads + range]]
+						  = (void *)(b->keys + i);
+		++p->counts[w->id * p->threads + range];
+	}
+	return NULL;
+}
+
+/* Insert the keys of range |id| into their lists. */
+
+static void *_hsh_bulk_link(void *arg)
+{
+	workerType    w     = (workerType)arg;
+	partitionType p     = w->p;
+	bulkType      b     = (bulkType)w->arg;
+	tableType     t     = p->t;
+	bucketType    nodes[HSH_BULK_NODES];
+	int           count = 0;
+	unsigned long i;
+
+	b->present[w->id] = 0;
+	for (i = p->ranges[w->id]; i < p->ranges[w->id + 1]; i++) {
+		size_t           j = (const void **)p->items[i] - b->keys;
+		struct sized_key k;
+		const void       *key  = _hsh_bulk_key(t, b->keys[j], &k);
+		bucketType       *head = &t->buckets[b->lists[j]];
+		bucketType       pt;
+
+		for (pt = *head; pt; pt = pt->next)
+			if (_hsh_equal(t, pt, b->hashes[j], key)) break;
+		if (pt) {
+			++b->present[w->id];
+			continue;
+		}
+
+		if (!count) {
+			pthread_mutex_lock(&b->lock);
+			for (; count < HSH_BULK_NODES; count++)
+				nodes[count] = mem_get_object(t->nodes);
+			pthread_mutex_unlock(&b->lock);
+		}
+		pt        = nodes[--count];
+		pt->hash  = b->hashes[j];
+		pt->datum = b->data ? b->data[j] : NULL;
+		pt->next  = *head;
+		_hsh_set_key(t, pt, key);
+		*head     = pt;
+	}
+
+	pthread_mutex_lock(&b->lock);
+	while (count) mem_free_object(t->nodes, nodes[--count]);
+	pthread_mutex_unlock(&b->lock);
+	return NULL;
+}
+
+/* \doc |hsh_bulk_load| inserts the |n| keys of the array |keys| into the
+   |table|, with the corresponding elements of |data| (or "NULL" data, if
+   |data| is "NULL"), as |n| calls to |hsh_insert| would, and returns the
+   number of keys that were already present.  In an |HSH_SIZED_KEYS|
+   table, the keys must be null-terminated.
+
+   The table is grown once, for all of the keys.  For large loads, the
+   keys are then hashed by |nthreads| threads (or as many threads as
+   there are processors, if |nthreads| is zero).  For a table of lists
+   that is not |HSH_CONCURRENT| and not profiled, the keys are also
+   grouped by the range of lists that they belong to, and each range is
+   filled by a single thread without any locking.  The growth of the
+   table is itself done by |nthreads| threads (see |hsh_create_ex|).
+   Other tables are filled by the calling thread.  No other call may be
+   made on the table while |hsh_bulk_load| runs. */
+
+unsigned long hsh_bulk_load(
+	hsh_HashTable table,
+	const void **keys,
+	const void **data,
+	size_t n,
+	int nthreads)
+{
+	tableType        t = (tableType)table;
+	struct bulk      b;
+	struct partition p;
+	workerType       w;
+	unsigned long    present = 0;
+	int              threads;
+	size_t           i;
+
+	_hsh_check(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to insert into readonly table");
+
+	if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > HSH_THREADS_MAX) nthreads = HSH_THREADS_MAX;
+	threads = n >= HSH_PARALLEL_MIN && nthreads > 1 ? nthreads : 1;
+
+	{
+		int saved = t->threads;
+
+		t->threads = max(threads, saved);
+		hsh_reserve(t, t->entries + n);
+		t->threads = saved;
+	}
+
+	b.keys    = keys;
+	b.data    = data;
+	b.n       = n;
+	b.hashes  = xmalloc((n + 1) * sizeof(unsigned long));
+	b.lists   = NULL;
+	b.present = xmalloc(threads * sizeof(unsigned long));
+	pthread_mutex_init(&b.lock, NULL);
+	w = _hsh_partition_init(&p, t, threads, &b);
+
+	if (threads > 1 && t->buckets && !t->concurrent && !t->profile) {
+		b.lists = xmalloc(n * sizeof(unsigned long));
+		if (t->snapshots) _hsh_snapshot_detach(t);
+		/* The loaders only search and link the current lists */
+		if (t->old_buckets) _hsh_migrate(t, t->old_prime);
+		_hsh_sorted_drop(t);
+		_hsh_parallel(_hsh_bulk_hash, w, sizeof(struct worker), threads);
+		_hsh_partition_group(&p);
+		_hsh_parallel(_hsh_bulk_hash, w, sizeof(struct worker), threads);
+		_hsh_parallel(_hsh_bulk_link, w, sizeof(struct worker), threads);
+		for (i = 0; i < (size_t)threads; i++) present += b.present[i];
+		t->entries += n - present;
+		xfree(b.lists);
+	} else {
+		_hsh_parallel(_hsh_bulk_hash, w, sizeof(struct worker), threads);
+		for (i = 0; i < n; i++) {
+			struct sized_key k;
+
+			present += _hsh_put_hash(t, b.hashes[i],
+									 _hsh_bulk_key(t, keys[i], &k),
+									 data ? data[i] : NULL, HSH_PUT_INSERT);
+		}
+	}
+
+	_hsh_partition_free(&p, w);
+	pthread_mutex_destroy(&b.lock);
+	xfree(b.present);
+	xfree(b.hashes);
+	return present;
+}
+
+/* \doc |hsh_insert| inserts a new |key| into the |table|.  If the
+   insertion is successful, zero is returned.  If the |key| already exists,
+   1 is returned, and its datum is left alone.  |hsh_replace| and
+   |hsh_upsert| change the |datum| associated with a |key|.
+
+   If the internal representation of the hash table becomes more than half
+   full, its size is increased automatically.  At present, this requires
+   that all of the buckets are relinked into a new array of lists.
+   Rehashing is not required, however, since the hash values are stored
+   for each key. */
+
+int hsh_insert(
+	hsh_HashTable table,
+	const void *key,
+	const void *datum)
+{
+	tableType t = (tableType)table;
+
+	_hsh_check(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to insert into readonly table");
+
+	if (t->flags & HSH_SIZED_KEYS)
+		return hsh_insert_n(t, key, strlen((const char *)key), datum);
+	return _hsh_insert_hash(t, _hsh_hash(t, key), key, datum);
+}
+
+static void _hsh_check_sized(tableType t, const char *function)
+{
+	_hsh_check(t, function);
+	if (!(t->flags & HSH_SIZED_KEYS))
+		err_internal(function, "Table was not created with HSH_SIZED_KEYS");
+}
+
+/* \doc |hsh_insert_n| acts like |hsh_insert|, but the |key| consists of
+   the |length| bytes at |key|, which are not copied.  The |table| must
+   have been created with |HSH_SIZED_KEYS|.  The stored length is
+   available from |hsh_get_position_length|. */
+
+int hsh_insert_n(
+	hsh_HashTable table,
+	const void *key,
+	size_t length,
+	const void *datum)
+{
+	tableType        t = (tableType)table;
+	struct sized_key k;
+
+	_hsh_check_sized(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to insert into readonly table");
+
+	k.key    = key;
+	k.length = length;
+	return _hsh_insert_hash(t, _hsh_hash_bytes(key, length, t->seed), &k, datum);
+}
+
+static int _hsh_put(
+	tableType t,
+	const void *key,
+	const void *datum,
+	int how)
+{
+	struct sized_key k;
+
+	if (t->readonly)
+		err_internal(__func__, "Attempt to change readonly table");
+
+	if (!(t->flags & HSH_SIZED_KEYS))
+		return _hsh_put_hash(t, _hsh_hash(t, key), key, datum, how);
+
+	k.key    = key;
+	k.length = strlen((const char *)key);
+	return _hsh_put_hash(t, _hsh_hash_bytes(key, k.length, t->seed), &k,
+						 datum, how);
+}
+
+/* \doc |hsh_replace| changes the datum associated with |key| to |datum|,
+   with a single lookup.  Zero is returned if the |key| was present.
+   Otherwise, nothing is inserted, and 1 is returned. */
+
+int hsh_replace(
+	hsh_HashTable table,
+	const void *key,
+	const void *datum)
+{
+	tableType t = (tableType)table;
+
+	_hsh_check(t, __func__);
+	return !_hsh_put(t, key, datum, HSH_PUT_REPLACE);
+}
+
+/* \doc |hsh_upsert| associates |datum| with |key|, inserting the |key| if
+   it is absent and replacing its datum otherwise, with a single lookup.
+   As for |hsh_insert|, zero is returned if the |key| was inserted and 1 if
+   it already existed. */
+
+int hsh_upsert(
+	hsh_HashTable table,
+	const void *key,
+	const void *datum)
+{
+	tableType t = (tableType)table;
+
+	_hsh_check(t, __func__);
+	return _hsh_put(t, key, datum, HSH_PUT_INSERT | HSH_PUT_REPLACE);
+}
+
+static const void **_hsh_find_or_insert(
+	tableType t,
+	unsigned long hash,
+	const void *key,
+	int *inserted,
+	const char *function)
+{
+	int dummy;
+
+	if (t->readonly)
+		err_internal(function, "Attempt to insert into readonly table");
+	if (t->concurrent)
+		err_internal(function, "Not supported for HSH_CONCURRENT tables");
+
+	return _hsh_find_or_insert_hash(t, hash, key, inserted ? inserted : &dummy);
+}
+
+/* \doc |hsh_find_or_insert| returns the address of the datum associated
+   with |key|, first inserting the |key| with a "NULL" datum if it is
+   absent, so that the datum can be read and updated in place.  For
+   instance, occurrences of each key can be counted by incrementing
+   |*slot|, which starts out as "NULL".
+
+   Only one lookup is made.  If |inserted| is not "NULL", it is set to 1
+   when the |key| was inserted, and to zero otherwise.  The address
+   remains valid until the |table| is next changed.  These functions are
+   not available for |HSH_CONCURRENT| tables, where other threads may read
+   the datum at any time. */
+
+const void **hsh_find_or_insert(
+	hsh_HashTable table,
+	const void *key,
+	int *inserted)
+{
+	tableType t = (tableType)table;
+
+	_hsh_check(t, __func__);
+	if (t->flags & HSH_SIZED_KEYS)
+		return hsh_find_or_insert_n(t, key, strlen((const char *)key),
+									inserted);
+	return _hsh_find_or_insert(t, _hsh_hash(t, key), key, inserted,
+							   __func__);
+}
+
+/* \doc |hsh_find_or_insert_n| is |hsh_find_or_insert| for the |length|
+   bytes at |key| in a |HSH_SIZED_KEYS| table. */
+
+const void **hsh_find_or_insert_n(
+	hsh_HashTable table,
+	const void *key,
+	size_t length,
+	int *inserted)
+{
+	tableType        t = (tableType)table;
+	struct sized_key k;
+
+	_hsh_check_sized(t, __func__);
+
+	k.key    = key;
+	k.length = length;
+	return _hsh_find_or_insert(t, _hsh_hash_bytes(key, length, t->seed),
+							   &k, inserted, __func__);
+}
+
+/* \doc |hsh_set_key| replaces the key of the entry whose datum address
+   |slot| was returned by |hsh_find_or_insert| with |key|, which must be
+   equal to it.  This allows a temporary key to be looked up, and a
+   permanent copy to be made only once the entry turns out to be new. */
+
+void hsh_set_key(hsh_HashTable table, const void **slot, const void *key)
+{
+	tableType  t = (tableType)table;
+	bucketType b;
+
+	_hsh_check(t, __func__);
+	if (t->concurrent)
+		err_internal(__func__, "Not supported for HSH_CONCURRENT tables");
+
+	/* Buckets and slots both start with the key, hash and datum */
+	b = (bucketType)((char *)slot - offsetof(struct bucket, datum));
+	if (t->flags & HSH_SIZED_KEYS
+		? memcmp(b->key, key, ((struct sized_bucket *)b)->length)
+		: t->compare(b->key, key))
+		err_internal(__func__, "New key differs from the old one");
+	if (t->snapshots)
+		_hsh_snapshot_save(t, t->slots
+						   ? (unsigned long)((slotType)b - t->slots)
+						   : HSH_INDEX(b->hash, t->prime, t->shift));
+	b->key = key;
+}
+
+static int _hsh_delete_list(
+	tableType t,
+	bucketType *head,
+	unsigned long hash,
+	const void *key)
+{
+	bucketType    pt;
+	bucketType    prev;
+	unsigned long n;
+
+	for (n = 1, prev = NULL, pt = *head; pt; n++, prev = pt, pt = pt->next)
+		if (_hsh_equal(t, pt, hash, key)) {
+			--t->entries;
+
+			if (!prev) *head      = pt->next;
+			else       prev->next = pt->next;
+
+			mem_free_object(t->nodes, pt);
+			if (t->profile) t->walked += n;
+			if (n > HSH_LONG_CHAIN) ++t->counters->long_chains;
+			return 0;
+		}
+
+	if (t->profile) t->walked += n - 1;
+	if (n > HSH_LONG_CHAIN + 1) ++t->counters->long_chains;
+	return 1;
+}
+
+static int _hsh_delete_sorted(
+	tableType t,
+	unsigned long h,
+	unsigned long hash,
+	const void *key)
+{
+	unsigned long i;
+
+	if (!_hsh_sorted_find(t, t->sorted[h], hash, key, &i)) return 1;
+	mem_free_object(t->nodes, _hsh_sorted_unlink(t, h, i));
+	--t->entries;
+	return 0;
+}
+
+static int _hsh_delete_hash(
+	tableType t,
+	unsigned long hashValue,
+	const void *key)
+{
+	unsigned long h;
+	int           result;
+
+	if (t->slots) {
+		unsigned long i;
+		slotType      s = _hsh_oa_find(t, hashValue, key, NULL, &i);
+
+		if (t->profile) _hsh_profile_lookup(t);
+		if (!s) return 1;
+		_hsh_oa_erase(t, i);
+		_hsh_shrink(t);
+		return 0;
+	}
+	if (t->concurrent) return _hsh_cc_delete(t, hashValue, key);
+
+	if (t->old_buckets && !t->iterating) _hsh_migrate(t, HSH_MIGRATE_STEP);
+
+	h      = HSH_INDEX(hashValue, t->prime, t->shift);
+	if (t->snapshots) _hsh_snapshot_save(t, h);
+	result = t->sorted && t->sorted[h]
+		? _hsh_delete_sorted(t, h, hashValue, key)
+		: _hsh_delete_list(t, &t->buckets[h], hashValue, key);
+	if (result && t->old_buckets) {
+		h      = HSH_INDEX(hashValue, t->old_prime, t->old_shift);
+		result = _hsh_delete_list(t, &t->old_buckets[h], hashValue, key);
+	}
+	if (t->profile) _hsh_profile_lookup(t);
+	if (!result) _hsh_shrink(t);
+   
+	return result;
+}
+
+/* \doc |hsh_delete| removes a |key| and the associated datum from the
+   |table|.  Zero is returned if the |key| was present.  Otherwise, 1 is
+   returned. */
+
+int hsh_delete(hsh_HashTable table, const void *key)
+{
+	tableType t = (tableType)table;
+
+	_hsh_check(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to delete from readonly table");
+
+	if (t->flags & HSH_SIZED_KEYS)
+		return hsh_delete_n(t, key, strlen((const char *)key));
+	return _hsh_delete_hash(t, _hsh_hash(t, key), key);
+}
+
+/* \doc |hsh_delete_n| acts like |hsh_delete| for a key of |length|
+   bytes in an |HSH_SIZED_KEYS| table. */
+
+int hsh_delete_n(hsh_HashTable table, const void *key, size_t length)
+{
+	tableType        t = (tableType)table;
+	struct sized_key k;
+
+	_hsh_check_sized(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to delete from readonly table");
+
+	k.key    = key;
+	k.length = length;
+	return _hsh_delete_hash(t, _hsh_hash_bytes(key, length, t->seed), &k);
+}
+
+
+/* As |_hsh_find_list|, but the bucket found is moved to the front of the
+   list, unless the table is readonly. */
+
+static bucketType _hsh_retrieve_list(
+	tableType t,
+	bucketType *head,
+	unsigned long hash,
+	const void *key,
+	unsigned long *walked)
+{
+	bucketType    pt;
+	bucketType    prev;
+	unsigned long n;
+
+	for (n = 1, prev = NULL, pt = *head; pt; n++, prev = pt, pt = pt->next)
+		if (_hsh_equal(t, pt, hash, key)) {
+			if (t->profile) t->walked += n;
+			if (n > HSH_LONG_CHAIN) ++t->counters->long_chains;
+			if (walked) *walked = n;
+			if (!prev) {
+				++t->counters->hits;
+			} else if (!t->readonly && !t->snapshots) {
+				/* Self organize */
+				prev->next = pt->next;
+				pt->next   = *head;
+				*head      = pt;
+			}
+			return pt;
+		}
+
+	if (t->profile) t->walked += n - 1;
+	if (n > HSH_LONG_CHAIN + 1) ++t->counters->long_chains;
+	if (walked) *walked = n - 1;
+	return NULL;
+}
+
+static const void *_hsh_retrieve_hash(
+	tableType t,
+	unsigned long hashValue,
+	const void *key)
+{
+	unsigned long h;
+	bucketType    pt;
+	unsigned long walked;
+
+	if (t->concurrent) return _hsh_cc_retrieve(t, hashValue, key);
+
+	++t->counters->retrievals;
+	if (t->slots) {
+		unsigned long probes;
+		slotType      s = _hsh_oa_find(t, hashValue, key, &probes, NULL);
+
+		if (t->profile) _hsh_profile_lookup(t);
+		if (s) {
+			if (!probes) ++t->counters->hits;
+			return s->datum;
+		}
+		++t->counters->misses;
+		return NULL;
+	}
+
+	h = HSH_INDEX(hashValue, t->prime, t->shift);
+	if (t->sorted && t->sorted[h]) {
+		pt = _hsh_sorted_find(t, t->sorted[h], hashValue, key, NULL);
+		if (pt && pt == t->buckets[h]) ++t->counters->hits;
+	} else {
+		pt = _hsh_retrieve_list(t, &t->buckets[h], hashValue, key, &walked);
+		if (_hsh_sortable(t, walked)) _hsh_sort_list(t, h);
+	}
+	if (!pt && t->old_buckets) {
+		h  = HSH_INDEX(hashValue, t->old_prime, t->old_shift);
+		pt = _hsh_retrieve_list(t, &t->old_buckets[h], hashValue, key,
+								NULL);
+	}
+	if (t->profile) _hsh_profile_lookup(t);
+	if (pt) return pt->datum;
+
+	++t->counters->misses;
+	return NULL;
+}
+
+/* \doc |hsh_retrieve| retrieves the datum associated with a |key|.  If the
+   |key| is not present in the |table|, then "NULL" is returned. */
+
+const void *hsh_retrieve(hsh_HashTable table,
+						 const void *key)
+{
+	tableType t = (tableType)table;
+
+	_hsh_check(t, __func__);
+	if (t->flags & HSH_SIZED_KEYS)
+		return hsh_retrieve_n(t, key, strlen((const char *)key));
+	return _hsh_retrieve_hash(t, _hsh_hash(t, key), key);
+}
+
+/* \doc |hsh_retrieve_n| acts like |hsh_retrieve| for a key of |length|
+   bytes in an |HSH_SIZED_KEYS| table.  The key need not be
+   null-terminated, so it may point directly into a larger buffer. */
+
+const void *hsh_retrieve_n(hsh_HashTable table, const void *key,
+						   size_t length)
+{
+	tableType        t = (tableType)table;
+	struct sized_key k;
+
+	_hsh_check_sized(t, __func__);
+
+	k.key    = key;
+	k.length = length;
+	return _hsh_retrieve_hash(t, _hsh_hash_bytes(key, length, t->seed), &k);
+}
+
+/* A lookup in flight in |hsh_retrieve_batch|.  Each lookup loads the
+   head of its list and then one bucket at a time; a prefetch is issued
+   for each load one round before the load itself, and the other lookups
+   are advanced in between (asynchronous memory access chaining). */
+
+typedef struct lookup {
+	enum { HSH_IDLE, HSH_HEAD, HSH_WALK } state;
+	size_t           i;		/* Index into |keys| */
+	unsigned long    hash;
+	bucketType       *head;
+	bucketType       pt;
+	const void       *key;		/* As passed to _hsh_equal */
+	struct sized_key sized;
+} *lookupType;
+
+static void _hsh_batch_lists(
+	tableType t,
+	const void **keys,
+	size_t n,
+	const void **out)
+{
+	struct lookup lookups[HSH_BATCH];
+	size_t        next = 0;
+	size_t        done = 0;
+	int           j;
+
+	for (j = 0; j < HSH_BATCH; j++) lookups[j].state = HSH_IDLE;
+
+	while (done < n) {
+		for (j = 0; j < HSH_BATCH; j++) {
+			lookupType l = lookups + j;
+
+			switch (l->state) {
+			case HSH_IDLE:
+				if (next == n) break;
+				l->i    = next++;
+				l->key  = keys[l->i];
+				l->hash = _hsh_hash(t, l->key);
+				if (t->flags & HSH_SIZED_KEYS) {
+					l->sized.key    = l->key;
+					l->sized.length = strlen((const char *)l->key);
+					l->key          = &l->sized;
+				}
+				l->head  = &t->buckets[HSH_INDEX(l->hash, t->prime, t->shift)];
+				l->state = HSH_HEAD;
+				HSH_PREFETCH(l->head);
+				++t->counters->retrievals;
+				break;
+			case HSH_HEAD:
+				l->pt    = *l->head;
+				l->state = HSH_WALK;
+				if (l->pt) {
+					HSH_PREFETCH(l->pt);
+					break;
+				}
+				/* FALLTHROUGH */
+			case HSH_WALK:
+				if (l->pt && !_hsh_equal(t, l->pt, l->hash, l->key)) {
+					l->pt = l->pt->next;
+					if (l->pt) {
+						HSH_PREFETCH(l->pt);
+						break;
+					}
+				}
+				if (!l->pt && t->old_buckets) {
+					unsigned long h = HSH_INDEX(l->hash,
+												t->old_prime, t->old_shift);
+
+					for (l->pt = t->old_buckets[h];
+						 l->pt && !_hsh_equal(t, l->pt, l->hash, l->key);
+						 l->pt = l->pt->next);
+				}
+				if (l->pt) {
+					if (l->pt == *l->head) ++t->counters->hits;
+					out[l->i] = l->pt->datum;
+				} else {
+					++t->counters->misses;
+					out[l->i] = NULL;
+				}
+				l->state = HSH_IDLE;
+				++done;
+				break;
+			}
+		}
+	}
+}
+
+/* \doc |hsh_retrieve_batch| looks up the |n| keys in the array |keys|,
+   and stores the datum associated with each of them (or "NULL") in the
+   corresponding element of |out|.  The result is the same as that of |n|
+   calls to |hsh_retrieve|, but is usually faster for large tables: all of
+   the lookups are started at once, and while the memory needed by one of
+   them is being loaded, the others proceed.  The lists are not
+   self-organized by |hsh_retrieve_batch|.  In a |HSH_SIZED_KEYS| table,
+   the keys must be null-terminated. */
+
+void hsh_retrieve_batch(
+	hsh_HashTable table,
+	const void **keys,
+	size_t n,
+	const void **out)
+{
+	tableType     t = (tableType)table;
+	unsigned long hashes[HSH_BATCH];
+	size_t        i;
+	size_t        j;
+
+	_hsh_check(t, __func__);
+
+	if (t->buckets && !t->concurrent) {
+		_hsh_batch_lists(t, keys, n, out);
+		return;
+	}
+
+	/* Lookups in a concurrent table cannot touch the array of lists
+	   outside of a read-side critical section, so only open addressing
+	   tables are prefetched. */
+	for (i = 0; i < n; i += HSH_BATCH) {
+		size_t m = n - i < HSH_BATCH ? n - i : HSH_BATCH;
+
+		for (j = 0; j < m; j++) {
+			hashes[j] = _hsh_hash(t, keys[i + j]);
+			if (t->slots) {
+				unsigned long mask = t->prime / HSH_GROUP - 1;
+				unsigned long g    = (_hsh_def_mix(hashes[j]) >> 7) & mask;
+
+				HSH_PREFETCH(t->tags + g * HSH_GROUP);
+				if (t->order) HSH_PREFETCH(t->order + g * HSH_GROUP);
+				else          HSH_PREFETCH(t->slots + g * HSH_GROUP);
+			}
+		}
+		for (j = 0; j < m; j++) {
+			if (t->flags & HSH_SIZED_KEYS) {
+				out[i + j] = hsh_retrieve(t, keys[i + j]);
+			} else {
+				out[i + j] = _hsh_retrieve_hash(t, hashes[j], keys[i + j]);
+			}
+		}
+	}
+}
+
+/* Call |iterator(key, datum)|, or |iterator_arg(key, datum, arg)|, for
+   each entry of |t|, and return non-zero as soon as one call does.  The
+   |iterator| may delete the entry it is given, so the next bucket is
+   found before the call, and the table is kept from shrinking. */
+
+static int _hsh_iterate(
+	tableType t,
+	int (*iterator)(const void *key, const void *datum),
+	int (*iterator_arg)(const void *key, const void *datum, void *arg),
+	void *arg)
+{
+	unsigned long i;
+	bucketType    pt;
+	bucketType    next;		/* Save, because pt might vanish. */
+	slotType      s;
+
+#define HSH_VISIT(key, datum) \
+	(iterator ? iterator((key), (datum)) : iterator_arg((key), (datum), arg))
+
+	if (t->slots) {
+		for (s = _hsh_oa_next(t, NULL); s; s = _hsh_oa_next(t, s))
+			if (HSH_VISIT(s->key, s->datum)) return 1;
+		return 0;
+	}
+
+	for (i = 0; i < t->prime; i++) {
+		for (pt = t->buckets[i]; pt; pt = next) {
+			next = pt->next;
+			if (HSH_VISIT(pt->key, pt->datum)) return 1;
+		}
+	}
+	for (i = t->migrated; i < t->old_prime; i++) {
+		for (pt = t->old_buckets[i]; pt; pt = next) {
+			next = pt->next;
+			if (HSH_VISIT(pt->key, pt->datum)) return 1;
+		}
+	}
+	return 0;
+
+#undef HSH_VISIT
+}
+
+/* \doc |hsh_iterate| is used to iterate a function over every value in the
+   |table|.  The function, |iterator|, is passed the |key| and |datum| pair
+   for each entry in the table.  If |iterator| returns a non-zero value,
+   the iterations stop, and |hsh_iterate| returns non-zero.  Note that the
+   keys are in some arbitrary order, and that this order may change between
+   two successive calls to |hsh_iterate|, unless the table was created with
+   |HSH_ORDERED|: then they are in the order of their insertion.
+
+   The |iterator| may delete the entry it is passed, and only that one.
+   The |table| does not shrink until |hsh_iterate| returns. */
+
+int hsh_iterate(hsh_HashTable table,
+				int (*iterator)(const void *key,
+								const void *datum))
+{
+	tableType t = (tableType)table;
+	int       result;
+
+	_hsh_check(t, __func__);
+
+	if (t->shared) return _hsh_iterate(t, iterator, NULL, NULL);
+	++t->iterating;
+	result = _hsh_iterate(t, iterator, NULL, NULL);
+	--t->iterating;
+	return result;
+}
+
+/* \doc |hsh_iterate_arg| is used to iterate a function over every value in
+   the |table|.  The function, |iterator|, is passed the |key| and |datum|
+   pair for each entry in the table.  If |iterator| returns a non-zero
+   value, the iterations stop, and |hsh_iterate| returns non-zero.  Note
+   that the keys are in some arbitrary order, and that this order may
+   change between two successive calls to |hsh_iterate|. */
+
+int hsh_iterate_arg(hsh_HashTable table,
+					int (*iterator)(const void *key,
+									const void *datum,
+									void *arg),
+					void *arg)
+{
+	tableType t = (tableType)table;
+	int       result;
+
+	_hsh_check(t, __func__);
+
+	if (t->shared) return _hsh_iterate(t, NULL, iterator, arg);
+	++t->iterating;
+	result = _hsh_iterate(t, NULL, iterator, arg);
+	--t->iterating;
+	return result;
+}
+
+/* a function callable from hsh_iterate() to print key values */
+static int _hsh_key_strings(const void *k, const void *d) {
+	const char *s;
+	static int i = 0;
+   
+	if (k == NULL) { i=0; return 0; }
+   
+	s = k;
+	printf("%s  ",s);
+	if ((i += strlen(s)+2) >= 60) { i=0; printf("\n"); }
+	return 0;
+}
+
+/* print all keys in table t as strings */
+void hsh_key_strings(hsh_HashTable t) {
+	_hsh_key_strings(NULL,NULL);
+	hsh_iterate(t,_hsh_key_strings);
+	printf("\n");
+}
+
+/* \doc |hsh_get_stats| returns statistics about the |table|.  The
    |hsh_Stats| structure is shown in \grind{hsh_Stats}. */
 
-hsh_Stats hsh_get_stats(hsh_HashTable table)
+hsh_Stats hsh_get_stats(hsh_HashTable table)
+{
+	tableType     t = (tableType)table;
+	hsh_Stats     s = xmalloc(sizeof(struct hsh_Stats));
+	unsigned long i;
+	unsigned      count;
+
+	_hsh_check(t, __func__);
+
+	s->size           = t->prime;
+	s->resizings      = t->resizings;
+	s->entries        = 0;
+	s->buckets_used   = 0;
+	s->singletons     = 0;
+	s->maximum_length = 0;
+	s->retrievals     = t->counters->retrievals;
+	s->hits           = t->counters->hits;
+	s->misses         = t->counters->misses;
+	s->mapped         = t->mapped;
+	s->pages          = MEM_PAGES(t->mapped, MEM_PAGE);
+	s->huge_pages     = MEM_PAGES(t->mapped, MEM_HUGE_PAGE);
+	s->long_chains    = t->counters->long_chains;
+	s->sorted_lists   = 0;
+	for (i = 0; t->sorted && i < t->prime; i++)
+		if (t->sorted[i]) ++s->sorted_lists;
+
+	if (t->slots) {
+		/* Groups play the role of buckets, and the length of a list is
+		   the number of groups probed to reach an entry. */
+		unsigned long mask = t->prime / HSH_GROUP - 1;
+
+		for (i = 0; i < t->prime; i += HSH_GROUP) {
+			unsigned long j;
+
+			for (count = 0, j = i; j < i + HSH_GROUP; j++) {
+				unsigned long g;
+				unsigned long step;
+
+				if (!HSH_TAG_FULL(t->tags[j])) continue;
+				++count;
+				g = (_hsh_def_mix(_hsh_oa_slot(t, j)->hash) >> 7) & mask;
+				for (step = 0; g != i / HSH_GROUP; g = (g + ++step) & mask);
+				s->maximum_length = max(s->maximum_length, step + 1);
+			}
+			if (!count) continue;
+			++s->buckets_used;
+			if (count == 1) ++s->singletons;
+			s->entries += count;
+		}
+	}
+
+	for (i = 0; t->buckets && i < t->prime + t->old_prime; i++) {
+		bucketType pt = i < t->prime
+			? t->buckets[i] : t->old_buckets[i - t->prime];
+
+		if (pt) {
+			++s->buckets_used;
+			for (count = 0; pt; ++count, pt = pt->next);
+			if (count == 1) ++s->singletons;
+			s->maximum_length = max(s->maximum_length, count);
+			s->entries += count;
+		}
+	}
+	if (t->entries != s->entries)
+		err_internal(__func__,
+					 "Incorrect count for entries: %lu vs. %lu",
+					 t->entries,
+					 s->entries);
+
+	return s;
+}
+
+static void _hsh_print_stats(hsh_Stats s, const void *table, FILE *stream)
+{
+	FILE *str = stream ? stream : stdout;
+
+	fprintf(str, "Statistics for hash table at %p:\n", table);
+	fprintf(str, "   %lu resizings to %lu total\n", s->resizings, s->size);
+	fprintf(str, "   %lu entries (%lu buckets used, %lu without overflow)\n",
+			s->entries, s->buckets_used, s->singletons);
+	fprintf(str, "   maximum list length is %lu", s->maximum_length);
+	if (s->buckets_used)
+		fprintf(str, " (optimal is %.1f)\n",
+				(double)s->entries / (double)s->buckets_used);
+	else
+		fprintf(str, "\n");
+	fprintf(str, "   %lu retrievals (%lu from top, %lu failed)\n",
+			s->retrievals, s->hits, s->misses);
+	if (s->mapped)
+		fprintf(str, "   %lu bytes mapped (%lu huge pages, not %lu small)\n",
+				s->mapped, s->huge_pages, s->pages);
+	if (s->long_chains)
+		fprintf(str, "   %lu lookups walked unexpectedly far"
+				" (colliding keys or a poor hash)\n", s->long_chains);
+	if (s->sorted_lists)
+		fprintf(str, "   %lu long lists sorted for binary search\n",
+				s->sorted_lists);
+}
+
+/* \doc |hsh_print_stats| prints the statistics for |table| on the
+   specified |stream|.  If |stream| is "NULL", then "stdout" will be
+   used. */
+
+void hsh_print_stats(hsh_HashTable table, FILE *stream)
+{
+	hsh_Stats s = hsh_get_stats(table);
+
+	_hsh_check(table, __func__);
+	_hsh_print_stats(s, table, stream);
+	xfree(s);			/* rare */
+}
+
+/* \doc |hsh_get_profile| copies the counters kept by a table created with
+   |HSH_PROFILE| into |profile|, which is shown in \grind{hsh_Profile}.
+   Nothing is allocated, and no list is walked, so that it may be called
+   often on a live table.  |walks| counts the lookups made by retrievals,
+   insertions and deletions according to the number of entries they
+   examined (for open addressing tables, the number of groups of slots),
+   with the last element counting all of the longer ones.  Batched
+   retrievals are not counted.  Returns 1, after filling in only |resizes|
+   and |bytes|, if the table was created without |HSH_PROFILE|, and zero
+   otherwise. */
+
+int hsh_get_profile(hsh_HashTable table, hsh_Profile *profile)
+{
+	tableType     t    = (tableType)table;
+	hsh_Profile   *kept = t->shared ? t->parked : t->profile;
+	unsigned long bytes;
+
+	_hsh_check(t, __func__);
+	if (kept) *profile = *kept;
+	else      memset(profile, 0, sizeof(hsh_Profile));
+
+	bytes = sizeof(struct table) + (kept ? sizeof(hsh_Profile) : 0);
+	if (t->flags & HSH_SMALL) bytes += HSH_SMALL_BYTES;
+	if (t->small) {
+		;
+	} else if (t->slots) {
+		bytes += t->prime
+			+ _hsh_oa_capacity(t, t->prime) * sizeof(struct slot);
+		if (t->order) bytes += t->prime * sizeof(unsigned long);
+	} else {
+		bytes += t->prime * sizeof(bucketType)
+			+ t->old_prime * sizeof(bucketType)
+			+ t->entries * _hsh_node_size(t);
+		if (t->concurrent)
+			bytes += sizeof(struct concurrent)
+				+ offsetof(struct lists, buckets);
+		if (t->sorted) {
+			unsigned long i;
+
+			bytes += t->prime * sizeof(sortedType);
+			for (i = 0; i < t->prime; i++)
+				if (t->sorted[i])
+					bytes += sizeof(struct sorted)
+						+ (t->sorted[i]->room - 1) * sizeof(bucketType);
+		}
+	}
+	if (t->shared) bytes += MEM_PAGE;
+	profile->resizes = t->resizings;
+	profile->bytes   = bytes;
+
+	return !kept;
+}
+
+void hsh_print_profile(hsh_HashTable table, FILE *stream)
+{
+	FILE          *str = stream ? stream : stdout;
+	hsh_Profile   p;
+	unsigned long i;
+
+	if (hsh_get_profile(table, &p)) {
+		fprintf(str, "No profile for hash table at %p\n", table);
+		return;
+	}
+	fprintf(str, "Profile for hash table at %p:\n", table);
+	fprintf(str, "   %lu lookups making %lu comparisons\n",
+			p.lookups, p.compares);
+	fprintf(str, "   entries examined per lookup:");
+	for (i = 0; i < HSH_PROFILE_WALKS; i++)
+		if (p.walks[i])
+			fprintf(str, " %lu%s:%lu", i,
+					i == HSH_PROFILE_WALKS - 1 ? "+" : "", p.walks[i]);
+	fprintf(str, "\n");
+	fprintf(str, "   %lu resizings taking %.6f seconds\n",
+			p.resizes, p.resize_seconds);
+	fprintf(str, "   about %lu bytes used\n", p.bytes);
+}
+
+unsigned long hsh_string_hash(const void *key)
+{
+	const char           *pt = (const char *)key;
+	unsigned long        h  = 0;
+
+	if (!pt)
+		err_internal(__func__, "String-valued keys may not be NULL");
+
+	while (*pt) {
+		h += *pt++;
+#if 0
+		h *= 65599L;		/* prime near %$2^{16}$% */
+#else
+		h *= 2654435789U;		/* prime near %$\frac{\sqrt{5}-1}{2}2^{32}$% */
+#endif
+	}
+
+	return h;
+}
+
+unsigned long hsh_pointer_hash(const void *key)
+{
+	const char           *pt;
+	unsigned long        h   = 0;
+	int                  i;
+
+#ifdef WORDS_BIGENDIAN
+	pt = ((const char *)&key) + SIZEOF_VOID_P - 1;
+#else
+	pt = (const char *)&key;
+#endif
+   
+	for (i = 0; i < SIZEOF_VOID_P; i++) {
+#ifdef WORDS_BIGENDIAN
+		h += *pt--;
+#else
+		h += *pt++;
+#endif
+#if 0
+		h *= 65599L;		/* prime near %$2^{16}$% */
+#else
+		h *= 2654435789U;		/* prime near %$\frac{\sqrt{5}-1}{2}2^{32}$% */
+#endif
+	}
+
+	return h & 0xffffffff;
+}
+
+/* Word-at-a-time hashing, after wyhash by Wang Yi.  Keys are read eight
+   bytes at a time, and each pair of words is combined by one 64x64->128
+   bit multiplication whose halves are folded together.  Keys longer than
+   48 bytes are consumed by three independent multiplication chains. */
+
+#define HSH_P0 UINT64_C(0xa0761d6478bd642f)
+#define HSH_P1 UINT64_C(0xe7037ed1a0b428db)
+#define HSH_P2 UINT64_C(0x8ebc6af09c88c6e3)
+#define HSH_P3 UINT64_C(0x589965cc75374cc3)
+
+static void _hsh_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)*a * *b;
+
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, la = (uint32_t)*a;
+	uint64_t hb = *b >> 32, lb = (uint32_t)*b;
+	uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+	uint64_t t  = ll + (hl << 32);
+	uint64_t lo = t + (lh << 32);
+	uint64_t c  = (t < ll) + (lo < t);
+
+	*a = lo;
+	*b = hh + (hl >> 32) + (lh >> 32) + c;
+#endif
+}
+
+static uint64_t _hsh_wymix(uint64_t a, uint64_t b)
+{
+	_hsh_mum(&a, &b);
+	return a ^ b;
+}
+
+static uint64_t _hsh_read8(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static uint64_t _hsh_read4(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+/* Hash |len| bytes at |data|.  Different values of |seed| give unrelated
+   hash functions. */
+
+unsigned long _hsh_hash_bytes(const void *data, size_t len,
+							  unsigned long seed)
+{
+	const unsigned char *p = data;
+	uint64_t            s  = seed;
+	uint64_t            a;
+	uint64_t            b;
+
+	s ^= _hsh_wymix(s ^ HSH_P0, HSH_P1);
+	if (len <= 16) {
+		if (len >= 4) {
+			size_t k = (len >> 3) << 2;
+
+			a = _hsh_read4(p) << 32 | _hsh_read4(p + k);
+			b = _hsh_read4(p + len - 4) << 32 | _hsh_read4(p + len - 4 - k);
+		} else if (len > 0) {
+			a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+
+		if (i > 48) {
+			uint64_t s1 = s;
+			uint64_t s2 = s;
+
+			do {
+				s  = _hsh_wymix(_hsh_read8(p) ^ HSH_P1,
+								_hsh_read8(p + 8) ^ s);
+				s1 = _hsh_wymix(_hsh_read8(p + 16) ^ HSH_P2,
+								_hsh_read8(p + 24) ^ s1);
+				s2 = _hsh_wymix(_hsh_read8(p + 32) ^ HSH_P3,
+								_hsh_read8(p + 40) ^ s2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			s ^= s1 ^ s2;
+		}
+		for (; i > 16; i -= 16, p += 16)
+			s = _hsh_wymix(_hsh_read8(p) ^ HSH_P1, _hsh_read8(p + 8) ^ s);
+		a = _hsh_read8(p + i - 16);
+		b = _hsh_read8(p + i - 8);
+	}
+
+	a ^= HSH_P1;
+	b ^= s;
+	_hsh_mum(&a, &b);
+	a = _hsh_wymix(a ^ HSH_P0 ^ len, b ^ HSH_P1);
+#if SIZEOF_LONG == 8
+	return a;
+#else
+	return (unsigned long)(a ^ (a >> 32));
+#endif
+}
+
+/* The seeds of HSH_RANDOM_SEED are the hashes of a counter and the
+   process id, keyed by bytes read once from "/dev/urandom" (or, failing
+   that, taken from the clock and the address space), so that drawing a
+   seed is cheap enough for many small tables. */
+
+static pthread_mutex_t _hsh_seed_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long   _hsh_seed_key;
+static unsigned long   _hsh_seed_count;
+
+static unsigned long _hsh_seed_key_read(void)
+{
+	unsigned long  key = 0;
+	int            fd  = open("/dev/urandom", O_RDONLY);
+	struct timeval tv;
+
+	if (fd >= 0) {
+		if (read(fd, &key, sizeof(key)) != (ssize_t)sizeof(key)) key = 0;
+		close(fd);
+	}
+	if (!key) {
+		gettimeofday(&tv, NULL);
+		key = _hsh_hash_bytes(&tv, sizeof(tv),
+							  (unsigned long)(uintptr_t)&tv ^ clock());
+	}
+	return key;
+}
+
+unsigned long _hsh_random_seed(void)
+{
+	unsigned long v[2];
+	unsigned long seed;
+
+	pthread_mutex_lock(&_hsh_seed_lock);
+	if (!_hsh_seed_key) _hsh_seed_key = _hsh_seed_key_read();
+	v[0] = ++_hsh_seed_count;
+	pthread_mutex_unlock(&_hsh_seed_lock);
+	v[1] = (unsigned long)getpid();
+
+	seed = _hsh_hash_bytes(v, sizeof(v), _hsh_seed_key);
+	return seed ? seed : HSH_GOLDEN;	/* Zero would mean no seed */
+}
+
+/* \doc |hsh_string_hash_fast| hashes a null-terminated string a word at a
+   time (the length is found first, by |strlen|, which is vectorized by
+   most C libraries).  It is much faster than |hsh_string_hash| for all
+   but the shortest strings, and is used by |hsh_create| and |set_create|
+   when |hash| is "NULL".  The hash values depend on the byte order of the
+   machine. */
+
+unsigned long hsh_string_hash_fast(const void *key)
+{
+	if (!key)
+		err_internal(__func__, "String-valued keys may not be NULL");
+
+	return _hsh_hash_bytes(key, strlen((const char *)key), 0);
+}
+
+/* \doc |hsh_pointer_hash_fast| hashes the \emph{value} of a pointer with
+   a single multiplication, folding the high bits of the product into the
+   low ones.  It may be used instead of |hsh_pointer_hash| together with
+   |hsh_pointer_compare|. */
+
+unsigned long hsh_pointer_hash_fast(const void *key)
+{
+	unsigned long h = (unsigned long)(uintptr_t)key * HSH_GOLDEN;
+
+	return h ^ (h >> (sizeof(unsigned long) * CHAR_BIT / 2));
+}
+
+int hsh_string_compare(const void *key1, const void *key2)
+{
+	if (!key1 || !key2)
+		err_internal(__func__,
+					 "String-valued keys may not be NULL: key1=%p, key2=%p",
+					 key1, key2);
+	return strcmp((const char *)key1, (const char *)key2);
+}
+
+int hsh_pointer_compare(const void *key1, const void *key2)
+{
+	intptr_t v1 = (const char *)key1 - (const char *)0;
+	intptr_t v2 = (const char *)key2 - (const char *)0;
+
+	if (v1 < v2)
+		return -1;
+	else if (v1 > v2)
+		return 1;
+	else
+		return 0;
+}
+
+/* Mark |t| readonly while positions are used, unless it is shared, and
+   so readonly already. */
+
+static void _hsh_iterating(tableType t, int flag)
+{
+	if (!t->shared) t->readonly = flag;
+}
+
+/* \doc |hsh_init_position| returns a position marker for some arbitary
+   first element in the table.  This marker can be used with
+   |hsh_next_position| and |hsh_get_position|. */
+
+hsh_Position hsh_init_position(hsh_HashTable table)
+{
+	tableType     t = (tableType)table;
+	unsigned long i;
+
+	_hsh_check(t, __func__);
+	if (t->slots) {
+		slotType s = _hsh_oa_next(t, NULL);
+
+		if (s) _hsh_iterating(t, 1);
+		return s;
+	}
+
+	for (i = 0; i < t->prime; i++) if (t->buckets[i]) {
+			_hsh_iterating(t, 1);
+			return t->buckets[i];
+		}
+	for (i = t->migrated; i < t->old_prime; i++) if (t->old_buckets[i]) {
+			_hsh_iterating(t, 1);
+			return t->old_buckets[i];
+		}
+	return NULL;
+}
+
+/* \doc |hsh_next_position| returns a position marker for the next element
+   in the table.  Elements are in arbitrary order based on their positions
+   in the hash table, or in the order of their insertion in an
+   |HSH_ORDERED| table. */
+
+hsh_Position hsh_next_position(hsh_HashTable table, hsh_Position position)
+{
+	tableType     t = (tableType)table;
+	bucketType    b = (bucketType)position;
+	bucketType    pt;
+	unsigned long i;
+	unsigned long h;
+
+	_hsh_check(t, __func__);
+   
+	if (!b){
+		_hsh_iterating(t, 0);
+		return NULL;
+	}
+
+	if (t->slots) {
+		slotType s = _hsh_oa_next(t, (slotType)position);
+
+		if (!s) _hsh_iterating(t, 0);
+		return s;
+	}
+   
+	if (b->next) return b->next;
+
+	h = HSH_INDEX(b->hash, t->prime, t->shift);
+	for (pt = t->buckets[h]; pt && pt != b; pt = pt->next);
+	if (t->old_buckets && !pt) {
+		/* The list was in the old array, which is visited last */
+		h = HSH_INDEX(b->hash, t->old_prime, t->old_shift);
+		for (i = h + 1; i < t->old_prime; i++)
+			if (t->old_buckets[i]) return t->old_buckets[i];
+
+		_hsh_iterating(t, 0);
+		return NULL;
+	}
+
+	for (i = h + 1; i < t->prime; i++)
+		if (t->buckets[i]) return t->buckets[i];
+	for (i = t->migrated; i < t->old_prime; i++)
+		if (t->old_buckets[i]) return t->old_buckets[i];
+
+	_hsh_iterating(t, 0);
+	return NULL;
+}
+
+/* \doc |hsh_get_position| returns the datum associated with the |position|
+   marker, or "NULL" if there is no such datum.  |key| is set to the key
+   associated with this datum, or "NULL" is there is no such datum. */
+
+void *hsh_get_position(hsh_Position position, void **key)
+{
+	bucketType b = (bucketType)position;
+
+	*key = NULL;
+	if (!b) return NULL;
+
+	*key = __UNCONST(b->key);	/* Discard const */
+	return __UNCONST(b->datum);	/* Discard const */
+}
+
+/* \doc |hsh_get_position_length| returns the length of the key at
+   |position| in an |HSH_SIZED_KEYS| |table|. */
+
+size_t hsh_get_position_length(hsh_HashTable table, hsh_Position position)
+{
+	_hsh_check_sized(table, __func__);
+	if (!position) return 0;
+	return ((sizedBucketType)position)->length;
+}
+
+/* \doc |hsh_readonly| sets the |readonly| flag for the |table| to |flag|.
+   |flag| should be 0 or 1.  The value of the previous flag is returned.
+   When a hash table is marked as readonly, self-organization of the
+   bucket-overflow lists will not take place, and any attempt to modify the
+   list (e.g., insertion or deletion) will result in an error. */
+
+int hsh_readonly(hsh_HashTable table, int flag)
+{
+	tableType t = (tableType)table;
+	int       current;
+
+	_hsh_check(t, __func__);
+	if (t->shared) {
+		if (!flag)
+			err_internal(__func__, "Attempt to change shared table");
+		return 1;
+	}
+
+	current     = t->readonly;
+	t->readonly = flag;
+	return current;
+}
+
+/* \doc |hsh_shared| sets the |shared| flag for the |table| to |flag|, and
+   returns the value of the previous flag.  A shared table is readonly (see
+   |hsh_readonly|), and, in addition, no lookup or iteration stores
+   anything into its memory.  A large table built by a process that then
+   calls |fork| (for instance, with |pr_open2|) thus stays in pages that
+   are shared by all of the children, rather than being copied into each
+   child that searches it.
+
+   The counters of |hsh_get_stats| are kept in a separate page while the
+   table is shared, so that each process counts its own lookups; they are
+   folded back into the table when |flag| is zero.  Lookups in a shared
+   |HSH_PROFILE| table are not profiled.  A shared table may be destroyed
+   without being unshared first. */
+
+int hsh_shared(hsh_HashTable table, int flag)
+{
+	tableType t       = (tableType)table;
+	int       current;
+
+	_hsh_check(t, __func__);
+	current = t->shared;
+
+	if (flag && !t->shared) {
+		void *pt;
+
+		if (t->readonly)
+			err_internal(__func__, "Attempt to share readonly table");
+		if (posix_memalign(&pt, MEM_PAGE, MEM_PAGE))
+			err_fatal(__func__, "Out of memory for shared counters");
+		t->counters  = pt;
+		*t->counters = t->own;
+		t->parked    = t->profile;
+		t->profile   = NULL;
+		t->readonly  = 1;
+		t->shared    = 1;
+	} else if (!flag && t->shared) {
+		t->own      = *t->counters;
+		free(t->counters);	/* from posix_memalign */
+		t->counters = &t->own;
+		t->profile  = t->parked;
+		t->parked   = NULL;
+		t->readonly = 0;
+		t->shared   = 0;
+	}
+	return current;
+}
+
+static void _hsh_snapshot_check(snapshotType s, const char *function)
+{
+	if (!s) err_internal(function, "snapshot is null");
+#if MAA_MAGIC
+	if (s->magic != HSH_SNAPSHOT_MAGIC)
+		err_internal(function,
+					 "Magic match failed: 0x%08x (should be 0x%08x)",
+					 s->magic,
+					 HSH_SNAPSHOT_MAGIC);
+#endif
+}
+
+static int _hsh_snapshot_add(const void *key, const void *datum, void *arg)
+{
+	savedType s = (savedType)arg;
+
+	s->entries[s->count].key     = key;
+	s->entries[s->count++].datum = datum;
+	return 0;
+}
+
+/* Return a copy of all of the entries of |t|. */
+
+static savedType _hsh_snapshot_all(tableType t)
+{
+	savedType s;
+
+	if (!t->entries) return &_hsh_saved_none;
+	s        = xmalloc(offsetof(struct saved, entries)
+					   + t->entries * sizeof(struct saved_entry));
+	s->count = 0;
+	_hsh_iterate(t, NULL, _hsh_snapshot_add, s);
+	return s;
+}
+
+/* \doc |hsh_snapshot| returns a view of the entries of |table| as they are
+   now, which |hsh_snapshot_iterate| walks while the |table| keeps
+   changing.  Taking a snapshot of a table of lists or of an open
+   addressing table copies nothing: a span of 64 lists or tags is copied
+   into the snapshot only before it is first changed, so that an export
+   costs the writers little more than the spans that they change during
+   it.  Meanwhile, lookups do not reorganize the lists, and deletions do
+   not shrink the |table|.  Growing or compacting the |table|, or
+   destroying it, copies the rest of the snapshot at once.  Snapshots of
+   |HSH_ORDERED|, |HSH_SMALL| and |HSH_CONCURRENT| tables, and of tables
+   being resized incrementally and marked readonly, are copied entirely
+   by |hsh_snapshot|.
+
+   |hsh_snapshot| and |hsh_snapshot_destroy| change the |table|, and are
+   called as its other writers are, but |hsh_snapshot_iterate| may run in
+   another thread at the same time as the writers.  The keys and data are
+   not copied, so those deleted from the |table| must be kept until the
+   snapshot is destroyed.  Addresses returned by |hsh_find_or_insert|
+   before the snapshot was taken must not be used to change data. */
+
+hsh_Snapshot hsh_snapshot(hsh_HashTable table)
+{
+	tableType    t = (tableType)table;
+	snapshotType s;
+
+	_hsh_check(t, __func__);
+	if (t->old_buckets && !t->readonly && !t->iterating)
+		_hsh_migrate(t, t->old_prime);
+
+	s = xmalloc(sizeof(struct snapshot));
+#if MAA_MAGIC
+	s->magic = HSH_SNAPSHOT_MAGIC;
+#endif
+	pthread_mutex_init(&s->lock, NULL);
+
+	if (t->concurrent || t->small || t->order || t->old_buckets) {
+		s->table   = NULL;
+		s->next    = NULL;
+		s->spans   = 1;
+		s->unsaved = 0;
+		s->saved   = xmalloc(sizeof(savedType));
+		if (t->concurrent) pthread_mutex_lock(&t->concurrent->lock);
+		s->saved[0] = _hsh_snapshot_all(t);
+		if (t->concurrent) pthread_mutex_unlock(&t->concurrent->lock);
+		return s;
+	}
+
+	s->table     = t;
+	s->next      = t->snapshots;
+	s->spans     = (t->prime + HSH_SNAPSHOT_SPAN - 1) / HSH_SNAPSHOT_SPAN;
+	s->unsaved   = s->spans;
+	s->saved     = xcalloc(s->spans, sizeof(savedType));
+	t->snapshots = s;
+	return s;
+}
+
+/* \doc |hsh_snapshot_iterate| calls |iterator| for every entry of the
+   table when |snapshot| was taken, as |hsh_iterate_arg| does.  The
+   |iterator| may change the table. */
+
+int hsh_snapshot_iterate(
+	hsh_Snapshot snapshot,
+	int (*iterator)(const void *key,
+					const void *datum,
+					void *arg),
+	void *arg)
+{
+	snapshotType  s      = (snapshotType)snapshot;
+	int           result = 0;
+	savedType     saved;
+	savedType     copy;
+	unsigned long n;
+	unsigned long i;
+
+	_hsh_snapshot_check(s, __func__);
+	for (n = 0; n < s->spans && !result; n++) {
+		/* A span still in the table is copied too, since |iterator| may
+		   change it, or a writer may, once the lock is released. */
+		pthread_mutex_lock(&s->lock);
+		saved = s->saved[n];
+		copy  = saved ? NULL : _hsh_snapshot_copy(s->table, n);
+		pthread_mutex_unlock(&s->lock);
+
+		if (copy) saved = copy;
+		for (i = 0; i < saved->count && !result; i++)
+			result = iterator(saved->entries[i].key,
+							  saved->entries[i].datum, arg);
+		_hsh_saved_free(copy);
+	}
+	return result != 0;
+}
+
+/* \doc |hsh_snapshot_destroy| frees all of the memory associated with the
+   |snapshot|, but not the keys and data.  The table may have been
+   destroyed already. */
+
+void hsh_snapshot_destroy(hsh_Snapshot snapshot)
+{
+	snapshotType  s = (snapshotType)snapshot;
+	snapshotType  *prev;
+	unsigned long n;
+
+	_hsh_snapshot_check(s, __func__);
+	if (s->table) {
+		for (prev = &s->table->snapshots; *prev != s; prev = &(*prev)->next);
+		*prev = s->next;
+	}
+	for (n = 0; n < s->spans; n++) _hsh_saved_free(s->saved[n]);
+	xfree(s->saved);
+	pthread_mutex_destroy(&s->lock);
+#if MAA_MAGIC
+	s->magic = HSH_SNAPSHOT_MAGIC_FREED;
+#endif
+	xfree(s);			/* terminal */
+}
+
+/* Sharded tables.  Each shard is an independent table with its own lock,
+   padded to a cache line so that threads working on different shards do
+   not contend for the same line.  The shard of a key is selected by the
+   top bits of its mixed hash value, which are not the bits used by the
+   shard itself to select a list. */
+
+typedef struct shard {
+	pthread_mutex_t lock;
+	tableType       table;
+	char            pad[HSH_CACHE_LINE
+						- (sizeof(pthread_mutex_t) + sizeof(tableType))
+						% HSH_CACHE_LINE];
+} *shardType;
+
+typedef struct sharded {
+#if MAA_MAGIC
+	int           magic;
+#endif
+	unsigned long (*hash)(const void *);
+	unsigned long seed;		/* HSH_RANDOM_SEED: shared by the shards */
+	int           flags;
+	unsigned long count;		/* Number of shards, a power of two */
+	int           shift;
+	shardType     shards;
+} *shardedType;
+
+#define HSH_SHARDS 64		/* Default number of shards */
+
+static void _hsh_sharded_check(shardedType s, const char *function)
+{
+	if (!s) err_internal(function, "table is null");
+#if MAA_MAGIC
+	if (s->magic != HSH_SHARDED_MAGIC)
+		err_internal(function,
+					 "Magic match failed: 0x%08x (should be 0x%08x)",
+					 s->magic,
+					 HSH_SHARDED_MAGIC);
+#endif
+}
+
+static unsigned long _hsh_sharded_hash(shardedType s, const void *key)
+{
+	if (!s->seed) return s->hash(key);
+	if (!key) err_internal(__func__, "String-valued keys may not be NULL");
+	return _hsh_hash_bytes(key, strlen((const char *)key), s->seed);
+}
+
+static shardType _hsh_shard(shardedType s, unsigned long hash)
+{
+	if (s->count == 1) return s->shards;
+	return s->shards + (_hsh_def_mix(hash) >> s->shift);
+}
+
+/* \doc |hsh_sharded_create| creates a table that many threads may insert
+   into, delete from and retrieve from at once.  The keys are partitioned
+   into |shards| independent hash tables (rounded up to a power of two, or
+   64 if |shards| is not positive), each protected by its own mutex.
+   |hash| and |compare| are used as for |hsh_create|, and |flags| are
+   passed to |hsh_create2| for each shard.  If |flags| contains
+   |HSH_CONCURRENT|, retrievals do not take the lock of the shard.
+   With |HSH_RANDOM_SEED|, all of the shards share one seed.
+
+   The |hsh_sharded_| functions mirror the corresponding |hsh_| functions.
+   There are no positions for sharded tables, and |iterator| functions must
+   not call |hsh_sharded_| functions on the same table. */
+
+hsh_ShardedTable hsh_sharded_create(
+	unsigned long (*hash)(const void *),
+	int (*compare)(const void *,
+				   const void *),
+	int shards,
+	int flags)
+{
+	shardedType   s     = xmalloc(sizeof(struct sharded));
+	unsigned long count = 1;
+	unsigned long i;
+	void          *pt;
+	hsh_Options   o;
+
+	if (flags & HSH_SIZED_KEYS)
+		err_fatal(__func__, "HSH_SIZED_KEYS is not supported by shards");
+	if (shards <= 0) shards = HSH_SHARDS;
+	while (count < (unsigned long)shards) count <<= 1;
+
+#if MAA_MAGIC
+	s->magic = HSH_SHARDED_MAGIC;
+#endif
+	s->hash  = hash ? hash : hsh_string_hash_fast;
+	s->seed  = (flags & HSH_RANDOM_SEED) && !hash ? _hsh_random_seed() : 0;
+	s->flags = flags;
+	s->count = count;
+	s->shift = _hsh_shift(count);
+	if (posix_memalign(&pt, HSH_CACHE_LINE, count * sizeof(struct shard)))
+		err_fatal(__func__, "Out of memory for %lu shards", count);
+	s->shards = pt;
+
+	memset(&o, 0, sizeof(o));
+	o.hash    = hash;
+	o.compare = compare;
+	o.flags   = flags;
+	o.seed    = s->seed;
+	for (i = 0; i < count; i++) {
+		pthread_mutex_init(&s->shards[i].lock, NULL);
+		s->shards[i].table = _hsh_create(&o);
+	}
+
+	return s;
+}
+
+/* \doc |hsh_sharded_destroy| frees all of the memory associated with the
+   sharded |table|, but not the keys and data. */
+
+void hsh_sharded_destroy(hsh_ShardedTable table)
+{
+	shardedType   s = (shardedType)table;
+	unsigned long i;
+
+	_hsh_sharded_check(s, __func__);
+	for (i = 0; i < s->count; i++) {
+		hsh_destroy(s->shards[i].table);
+		pthread_mutex_destroy(&s->shards[i].lock);
+	}
+	free(s->shards);		/* terminal, from posix_memalign */
+#if MAA_MAGIC
+	s->magic = HSH_SHARDED_MAGIC_FREED;
+#endif
+	xfree(s);			/* terminal */
+}
+
+int hsh_sharded_insert(
+	hsh_ShardedTable table,
+	const void *key,
+	const void *datum)
+{
+	shardedType   s    = (shardedType)table;
+	unsigned long hash = _hsh_sharded_hash(s, key);
+	shardType     sh;
+	int           result;
+
+	_hsh_sharded_check(s, __func__);
+	sh = _hsh_shard(s, hash);
+	pthread_mutex_lock(&sh->lock);
+	result = _hsh_insert_hash(sh->table, hash, key, datum);
+	pthread_mutex_unlock(&sh->lock);
+
+	return result;
+}
+
+int hsh_sharded_delete(hsh_ShardedTable table, const void *key)
+{
+	shardedType   s    = (shardedType)table;
+	unsigned long hash = _hsh_sharded_hash(s, key);
+	shardType     sh;
+	int           result;
+
+	_hsh_sharded_check(s, __func__);
+	sh = _hsh_shard(s, hash);
+	pthread_mutex_lock(&sh->lock);
+	result = _hsh_delete_hash(sh->table, hash, key);
+	pthread_mutex_unlock(&sh->lock);
+
+	return result;
+}
+
+const void *hsh_sharded_retrieve(hsh_ShardedTable table, const void *key)
+{
+	shardedType   s    = (shardedType)table;
+	unsigned long hash = _hsh_sharded_hash(s, key);
+	shardType     sh;
+	const void    *datum;
+
+	_hsh_sharded_check(s, __func__);
+	sh = _hsh_shard(s, hash);
+	if (s->flags & HSH_CONCURRENT)
+		return _hsh_retrieve_hash(sh->table, hash, key);
+
+	pthread_mutex_lock(&sh->lock);
+	datum = _hsh_retrieve_hash(sh->table, hash, key);
+	pthread_mutex_unlock(&sh->lock);
+
+	return datum;
+}
+
+/* \doc |hsh_sharded_iterate| calls |iterator| for every entry, one shard
+   at a time, holding the lock of that shard. */
+
+int hsh_sharded_iterate(
+	hsh_ShardedTable table,
+	int (*iterator)(const void *key,
+					const void *datum,
+					void *arg),
+	void *arg)
+{
+	shardedType   s = (shardedType)table;
+	unsigned long i;
+	int           result = 0;
+
+	_hsh_sharded_check(s, __func__);
+	for (i = 0; i < s->count && !result; i++) {
+		pthread_mutex_lock(&s->shards[i].lock);
+		result = hsh_iterate_arg(s->shards[i].table, iterator, arg);
+		pthread_mutex_unlock(&s->shards[i].lock);
+	}
+
+	return result;
+}
+
+/* \doc |hsh_sharded_get_stats| returns the statistics of all of the
+   shards of |table| added together, except for |maximum_length|, which is
+   the largest of the shards. */
+
+hsh_Stats hsh_sharded_get_stats(hsh_ShardedTable table)
+{
+	shardedType   s     = (shardedType)table;
+	hsh_Stats     total = xmalloc(sizeof(struct hsh_Stats));
+	unsigned long i;
+
+	_hsh_sharded_check(s, __func__);
+	memset(total, 0, sizeof(struct hsh_Stats));
+
+	for (i = 0; i < s->count; i++) {
+		hsh_Stats st;
+
+		pthread_mutex_lock(&s->shards[i].lock);
+		st = hsh_get_stats(s->shards[i].table);
+		pthread_mutex_unlock(&s->shards[i].lock);
+
+		total->size          += st->size;
+		total->resizings     += st->resizings;
+		total->entries       += st->entries;
+		total->buckets_used  += st->buckets_used;
+		total->singletons    += st->singletons;
+		total->maximum_length = max(total->maximum_length,
+									st->maximum_length);
+		total->retrievals    += st->retrievals;
+		total->hits          += st->hits;
+		total->misses        += st->misses;
+		total->mapped        += st->mapped;
+		total->pages         += st->pages;
+		total->huge_pages    += st->huge_pages;
+		total->long_chains   += st->long_chains;
+		total->sorted_lists  += st->sorted_lists;
+		xfree(st);		/* rare */
+	}
+
+	return total;
+}
+
+void hsh_sharded_print_stats(hsh_ShardedTable table, FILE *stream)
+{
+	hsh_Stats s = hsh_sharded_get_stats(table);
+
+	_hsh_print_stats(s, table, stream);
+	xfree(s);			/* rare */
+}
+
+/* Frozen tables.
+
+   |hsh_freeze| copies the entries of a table into a flat array indexed by
+   a minimal perfect hash function, built as in PTHash: the mixed hash
+   value of a key selects a bucket, and each bucket stores a small
+   ``pilot'', chosen so that the keys of the bucket land in distinct, free
+   slots of an array slightly larger than the number of keys.  Slots past
+   the number of keys are remapped into the holes left below it.  A
+   retrieval therefore costs one pilot, one slot and one key comparison,
+   with no chains to follow.
+
+   Keys whose hash values are equal cannot be separated by any pilot, so
+   all but the first of them are kept in a small overflow array, sorted by
+   hash value and searched only when the slot does not match. */
+
+#define HSH_FROZEN_LOAD   0.99	/* Keys per slot addressed by pilots */
+#define HSH_FROZEN_BUCKET 4	/* 4n / log2(n) buckets for n keys */
+#define HSH_FROZEN_SKEW   UINT64_C(0x99999999) /* 60% of the keys go to */
+#define HSH_FROZEN_FRONT  0.3		   /* 30% of the buckets */
+#define HSH_FROZEN_TRIES  (1UL << 24)	/* Pilots tried for one bucket */
+#define HSH_FROZEN_SEEDS  16		/* Seeds tried before giving up */
+#define HSH_FROZEN_GOLDEN UINT64_C(0x9e3779b97f4a7c15)
+#define HSH_FROZEN_ODD    UINT64_C(0xbf58476d1ce4e5b9)
+
+typedef struct frozen_entry {
+	const void    *key;
+	const void    *datum;
+} *frozenEntryType;
+
+typedef struct frozen_key {	/* Entries of a table being frozen */
+	unsigned long hash;
+	uint64_t      x;
+	unsigned long bucket;
+	unsigned long position;
+	const void    *key;
+	const void    *datum;
+	size_t        length;
+} *frozenKeyType;
+
+typedef struct frozen {
+#if MAA_MAGIC
+	int             magic;
+#endif
+	unsigned long   (*hash)(const void *);
+	int             (*compare)(const void *, const void *);
+	unsigned long   seed;		/* As in the table frozen */
+	int             flags;
+	uint64_t        mix;		/* Seed of the perfect hash function */
+	unsigned long   count;		/* Entries in |entries| */
+	unsigned long   size;		/* Slots addressed by the pilots */
+	unsigned long   buckets;
+	unsigned long   front;		/* Buckets taking 60% of the keys */
+	int             width;		/* Bytes per pilot: 1, 2 or 4 */
+	void            *pilots;
+	uint32_t        *remap;		/* Slots |count| to |size - 1| */
+	frozenEntryType entries;
+	size_t          *lengths;	/* HSH_SIZED_KEYS only */
+	unsigned long   overflow_count;
+	frozenKeyType   overflow;
+} *frozenType;
+
+static void _hsh_frozen_check(frozenType f, const char *function)
+{
+	if (!f) err_internal(function, "table is null");
+#if MAA_MAGIC
+	if (f->magic != HSH_FROZEN_MAGIC)
+		err_internal(function,
+					 "Magic match failed: 0x%08x (should be 0x%08x)",
+					 f->magic,
+					 HSH_FROZEN_MAGIC);
+#endif
+}
+
+static uint64_t _hsh_frozen_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= UINT64_C(0xff51afd7ed558ccd);
+	x ^= x >> 33;
+	x *= UINT64_C(0xc4ceb9fe1a85ec53);
+	x ^= x >> 33;
+	return x;
+}
+
+/* |length| is only used for HSH_SIZED_KEYS and seeded tables. */
+
+static unsigned long _hsh_frozen_hash(frozenType f, const void *key,
+									  size_t length)
+{
+	if (!(f->flags & HSH_SIZED_KEYS) && !f->seed) return f->hash(key);
+	return _hsh_hash_bytes(key, length, f->seed);
+}
+
+static unsigned long _hsh_frozen_bucket(frozenType f, uint64_t x)
+{
+	uint64_t lo = (uint32_t)x;
+
+	if ((x >> 32) < HSH_FROZEN_SKEW) return (lo * f->front) >> 32;
+	return f->front + ((lo * (f->buckets - f->front)) >> 32);
+}
+
+static unsigned long _hsh_frozen_position(frozenType f, uint64_t x,
+										  uint64_t pilot)
+{
+	uint64_t a = (x ^ (pilot * HSH_FROZEN_GOLDEN)) * HSH_FROZEN_ODD;
+	uint64_t b = f->size;
+
+	_hsh_mum(&a, &b);
+	return b;
+}
+
+static unsigned long _hsh_frozen_pilot(frozenType f, unsigned long bucket)
+{
+	switch (f->width) {
+	case 1:  return ((uint8_t *)f->pilots)[bucket];
+	case 2:  return ((uint16_t *)f->pilots)[bucket];
+	default: return ((uint32_t *)f->pilots)[bucket];
+	}
+}
+
+/* Return the slot of the only key that may have the given |hash|. */
+
+static unsigned long _hsh_frozen_slot(frozenType f, unsigned long hash)
+{
+	uint64_t      x    = _hsh_frozen_mix(hash + f->mix);
+	unsigned long slot = _hsh_frozen_position(
+		f, x, _hsh_frozen_pilot(f, _hsh_frozen_bucket(f, x)));
+
+	return slot < f->count ? slot : f->remap[slot - f->count];
+}
+
+static int _hsh_frozen_compare(const void *a, const void *b)
+{
+	unsigned long ha = ((const struct frozen_key *)a)->hash;
+	unsigned long hb = ((const struct frozen_key *)b)->hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+/* Find pilots for the |f->count| distinct |keys|.  Return non-zero if
+   some bucket could not be placed, in which case another |f->mix| should
+   be tried. */
+
+static int _hsh_frozen_build(frozenType f, frozenKeyType keys)
+{
+	unsigned long m       = f->count;
+	unsigned long *start  = xmalloc((f->buckets + 1) * sizeof(unsigned long));
+	unsigned long *order  = xmalloc(m * sizeof(unsigned long));
+	unsigned long *sorted = xmalloc(f->buckets * sizeof(unsigned long));
+	uint32_t      *pilots = xmalloc(f->buckets * sizeof(uint32_t));
+	char          *taken  = xmalloc(f->size);
+	unsigned long *sizes;
+	unsigned long largest = 0;
+	unsigned long maximum = 0;
+	unsigned long i;
+	unsigned long j;
+	unsigned long k;
+	int           failed  = 0;
+
+	memset(start, 0, (f->buckets + 1) * sizeof(unsigned long));
+	memset(taken, 0, f->size);
+	for (i = 0; i < m; i++) {
+		keys[i].x      = _hsh_frozen_mix(keys[i].hash + f->mix);
+		keys[i].bucket = _hsh_frozen_bucket(f, keys[i].x);
+		++start[keys[i].bucket + 1];
+	}
+	for (i = 0; i < f->buckets; i++) {
+		largest = max(largest, start[i + 1]);
+		start[i + 1] += start[i];
+	}
+	for (i = 0; i < m; i++) order[start[keys[i].bucket]++] = i;
+	for (i = f->buckets; i > 0; i--) start[i] = start[i - 1];
+	start[0] = 0;
+
+	/* Place the largest buckets first, while the array is empty */
+	sizes = xmalloc((largest + 2) * sizeof(unsigned long));
+	memset(sizes, 0, (largest + 2) * sizeof(unsigned long));
+	for (i = 0; i < f->buckets; i++)
+		++sizes[largest - (start[i + 1] - start[i]) + 1];
+	for (i = 0; i <= largest; i++) sizes[i + 1] += sizes[i];
+	for (i = 0; i < f->buckets; i++)
+		sorted[sizes[largest - (start[i + 1] - start[i])]++] = i;
+	xfree(sizes);
+
+	for (i = 0; i < f->buckets && !failed; i++) {
+		unsigned long b     = sorted[i];
+		unsigned long first = start[b];
+		unsigned long last  = start[b + 1];
+		unsigned long pilot;
+
+		if (first == last) {
+			pilots[b] = 0;
+			continue;
+		}
+		for (pilot = 0; pilot < HSH_FROZEN_TRIES; pilot++) {
+			for (j = first; j < last; j++) {
+				frozenKeyType key = &keys[order[j]];
+
+				key->position = _hsh_frozen_position(f, key->x, pilot);
+				if (taken[key->position]) break;
+				for (k = first; k < j; k++)
+					if (keys[order[k]].position == key->position) break;
+				if (k < j) break;
+			}
+			if (j == last) break;
+		}
+		if (pilot == HSH_FROZEN_TRIES) {
+			failed = 1;
+			break;
+		}
+		for (j = first; j < last; j++) taken[keys[order[j]].position] = 1;
+		pilots[b] = pilot;
+		maximum   = max(maximum, pilot);
+	}
+
+	if (!failed) {
+		/* Slots at or past |m| move to the holes below |m| */
+		f->remap = xmalloc((f->size - m + 1) * sizeof(uint32_t));
+		for (i = m, j = 0; i < f->size; i++) {
+			f->remap[i - m] = 0;
+			if (!taken[i]) continue;
+			while (taken[j]) j++;
+			f->remap[i - m] = j++;
+		}
+
+		f->width  = maximum < 0x100 ? 1 : maximum < 0x10000 ? 2 : 4;
+		f->pilots = xmalloc(f->buckets * f->width);
+		for (i = 0; i < f->buckets; i++) {
+			switch (f->width) {
+			case 1:  ((uint8_t *)f->pilots)[i]  = pilots[i]; break;
+			case 2:  ((uint16_t *)f->pilots)[i] = pilots[i]; break;
+			default: ((uint32_t *)f->pilots)[i] = pilots[i]; break;
+			}
+		}
+	}
+
+	xfree(taken);
+	xfree(pilots);
+	xfree(sorted);
+	xfree(order);
+	xfree(start);
+	return failed;
+}
+
+static frozenType _hsh_frozen_create(tableType t)
+{
+	frozenType f = xmalloc(sizeof(struct frozen));
+
+	if (t->entries > 0xffffffffUL)
+		err_fatal(__func__, "Too many entries to freeze: %lu", t->entries);
+
+#if MAA_MAGIC
+	f->magic    = 0;
+#endif
+	f->hash     = t->hash;
+	f->compare  = t->compare;
+	f->seed     = t->seed;
+	f->flags    = t->flags & HSH_SIZED_KEYS;
+	f->mix      = 0;
+	f->count    = 0;
+	f->size     = 0;
+	f->buckets  = 0;
+	f->front    = 0;
+	f->width    = 1;
+	f->pilots   = NULL;
+	f->remap    = NULL;
+	f->entries  = NULL;
+	f->lengths  = NULL;
+	f->overflow = NULL;
+	f->overflow_count = 0;
+
+	return f;
+}
+
+/* Return the entries of |t|, with their hash values as |f| computes
+   them. */
+
+static frozenKeyType _hsh_frozen_keys(frozenType f, tableType t)
+{
+	frozenKeyType keys     = xmalloc((t->entries + 1)
+									 * sizeof(struct frozen_key));
+	int           readonly = t->readonly;
+	hsh_Position  position;
+	unsigned long n        = 0;
+
+	for (position = hsh_init_position(t);
+		 position;
+		 position = hsh_next_position(t, position)) {
+		void *key;
+
+		keys[n].datum  = hsh_get_position(position, &key);
+		keys[n].key    = key;
+		keys[n].length = 0;
+		if (f->flags & HSH_SIZED_KEYS)
+			keys[n].length = hsh_get_position_length(t, position);
+		else if (f->seed)
+			keys[n].length = strlen((const char *)key);
+		keys[n].hash = _hsh_frozen_hash(f, key, keys[n].length);
+		++n;
+	}
+	t->readonly = readonly;	/* The walk ends by clearing it */
+
+	return keys;
+}
+
+/* Build the perfect hash function of |f| for the |n| |keys|, and move
+   all but the first of the keys sharing a hash value to the overflow
+   array.  The |m| keys left at the front of |keys| are returned, with
+   their slots in |position|. */
+
+static unsigned long _hsh_frozen_index(frozenType f, frozenKeyType keys,
+									   unsigned long n)
+{
+	unsigned long m = 0;
+	unsigned long i;
+	int           attempt;
+	int           bits;
+
+	qsort(keys, n, sizeof(struct frozen_key), _hsh_frozen_compare);
+	for (i = 0; i < n; i++) {
+		if (i && keys[i].hash == keys[m - 1].hash) {
+			if (!f->overflow)
+				f->overflow = xmalloc(n * sizeof(struct frozen_key));
+			f->overflow[f->overflow_count++] = keys[i];
+		} else {
+			keys[m++] = keys[i];
+		}
+	}
+
+	f->count   = m;
+	f->size    = m ? m / HSH_FROZEN_LOAD + 1 : 0;
+	for (bits = 1; bits < 64 && (1UL << bits) < m; bits++);
+	f->buckets = HSH_FROZEN_BUCKET * m / bits + 1;
+	f->front   = f->buckets * HSH_FROZEN_FRONT;
+
+	for (attempt = 0; m && _hsh_frozen_build(f, keys); attempt++) {
+		if (attempt == HSH_FROZEN_SEEDS)
+			err_fatal(__func__, "No perfect hash function found");
+		f->mix = (attempt + 1) * HSH_FROZEN_GOLDEN;
+	}
+
+	for (i = 0; i < m; i++)
+		if (keys[i].position >= m)
+			keys[i].position = f->remap[keys[i].position - m];
+
+	return m;
+}
+
+/* \doc |hsh_freeze| returns an immutable copy of |table|, addressed by a
+   minimal perfect hash function.  Such a table uses a few bits per key in
+   addition to the key and datum pointers, and each retrieval looks at a
+   single entry, so that it is smaller and faster than the original for
+   tables that are built once and then only read.  |table| is not
+   changed, and may be destroyed once it has been frozen.  The keys and
+   data are shared, not copied.
+
+   The frozen table is used with the |hsh_frozen_| functions, which may be
+   called from any number of threads at once. */
+
+hsh_FrozenTable hsh_freeze(hsh_HashTable table)
+{
+	tableType     t = (tableType)table;
+	frozenType    f;
+	frozenKeyType keys;
+	unsigned long m;
+	unsigned long i;
+
+	_hsh_check(t, __func__);
+	f = _hsh_frozen_create(t);
+#if MAA_MAGIC
+	f->magic = HSH_FROZEN_MAGIC;
+#endif
+
+	keys = _hsh_frozen_keys(f, t);
+	m    = _hsh_frozen_index(f, keys, t->entries);
+
+	f->entries = xmalloc((m + 1) * sizeof(struct frozen_entry));
+	if (f->flags & HSH_SIZED_KEYS) f->lengths = xmalloc((m + 1) * sizeof(size_t));
+	for (i = 0; i < m; i++) {
+		unsigned long slot = keys[i].position;
+
+		f->entries[slot].key   = keys[i].key;
+		f->entries[slot].datum = keys[i].datum;
+		if (f->lengths) f->lengths[slot] = keys[i].length;
+	}
+
+	xfree(keys);
+	return f;
+}
+
+/* \doc |hsh_frozen_destroy| frees all of the memory associated with the
+   frozen |table|, but not the keys and data. */
+
+void hsh_frozen_destroy(hsh_FrozenTable table)
+{
+	frozenType f = (frozenType)table;
+
+	_hsh_frozen_check(f, __func__);
+	if (f->pilots) xfree(f->pilots);
+	if (f->remap) xfree(f->remap);
+	if (f->lengths) xfree(f->lengths);
+	if (f->overflow) xfree(f->overflow);
+	xfree(f->entries);
+#if MAA_MAGIC
+	f->magic = HSH_FROZEN_MAGIC_FREED;
+#endif
+	xfree(f);			/* terminal */
+}
+
+static const void *_hsh_frozen_retrieve(frozenType f, unsigned long hash,
+										const void *key, size_t length)
+{
+	unsigned long lo;
+	unsigned long hi;
+
+	if (f->count) {
+		unsigned long slot = _hsh_frozen_slot(f, hash);
+
+		if (f->lengths
+			? f->lengths[slot] == length
+			  && !memcmp(f->entries[slot].key, key, length)
+			: !f->compare(f->entries[slot].key, key))
+			return f->entries[slot].datum;
+	}
+
+	for (lo = 0, hi = f->overflow_count; lo < hi;) {
+		unsigned long mid = lo + (hi - lo) / 2;
+
+		if (f->overflow[mid].hash < hash) lo = mid + 1;
+		else                              hi = mid;
+	}
+	for (; lo < f->overflow_count && f->overflow[lo].hash == hash; lo++) {
+		frozenKeyType o = &f->overflow[lo];
+
+		if (f->lengths
+			? o->length == length && !memcmp(o->key, key, length)
+			: !f->compare(o->key, key))
+			return o->datum;
+	}
+
+	return NULL;
+}
+
+/* \doc |hsh_frozen_retrieve| returns the datum associated with |key| in
+   the frozen |table|, or "NULL" if |key| is not present.  Unlike
+   |hsh_retrieve|, it writes nothing to the table. */
+
+const void *hsh_frozen_retrieve(hsh_FrozenTable table, const void *key)
+{
+	frozenType f      = (frozenType)table;
+	size_t     length = 0;
+
+	_hsh_frozen_check(f, __func__);
+	if ((f->flags & HSH_SIZED_KEYS) || f->seed)
+		length = strlen((const char *)key);
+	return _hsh_frozen_retrieve(f, _hsh_frozen_hash(f, key, length),
+								key, length);
+}
+
+/* \doc |hsh_frozen_retrieve_n| is |hsh_retrieve_n| for frozen
+   |HSH_SIZED_KEYS| tables. */
+
+const void *hsh_frozen_retrieve_n(hsh_FrozenTable table, const void *key,
+								  size_t length)
+{
+	frozenType f = (frozenType)table;
+
+	_hsh_frozen_check(f, __func__);
+	if (!(f->flags & HSH_SIZED_KEYS))
+		err_internal(__func__, "Table was not created with HSH_SIZED_KEYS");
+	return _hsh_frozen_retrieve(f, _hsh_frozen_hash(f, key, length),
+								key, length);
+}
+
+/* \doc |hsh_frozen_iterate| calls |iterator| for every entry of the frozen
+   |table|, as |hsh_iterate_arg| does. */
+
+int hsh_frozen_iterate(
+	hsh_FrozenTable table,
+	int (*iterator)(const void *key,
+					const void *datum,
+					void *arg),
+	void *arg)
+{
+	frozenType    f = (frozenType)table;
+	unsigned long i;
+
+	_hsh_frozen_check(f, __func__);
+	for (i = 0; i < f->count; i++)
+		if (iterator(f->entries[i].key, f->entries[i].datum, arg)) return 1;
+	for (i = 0; i < f->overflow_count; i++)
+		if (iterator(f->overflow[i].key, f->overflow[i].datum, arg)) return 1;
+
+	return 0;
+}
+
+void hsh_frozen_print_stats(hsh_FrozenTable table, FILE *stream)
+{
+	frozenType    f     = (frozenType)table;
+	FILE          *str  = stream ? stream : stdout;
+	unsigned long bytes;
+
+	_hsh_frozen_check(f, __func__);
+	bytes = f->buckets * f->width + (f->size - f->count) * sizeof(uint32_t);
+	fprintf(str, "Statistics for frozen hash table at %p:\n", table);
+	fprintf(str, "   %lu entries (%lu sharing a hash value)\n",
+			f->count + f->overflow_count, f->overflow_count);
+	fprintf(str, "   %lu buckets with %d-byte pilots, %lu slots remapped\n",
+			f->buckets, f->width, f->size - f->count);
+	if (f->count)
+		fprintf(str, "   %.2f bits per key besides the entries\n",
+				8.0 * bytes / f->count);
+}
+
+/* Mapped tables.
+
+   |hsh_save| writes a table of strings to a file that |hsh_map| can use
+   in place: a header, the pilots and remapping of a perfect hash function
+   built as for frozen tables, the entries, and then the bytes of the keys
+   and data.  The file holds offsets rather than pointers, so that it may
+   be mapped at any address, and every process mapping it shares the same
+   pages of the page cache. */
+
+#define HSH_FILE_MAGIC "maa-hsh1"
+#define HSH_FILE_ORDER 0x01020304
+#define HSH_FILE_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+typedef struct file_header {
+	char          magic[8];
+	uint32_t      order;		/* HSH_FILE_ORDER as written */
+	uint32_t      long_size;	/* sizeof(unsigned long) as written */
+	uint32_t      flags;
+	uint32_t      width;
+	uint64_t      seed;
+	uint64_t      mix;
+	uint64_t      count;
+	uint64_t      size;
+	uint64_t      buckets;
+	uint64_t      front;
+	uint64_t      overflow_count;
+	uint64_t      pilots;		/* Offsets from the start of the file */
+	uint64_t      remap;
+	uint64_t      entries;		/* |count| entries by slot, then */
+	uint64_t      length;		/* the overflow entries by hash */
+} *fileHeaderType;
+
+typedef struct file_entry {
+	uint64_t      hash;
+	uint64_t      key;		/* NUL terminated */
+	uint64_t      key_length;
+	uint64_t      datum;		/* Zero for a "NULL" datum */
+	uint64_t      datum_length;
+} *fileEntryType;
+
+typedef struct mapped {
+#if MAA_MAGIC
+	int                     magic;
+#endif
+	struct frozen           index;	/* Pointing into the mapping */
+	const char              *base;
+	size_t                  length;
+	const struct file_entry *entries;
+} *mappedType;
+
+static void _hsh_mapped_check(mappedType p, const char *function)
 {
-	tableType     t = (tableType)table;
-	hsh_Stats     s = xmalloc(sizeof(struct hsh_Stats));
-	unsigned long i;
-	unsigned      count;
+	if (!p) err_internal(function, "table is null");
+#if MAA_MAGIC
+	if (p->magic != HSH_MAPPED_MAGIC)
+		err_internal(function,
+					 "Magic match failed: 0x%08x (should be 0x%08x)",
+					 p->magic,
+					 HSH_MAPPED_MAGIC);
+#endif
+}
+
+static void _hsh_file_write(FILE *str, const void *data, size_t length,
+							const char *filename)
+{
+	static const char zero[8];
+
+	if (!length) return;
+	if (fwrite(data ? data : zero, 1, length, str) != length)
+		err_fatal_errno(__func__, "Cannot write to \"%s\"", filename);
+}
+
+/* Write the |e| entry for |key|, and return the offset of the bytes
+   following its key and datum. */
+
+static uint64_t _hsh_file_entry(fileEntryType e, frozenKeyType key,
+								uint64_t offset,
+								size_t (*datum_length)(const void *datum,
+													   void *arg),
+								void *arg)
+{
+	e->hash         = key->hash;
+	e->key          = offset;
+	e->key_length   = key->length;
+	offset          = HSH_FILE_ALIGN(offset + key->length + 1);
+	e->datum        = key->datum ? offset : 0;
+	e->datum_length = 0;
+	if (key->datum)
+		e->datum_length = datum_length
+			? datum_length(key->datum, arg)
+			: strlen((const char *)key->datum) + 1;
+	return HSH_FILE_ALIGN(offset + e->datum_length);
+}
+
+static void _hsh_file_blobs(FILE *str, frozenKeyType key, fileEntryType e,
+							const char *filename)
+{
+	_hsh_file_write(str, key->key, e->key_length, filename);
+	_hsh_file_write(str, NULL,
+					HSH_FILE_ALIGN(e->key_length + 1) - e->key_length,
+					filename);
+	_hsh_file_write(str, key->datum, e->datum_length, filename);
+	_hsh_file_write(str, NULL,
+					HSH_FILE_ALIGN(e->datum_length) - e->datum_length,
+					filename);
+}
+
+/* \doc |hsh_save| writes the |table| to |filename|, so that it can later
+   be used with |hsh_map|.  The keys of |table| must be strings, so that
+   it was created with a "NULL" |hash| function or with |HSH_SIZED_KEYS|.
+   The bytes of each datum are saved as well: |datum_length(datum, arg)|
+   returns their number, or, if |datum_length| is "NULL", the data are
+   taken to be strings.  "NULL" data are saved as such.
+
+   The seed of the hash function is saved too, since |hsh_map| needs it to
+   find the keys.  For a table created with |HSH_RANDOM_SEED|, this is the
+   secret that keeps others from choosing keys that collide, so such a
+   file must be kept from anyone who should not learn it.
+
+   The file is written in place.  To replace a file that other processes
+   have mapped, write a new file and |rename| it over the old one. */
+
+void hsh_save(
+	hsh_HashTable table,
+	const char *filename,
+	size_t (*datum_length)(const void *datum, void *arg),
+	void *arg)
+{
+	tableType          t = (tableType)table;
+	frozenType         f;
+	frozenKeyType      keys;
+	frozenKeyType      *order;
+	fileEntryType      entries;
+	struct file_header h;
+	uint64_t           offset;
+	unsigned long      m;
+	unsigned long      i;
+	FILE               *str;
 
 	_hsh_check(t, __func__);
+	if (!(t->flags & HSH_SIZED_KEYS)
+		&& (t->hash != hsh_string_hash_fast
+			|| t->compare != hsh_string_compare))
+		err_internal(__func__, "Only tables of strings can be saved");
 
-	s->size           = t->prime;
-	s->resizings      = t->resizings;
-	s->entries        = 0;
-	s->buckets_used   = 0;
-	s->singletons     = 0;
-	s->maximum_length = 0;
-	s->retrievals     = t->retrievals;
-	s->hits           = t->hits;
-	s->misses         = t->misses;
+	f    = _hsh_frozen_create(t);
+	keys = _hsh_frozen_keys(f, t);
+	if (!(t->flags & HSH_SIZED_KEYS) && !t->seed)
+		for (i = 0; i < t->entries; i++)
+			keys[i].length = strlen((const char *)keys[i].key);
+	m = _hsh_frozen_index(f, keys, t->entries);
 
-	for (i = 0; i < t->prime; i++) {
-		if (t->buckets[i]) {
-			bucketType pt;
-	 
-			++s->buckets_used;
-			for (count = 0, pt = t->buckets[i]; pt; ++count, pt = pt->next);
-			if (count == 1) ++s->singletons;
-			s->maximum_length = max(s->maximum_length, count);
-			s->entries += count;
-		}
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, HSH_FILE_MAGIC, sizeof(h.magic));
+	h.order          = HSH_FILE_ORDER;
+	h.long_size      = sizeof(unsigned long);
+	h.flags          = f->flags;
+	h.width          = f->width;
+	h.seed           = f->seed;
+	h.mix            = f->mix;
+	h.count          = m;
+	h.size           = f->size;
+	h.buckets        = m ? f->buckets : 0;
+	h.front          = f->front;
+	h.overflow_count = f->overflow_count;
+	h.pilots         = HSH_FILE_ALIGN(sizeof(h));
+	h.remap          = HSH_FILE_ALIGN(h.pilots + (m ? f->buckets * f->width : 0));
+	h.entries        = HSH_FILE_ALIGN(h.remap
+									  + (f->size - m) * sizeof(uint32_t));
+	offset           = h.entries + (m + f->overflow_count)
+									   * sizeof(struct file_entry);
+
+	order   = xmalloc((m + f->overflow_count + 1) * sizeof(frozenKeyType));
+	entries = xmalloc((m + f->overflow_count + 1) * sizeof(struct file_entry));
+	for (i = 0; i < m; i++) order[keys[i].position] = &keys[i];
+	for (i = 0; i < f->overflow_count; i++) order[m + i] = &f->overflow[i];
+	for (i = 0; i < m + f->overflow_count; i++)
+		offset = _hsh_file_entry(&entries[i], order[i], offset,
+								 datum_length, arg);
+	h.length = offset;
+
+	if (!(str = fopen(filename, "wb")))
+		err_fatal_errno(__func__, "Cannot open \"%s\" for write", filename);
+	_hsh_file_write(str, &h, sizeof(h), filename);
+	_hsh_file_write(str, NULL, h.pilots - sizeof(h), filename);
+	if (m) {
+		_hsh_file_write(str, f->pilots, f->buckets * f->width, filename);
+		_hsh_file_write(str, NULL, h.remap - h.pilots - f->buckets * f->width,
+						filename);
+		_hsh_file_write(str, f->remap, (f->size - m) * sizeof(uint32_t),
+						filename);
+		_hsh_file_write(str, NULL, h.entries - h.remap
+						- (f->size - m) * sizeof(uint32_t), filename);
 	}
-	if (t->entries != s->entries)
-		err_internal(__func__,
-					 "Incorrect count for entries: %lu vs. %lu",
-					 t->entries,
-					 s->entries);
+	_hsh_file_write(str, entries,
+					(m + f->overflow_count) * sizeof(struct file_entry),
+					filename);
+	for (i = 0; i < m + f->overflow_count; i++)
+		_hsh_file_blobs(str, order[i], &entries[i], filename);
+	if (fclose(str))
+		err_fatal_errno(__func__, "Cannot write to \"%s\"", filename);
 
-	return s;
+	xfree(entries);
+	xfree(order);
+	xfree(keys);
+	if (f->pilots) xfree(f->pilots);
+	if (f->remap) xfree(f->remap);
+	if (f->overflow) xfree(f->overflow);
+	xfree(f);
 }
 
-/* \doc |hsh_print_stats| prints the statistics for |table| on the
-   specified |stream|.  If |stream| is "NULL", then "stdout" will be
-   used. */
+/* Return non-zero if |count| items of |size| bytes at |offset| lie within
+   the |length| bytes of a file, without overflowing. */
 
-void hsh_print_stats(hsh_HashTable table, FILE *stream)
+static int _hsh_file_fits(uint64_t offset, uint64_t count, uint64_t size,
+						  uint64_t length)
 {
-	FILE      *str = stream ? stream : stdout;
-	hsh_Stats s    = hsh_get_stats(table);
+	return offset <= length && (!count || (length - offset) / count >= size);
+}
 
-	_hsh_check(table, __func__);
-   
-	fprintf(str, "Statistics for hash table at %p:\n", table);
-	fprintf(str, "   %lu resizings to %lu total\n", s->resizings, s->size);
-	fprintf(str, "   %lu entries (%lu buckets used, %lu without overflow)\n",
-			s->entries, s->buckets_used, s->singletons);
-	fprintf(str, "   maximum list length is %lu", s->maximum_length);
-	if (s->buckets_used)
-		fprintf(str, " (optimal is %.1f)\n",
-				(double)s->entries / (double)s->buckets_used);
-	else
-		fprintf(str, "\n");
-	fprintf(str, "   %lu retrievals (%lu from top, %lu failed)\n",
-			s->retrievals, s->hits, s->misses);
+/* Return non-zero if the file of |length| bytes at |base|, whose header
+   |h| was already found to be the one of a file of this machine, can be
+   used without reading outside of it. */
 
-	xfree(s);			/* rare */
+static int _hsh_file_valid(const char *base, const struct file_header *h,
+						   uint64_t length)
+{
+	const struct file_entry *e;
+	const uint32_t          *remap;
+	uint64_t                n;
+	uint64_t                i;
+
+	if ((h->width != 1 && h->width != 2 && h->width != 4)
+		|| h->count > h->size
+		|| h->size > ULONG_MAX
+		|| (h->count && h->front >= h->buckets)
+		|| h->pilots % 8 || h->remap % 8 || h->entries % 8
+		|| !_hsh_file_fits(h->pilots, h->buckets, h->width, length)
+		|| !_hsh_file_fits(h->remap, h->size - h->count, sizeof(uint32_t),
+						   length)
+		|| h->overflow_count > UINT64_MAX - h->count
+		|| !_hsh_file_fits(h->entries, h->count + h->overflow_count,
+						   sizeof(struct file_entry), length))
+		return 0;
+
+	remap = (const uint32_t *)(base + h->remap);
+	for (i = 0; i < h->size - h->count; i++)
+		if (remap[i] >= h->count) return 0;
+
+	e = (const struct file_entry *)(base + h->entries);
+	n = h->count + h->overflow_count;
+	for (i = 0; i < n; i++, e++)
+		if (e->key_length >= length
+			|| !_hsh_file_fits(e->key, e->key_length + 1, 1, length)
+			|| (e->datum
+				&& !_hsh_file_fits(e->datum, e->datum_length, 1, length)))
+			return 0;
+	return 1;
 }
 
-unsigned long hsh_string_hash(const void *key)
+/* \doc |hsh_map| maps a file written by |hsh_save| read-only into memory,
+   and returns a table that retrieves from it directly, without reading
+   the whole file first.  If the file cannot be opened or mapped, or was
+   not written by |hsh_save| on a compatible machine, "NULL" is returned
+   with |errno| set, so that the caller can rebuild the table instead.
+   The header, the perfect hash function and the entries are checked,
+   but not the bytes of the keys and data.
+
+   The keys and data returned by the |hsh_mapped_| functions point into
+   the mapping, and remain valid until |hsh_unmap| is called.  Mapped
+   tables may be read from any number of threads at once. */
+
+hsh_MappedTable hsh_map(const char *filename)
 {
-	const char           *pt = (const char *)key;
-	unsigned long        h  = 0;
+	mappedType               p;
+	const struct file_header *h;
+	struct stat              st;
+	void                     *base;
+	int                      fd;
+	int                      error;
 
-	if (!pt)
-		err_internal(__func__, "String-valued keys may not be NULL");
+	if ((fd = open(filename, O_RDONLY)) < 0) return NULL;
+	if (fstat(fd, &st)) {
+		error = errno;
+		close(fd);
+		errno = error;
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(struct file_header)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	base  = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	error = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		errno = error;
+		return NULL;
+	}
 
-	while (*pt) {
-		h += *pt++;
-#if 0
-		h *= 65599L;		/* prime near %$2^{16}$% */
-#else
-		h *= 2654435789U;		/* prime near %$\frac{\sqrt{5}-1}{2}2^{32}$% */
-#endif
+	h = base;
+	if (memcmp(h->magic, HSH_FILE_MAGIC, sizeof(h->magic))
+		|| h->order != HSH_FILE_ORDER
+		|| h->long_size != sizeof(unsigned long)
+		|| h->length != (uint64_t)st.st_size
+		|| !_hsh_file_valid(base, h, h->length)) {
+		munmap(base, st.st_size);
+		errno = EINVAL;
+		return NULL;
 	}
 
-	return h;
+	p = xmalloc(sizeof(struct mapped));
+#if MAA_MAGIC
+	p->magic   = HSH_MAPPED_MAGIC;
+#endif
+	p->base    = base;
+	p->length  = st.st_size;
+	p->entries = (const struct file_entry *)(p->base + h->entries);
+
+	memset(&p->index, 0, sizeof(p->index));
+	p->index.flags   = h->flags;
+	p->index.seed    = h->seed;
+	p->index.mix     = h->mix;
+	p->index.count   = h->count;
+	p->index.size    = h->size;
+	p->index.buckets = h->buckets;
+	p->index.front   = h->front;
+	p->index.width   = h->width;
+	p->index.pilots  = __UNCONST(p->base + h->pilots);
+	p->index.remap   = __UNCONST(p->base + h->remap);
+	p->index.overflow_count = h->overflow_count;
+
+	return p;
 }
 
-unsigned long hsh_pointer_hash(const void *key)
+/* \doc |hsh_unmap| unmaps the file of the mapped |table| and frees the
+   memory associated with it. */
+
+void hsh_unmap(hsh_MappedTable table)
 {
-	const char           *pt;
-	unsigned long        h   = 0;
-	int                  i;
+	mappedType p = (mappedType)table;
 
-#ifdef WORDS_BIGENDIAN
-	pt = ((const char *)&key) + SIZEOF_VOID_P - 1;
-#else
-	pt = (const char *)&key;
+	_hsh_mapped_check(p, __func__);
+	munmap(__UNCONST(p->base), p->length);
+#if MAA_MAGIC
+	p->magic = HSH_MAPPED_MAGIC_FREED;
 #endif
-   
-	for (i = 0; i < SIZEOF_VOID_P; i++) {
-#ifdef WORDS_BIGENDIAN
-		h += *pt--;
+	xfree(p);			/* terminal */
+}
+
+static int _hsh_mapped_equal(mappedType p, const struct file_entry *e,
+							 unsigned long hash, const void *key,
+							 size_t length)
+{
+	return e->hash == hash && e->key_length == length
+		&& !memcmp(p->base + e->key, key, length);
+}
+
+/* \doc |hsh_mapped_retrieve_n| returns the datum saved for the |length|
+   bytes at |key| in the mapped |table|, or "NULL" if there is none.  If
+   |datum_length| is not "NULL", the length of the datum is stored there.
+   Keys of tables without |HSH_SIZED_KEYS| may be retrieved this way as
+   well. */
+
+const void *hsh_mapped_retrieve_n(
+	hsh_MappedTable table,
+	const void *key,
+	size_t length,
+	size_t *datum_length)
+{
+	mappedType              p    = (mappedType)table;
+	unsigned long           hash;
+	const struct file_entry *e   = NULL;
+	const struct file_entry *o;
+	unsigned long           lo;
+	unsigned long           hi;
+
+	_hsh_mapped_check(p, __func__);
+	hash = _hsh_hash_bytes(key, length, p->index.seed);
+
+	if (p->index.count) {
+		e = &p->entries[_hsh_frozen_slot(&p->index, hash)];
+		if (!_hsh_mapped_equal(p, e, hash, key, length)) e = NULL;
+	}
+
+	o = p->entries + p->index.count;
+	for (lo = 0, hi = p->index.overflow_count; !e && lo < hi;) {
+		unsigned long mid = lo + (hi - lo) / 2;
+
+		if (o[mid].hash < hash) lo = mid + 1;
+		else                    hi = mid;
+	}
+	for (; !e && lo < p->index.overflow_count && o[lo].hash == hash; lo++)
+		if (_hsh_mapped_equal(p, &o[lo], hash, key, length)) e = &o[lo];
+
+	if (datum_length) *datum_length = e ? e->datum_length : 0;
+	return e && e->datum ? p->base + e->datum : NULL;
+}
+
+/* \doc |hsh_mapped_retrieve| returns the datum saved for the string |key|
+   in the mapped |table|, or "NULL" if there is none. */
+
+const void *hsh_mapped_retrieve(hsh_MappedTable table, const void *key)
+{
+	return hsh_mapped_retrieve_n(table, key, strlen((const char *)key),
+								 NULL);
+}
+
+/* \doc |hsh_mapped_iterate| calls |iterator| for every entry of the
+   mapped |table|, as |hsh_iterate_arg| does.  The keys are NUL
+   terminated. */
+
+int hsh_mapped_iterate(
+	hsh_MappedTable table,
+	int (*iterator)(const void *key,
+					const void *datum,
+					void *arg),
+	void *arg)
+{
+	mappedType    p = (mappedType)table;
+	unsigned long i;
+
+	_hsh_mapped_check(p, __func__);
+	for (i = 0; i < p->index.count + p->index.overflow_count; i++) {
+		const struct file_entry *e = &p->entries[i];
+
+		if (iterator(p->base + e->key, e->datum ? p->base + e->datum : NULL,
+					 arg))
+			return 1;
+	}
+
+	return 0;
+}
+
+				/* Tables of 64-bit integers, generated by
+				   HSH_DEFINE.  The mixer of hshdef.h
+				   scrambles the whole key on 64-bit hosts,
+				   so the hash only folds it elsewhere. */
+#if SIZEOF_LONG == 8
+#define HSH_INT_HASH(key) ((unsigned long)(key))
 #else
-		h += *pt++;
+#define HSH_INT_HASH(key) ((unsigned long)((key) ^ (key) >> 32))
 #endif
-#if 0
-		h *= 65599L;		/* prime near %$2^{16}$% */
-#else
-		h *= 2654435789U;		/* prime near %$\frac{\sqrt{5}-1}{2}2^{32}$% */
+
+HSH_DEFINE(_hsh_ints, uint64_t, uint64_t, HSH_INT_HASH, HSH_DEF_INTEGER_EQUAL)
+
+typedef struct ints {
+#if MAA_MAGIC
+	int       magic;
 #endif
-	}
+	_hsh_ints *table;
+} *intsType;
 
-	return h & 0xffffffff;
+static void _hsh_int_check(intsType i, const char *function)
+{
+	if (!i) err_internal(function, "table is null");
+#if MAA_MAGIC
+	if (i->magic != HSH_INT_MAGIC)
+		err_internal(function,
+					 "Magic match failed: 0x%08x (should be 0x%08x)",
+					 i->magic,
+					 HSH_INT_MAGIC);
+#endif
 }
 
-int hsh_string_compare(const void *key1, const void *key2)
+/* \doc |hsh_int_create| creates a table mapping 64-bit integer keys to
+   64-bit integer values.  Unlike a table created with |hsh_create| and
+   |hsh_pointer_hash|, the keys and values are stored in a flat array of
+   16-byte slots, each with a tag byte as with |HSH_OPEN_ADDRESSING|, with
+   no memory allocated per entry and no call through a function pointer.
+   The table grows when it would become more than 7/8 full, and shrinks
+   when deletions leave it less than 7/32 full (but never below the size
+   asked for by |hsh_int_reserve|), so an entry takes between about 20 and
+   78 bytes, counting the empty slots. */
+
+hsh_IntTable hsh_int_create(void)
 {
-	if (!key1 || !key2)
-		err_internal(__func__,
-					 "String-valued keys may not be NULL: key1=%p, key2=%p",
-					 key1, key2);
-	return strcmp((const char *)key1, (const char *)key2);
+	intsType i = xmalloc(sizeof(struct ints));
+
+#if MAA_MAGIC
+	i->magic = HSH_INT_MAGIC;
+#endif
+	i->table = _hsh_ints_create();
+	return i;
 }
 
-int hsh_pointer_compare(const void *key1, const void *key2)
+/* \doc |hsh_int_destroy| frees all of the memory associated with the
+   integer |table|. */
+
+void hsh_int_destroy(hsh_IntTable table)
 {
-	intptr_t v1 = (const char *)key1 - (const char *)0;
-	intptr_t v2 = (const char *)key2 - (const char *)0;
+	intsType i = (intsType)table;
 
-	if (v1 < v2)
-		return -1;
-	else if (v1 > v2)
-		return 1;
-	else
-		return 0;
+	_hsh_int_check(i, __func__);
+	_hsh_ints_destroy(i->table);
+#if MAA_MAGIC
+	i->magic = HSH_INT_MAGIC_FREED;
+#endif
+	xfree(i);			/* terminal */
 }
 
-/* \doc |hsh_init_position| returns a position marker for some arbitary
-   first element in the table.  This marker can be used with
-   |hsh_next_position| and |hsh_get_position|. */
+/* \doc |hsh_int_insert|, |hsh_int_replace|, |hsh_int_upsert| and
+   |hsh_int_delete| act like |hsh_insert|, |hsh_replace|, |hsh_upsert|
+   and |hsh_delete| for an integer |table|. */
 
-hsh_Position hsh_init_position(hsh_HashTable table)
+int hsh_int_insert(hsh_IntTable table, uint64_t key, uint64_t value)
 {
-	tableType     t = (tableType)table;
-	unsigned long i;
+	_hsh_int_check(table, __func__);
+	return _hsh_ints_insert(((intsType)table)->table, key, value);
+}
 
-	_hsh_check(t, __func__);
-	for (i = 0; i < t->prime; i++) if (t->buckets[i]) {
-			t->readonly = 1;
-			return t->buckets[i];
-		}
-	return NULL;
+int hsh_int_replace(hsh_IntTable table, uint64_t key, uint64_t value)
+{
+	_hsh_int_check(table, __func__);
+	return _hsh_ints_replace(((intsType)table)->table, key, value);
 }
 
-/* \doc |hsh_next_position| returns a position marker for the next element
-   in the table.  Elements are in arbitrary order based on their positions
-   in the hash table. */
+int hsh_int_upsert(hsh_IntTable table, uint64_t key, uint64_t value)
+{
+	_hsh_int_check(table, __func__);
+	return _hsh_ints_upsert(((intsType)table)->table, key, value);
+}
 
-hsh_Position hsh_next_position(hsh_HashTable table, hsh_Position position)
+int hsh_int_delete(hsh_IntTable table, uint64_t key)
 {
-	tableType     t = (tableType)table;
-	bucketType    b = (bucketType)position;
-	unsigned long i;
-	unsigned long h;
+	_hsh_int_check(table, __func__);
+	return _hsh_ints_delete(((intsType)table)->table, key);
+}
 
-	_hsh_check(t, __func__);
-   
-	if (!b){
-		t->readonly = 0;
-		return NULL;
-	}
-   
-	if (b->next) return b->next;
+/* \doc |hsh_int_retrieve| stores the value of |key| in |*value| (unless
+   |value| is "NULL") and returns zero if |key| is in the integer |table|.
+   Otherwise, 1 is returned. */
 
-	for (h = b->hash % t->prime, i = h + 1; i < t->prime; i++)
-		if (t->buckets[i]) return t->buckets[i];
+int hsh_int_retrieve(hsh_IntTable table, uint64_t key, uint64_t *value)
+{
+	uint64_t *pt;
 
-	t->readonly = 0;
-	return NULL;
+	_hsh_int_check(table, __func__);
+	if (!(pt = _hsh_ints_retrieve(((intsType)table)->table, key)))
+		return 1;
+	if (value) *value = *pt;
+	return 0;
 }
 
-/* \doc |hsh_get_position| returns the datum associated with the |position|
-   marker, or "NULL" if there is no such datum.  |key| is set to the key
-   associated with this datum, or "NULL" is there is no such datum. */
+/* \doc |hsh_int_find_or_insert| returns the address of the value of |key|
+   in the integer |table|, inserting |key| with a value of zero if it is
+   absent, and sets |*inserted| as |hsh_find_or_insert| does.  The
+   address remains valid until the next insertion or deletion. */
 
-void *hsh_get_position(hsh_Position position, void **key)
+uint64_t *hsh_int_find_or_insert(hsh_IntTable table, uint64_t key,
+								 int *inserted)
 {
-	bucketType b = (bucketType)position;
+	_hsh_int_check(table, __func__);
+	return _hsh_ints_find_or_insert(((intsType)table)->table, key, inserted);
+}
 
-	*key = NULL;
-	if (!b) return NULL;
+/* \doc |hsh_int_reserve| acts like |hsh_reserve| for an integer
+   |table|. */
 
-	*key = __UNCONST(b->key);	/* Discard const */
-	return __UNCONST(b->datum);	/* Discard const */
+void hsh_int_reserve(hsh_IntTable table, unsigned long entries)
+{
+	_hsh_int_check(table, __func__);
+	_hsh_ints_reserve(((intsType)table)->table, entries);
 }
 
-/* \doc |hsh_readonly| sets the |readonly| flag for the |table| to |flag|.
-   |flag| should be 0 or 1.  The value of the previous flag is returned.
-   When a hash table is marked as readonly, self-organization of the
-   bucket-overflow lists will not take place, and any attempt to modify the
-   list (e.g., insertion or deletion) will result in an error. */
+/* \doc |hsh_int_count| returns the number of entries in the integer
+   |table|. */
 
-int hsh_readonly(hsh_HashTable table, int flag)
+unsigned long hsh_int_count(hsh_IntTable table)
 {
-	tableType t = (tableType)table;
-	int       current;
+	_hsh_int_check(table, __func__);
+	return _hsh_ints_count(((intsType)table)->table);
+}
 
-	_hsh_check(t, __func__);
+/* \doc |hsh_int_iterate| calls |iterator| for every entry of the integer
+   |table|, passing a pointer through which the value may be changed, and
+   stops (returning 1) as soon as |iterator| returns non-zero.  The table
+   must not be changed otherwise during the iteration. */
 
-	current     = t->readonly;
-	t->readonly = flag;
-	return current;
+int hsh_int_iterate(hsh_IntTable table,
+					int (*iterator)(uint64_t key, uint64_t *value,
+									void *arg),
+					void *arg)
+{
+	_hsh_int_check(table, __func__);
+	return _hsh_ints_iterate(((intsType)table)->table, iterator, arg);
+}
+
+/* \doc |hsh_int_print_stats| prints the size and memory use of the
+   integer |table| on |stream| (or "stdout"). */
+
+void hsh_int_print_stats(hsh_IntTable table, FILE *stream)
+{
+	FILE          *str = stream ? stream : stdout;
+	_hsh_ints     *t;
+	unsigned long bytes;
+
+	_hsh_int_check(table, __func__);
+	t     = ((intsType)table)->table;
+	bytes = t->size * (1 + sizeof(_hsh_ints_slot));
+	fprintf(str, "Statistics for integer hash table at %p:\n", table);
+	fprintf(str, "   %lu entries in %lu slots\n", t->entries, t->size);
+	fprintf(str, "   %lu bytes of slots and tags", bytes);
+	if (t->entries)
+		fprintf(str, " (%.1f per entry)", (double)bytes / t->entries);
+	fprintf(str, "\n");
 }
@@ -0,0 +1,426 @@
+/* hshdef.h -- Type-specialized hash tables generated by macros
+ * Copyright 1994-1997, 1999, 2002 Rickard E. Faith (faith@dict.org)
+ * Copyright 2002-2008 Aleksey Cheusov (vle@gmx.net)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * \section{Type-Specialized Hash Tables}
+ *
+ * \intro The |hsh_| tables store keys and data as pointers to "void" and
+ * call the hash and comparison functions through pointers.  For a table
+ * on a hot path, the header file "hshdef.h" provides the |HSH_DEFINE|
+ * macro instead, which generates a table type and its functions for a
+ * particular key type and value type.  Keys and values are stored in the
+ * slots themselves, without boxing, and the hash and equality functions
+ * are called directly, so that the compiler may inline them.
+ *
+ * The generated tables use the open addressing layout of |hsh_create2|
+ * with |HSH_OPEN_ADDRESSING|: a 7-bit tag taken from each hash value is
+ * kept in a byte array that is searched 16 slots at a time, and the table
+ * is kept no more than 7/8 full.  The hash values are not stored, so keys
+ * are hashed again when the table grows.
+ *
+ */
+
+#ifndef _HSHDEF_H_
+#define _HSHDEF_H_
+
+#include <string.h>
+#include <limits.h>
+#include "maa.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define HSH_DEF_FUNC static __inline__ __attribute__((__unused__))
+#else
+#define HSH_DEF_FUNC static
+#endif
+
+#define HSH_DEF_GROUP     16	/* Slots (and tags) probed at once */
+#define HSH_DEF_EMPTY     0x80	/* Slot was never used */
+#define HSH_DEF_DELETED   0xfe	/* Slot is free, but probing continues */
+#define HSH_DEF_FULL(c)   (!((c) & 0x80))
+
+				/* Hash and equality functions for
+				   integer and string keys */
+#define HSH_DEF_INTEGER_HASH(key)  ((unsigned long)(key))
+#define HSH_DEF_INTEGER_EQUAL(a,b) ((a) == (b))
+#define HSH_DEF_STRING_HASH(key)   hsh_string_hash_fast(key)
+#define HSH_DEF_STRING_EQUAL(a,b)  (!strcmp((a), (b)))
+
+/* Scramble a hash value, whose low bits are often poor, before taking the
+   group number and the tag from it. */
+
+HSH_DEF_FUNC unsigned long _hsh_def_mix(unsigned long h)
+{
+#if ULONG_MAX > 0xffffffffUL
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdUL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53UL;
+	h ^= h >> 33;
+#else
+	h ^= h >> 16;
+	h *= 0x85ebca6bUL;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35UL;
+	h ^= h >> 16;
+#endif
+	return h;
+}
+
+/* Return a bit mask with bit |i| set if |tags[i] == tag|, for the
+   |HSH_DEF_GROUP| tags starting at |tags|. */
+
+HSH_DEF_FUNC unsigned _hsh_def_match(const unsigned char *tags,
+									 unsigned char tag)
+{
+#if defined(__SSE2__)
+	__m128i group = _mm_loadu_si128((const __m128i *)tags);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+	unsigned mask = 0;
+	int      i;
+
+	for (i = 0; i < HSH_DEF_GROUP; i++)
+		if (tags[i] == tag) mask |= 1U << i;
+	return mask;
+#endif
+}
+
+/* Return a bit mask of the free (empty or deleted) slots in a group. */
+
+HSH_DEF_FUNC unsigned _hsh_def_free(const unsigned char *tags)
+{
+#if defined(__SSE2__)
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)tags));
+#else
+	unsigned mask = 0;
+	int      i;
+
+	for (i = 0; i < HSH_DEF_GROUP; i++)
+		if (!HSH_DEF_FULL(tags[i])) mask |= 1U << i;
+	return mask;
+#endif
+}
+
+HSH_DEF_FUNC int _hsh_def_first_bit(unsigned mask)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(mask);
+#else
+	int i;
+
+	for (i = 0; !(mask & 1); i++) mask >>= 1;
+	return i;
+#endif
+}
+
+/* Return the index of a free slot for a new entry with the given |hash|
+   in the |size| |tags|, and mark it as used. */
+
+HSH_DEF_FUNC unsigned long _hsh_def_place(unsigned char *tags,
+										  unsigned long size,
+										  unsigned long *deleted,
+										  unsigned long hash)
+{
+	unsigned long mix  = _hsh_def_mix(hash);
+	unsigned long mask = size / HSH_DEF_GROUP - 1;
+	unsigned long g    = (mix >> 7) & mask;
+	unsigned long step = 0;
+	unsigned      avail;
+	unsigned long i;
+
+	while (!(avail = _hsh_def_free(tags + g * HSH_DEF_GROUP)))
+		g = (g + ++step) & mask;
+
+	i = g * HSH_DEF_GROUP + _hsh_def_first_bit(avail);
+	if (tags[i] == HSH_DEF_DELETED) --*deleted;
+	tags[i] = mix & 0x7f;
+
+	return i;
+}
+
+/* Mark slot |i| of the |tags| as free. */
+
+HSH_DEF_FUNC void _hsh_def_erase(unsigned char *tags, unsigned long i,
+								 unsigned long *deleted)
+{
+	/* If the group still has an empty slot, no probe sequence continues
+	   past it, so the slot can become empty too. */
+	if (_hsh_def_match(tags + i / HSH_DEF_GROUP * HSH_DEF_GROUP,
+					   HSH_DEF_EMPTY)) {
+		tags[i] = HSH_DEF_EMPTY;
+	} else {
+		tags[i] = HSH_DEF_DELETED;
+		++*deleted;
+	}
+}
+
+/* \doc |HSH_DEFINE(name, KeyT, ValT, hashfn, eqfn)| defines a table type
+   |name| mapping keys of type |KeyT| to values of type |ValT|, and the
+   functions listed below, whose names start with |name|.  |hashfn(key)|
+   should return an "unsigned long" hash value for a key, and
+   |eqfn(key1, key2)| should return non-zero if two keys are equal (note
+   that this is the opposite of the |compare| functions of |hsh_create|).
+   Either may be a function or a function-like macro; |HSH_DEF_INTEGER_HASH|
+   and |HSH_DEF_INTEGER_EQUAL| suit integer keys, and
+   |HSH_DEF_STRING_HASH| and |HSH_DEF_STRING_EQUAL| suit null-terminated
+   strings.  All of the functions are "static", so |HSH_DEFINE| may be used
+   in any number of source files.
+
+   |name_create()| returns an empty table, and |name_destroy(table)|
+   frees it.  As with |hsh_destroy|, memory pointed to by the keys and
+   values is not freed.
+
+   |name_insert(table, key, value)|, |name_replace|, |name_upsert| and
+   |name_delete(table, key)| return the same results as |hsh_insert|,
+   |hsh_replace|, |hsh_upsert| and |hsh_delete|.  A table grows when it
+   would become more than 7/8 full, and shrinks when deletions leave it
+   less than 7/32 full.
+
+   |name_retrieve(table, key)| returns the address of the value of |key|,
+   or "NULL" if |key| is absent.
+   |name_find_or_insert(table, key, inserted)| returns the address of the
+   value of |key|, adding it with a value of all zero bytes if it is
+   absent, and sets |*inserted| as |hsh_find_or_insert| does.  These
+   addresses remain valid until the next insertion or deletion.
+
+   |name_reserve(table, entries)| grows the table so that it can hold
+   |entries| entries without growing again, and keeps deletions from
+   shrinking it below that size.  |name_count(table)| returns the number
+   of entries.
+
+   |name_iterate(table, iterator, arg)| calls
+   |iterator(key, value, arg)| for each entry, where |value| points to
+   the value, and stops (returning 1) if |iterator| returns non-zero.  The
+   table must not be changed during the iteration, apart from through
+   |value|. */
+
+#define HSH_DEFINE(name, KeyT, ValT, hashfn, eqfn)                           \
+                                                                             \
+typedef struct name##_slot {                                                 \
+	KeyT key;                                                                \
+	ValT value;                                                              \
+} name##_slot;                                                               \
+                                                                             \
+typedef struct name {                                                        \
+	unsigned long size;		/* Number of slots, a power of two */            \
+	unsigned long entries;                                                   \
+	unsigned long deleted;	/* Number of HSH_DEF_DELETED tags */             \
+	unsigned long min_size;	/* Never shrink below this many slots */         \
+	unsigned char *tags;                                                     \
+	name##_slot   *slots;                                                    \
+} name;                                                                      \
+                                                                             \
+HSH_DEF_FUNC void _##name##_alloc(name *t, unsigned long size)               \
+{                                                                            \
+	t->size    = size;                                                       \
+	t->deleted = 0;                                                          \
+	t->tags    = xmalloc(size);                                              \
+	t->slots   = xmalloc(size * sizeof(name##_slot));                        \
+	memset(t->tags, HSH_DEF_EMPTY, size);                                    \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC name *name##_create(void)                                       \
+{                                                                            \
+	name *t = xmalloc(sizeof(name));                                         \
+                                                                             \
+	t->entries  = 0;                                                         \
+	t->min_size = HSH_DEF_GROUP;                                             \
+	_##name##_alloc(t, HSH_DEF_GROUP);                                       \
+	return t;                                                                \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC void name##_destroy(name *t)                                    \
+{                                                                            \
+	xfree(t->tags);                                                          \
+	xfree(t->slots);                                                         \
+	xfree(t);                                                                \
+}                                                                            \
+                                                                             \
+/* Return the index of the slot holding |key|, or |t->size|. */              \
+                                                                             \
+HSH_DEF_FUNC unsigned long _##name##_find(name *t, KeyT key,                 \
+										  unsigned long hash)                \
+{                                                                            \
+	unsigned long mix  = _hsh_def_mix(hash);                                 \
+	unsigned char tag  = mix & 0x7f;                                         \
+	unsigned long mask = t->size / HSH_DEF_GROUP - 1;                        \
+	unsigned long g    = (mix >> 7) & mask;                                  \
+	unsigned long step;                                                      \
+                                                                             \
+	for (step = 0; step <= mask; g = (g + ++step) & mask) {                  \
+		const unsigned char *tags  = t->tags + g * HSH_DEF_GROUP;            \
+		unsigned            match = _hsh_def_match(tags, tag);               \
+                                                                             \
+		while (match) {                                                      \
+			unsigned long i = g * HSH_DEF_GROUP + _hsh_def_first_bit(match); \
+                                                                             \
+			if (eqfn(t->slots[i].key, key)) return i;                        \
+			match &= match - 1;                                              \
+		}                                                                    \
+		if (_hsh_def_match(tags, HSH_DEF_EMPTY)) break;                      \
+	}                                                                        \
+	return t->size;                                                          \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC void _##name##_resize(name *t, unsigned long size)              \
+{                                                                            \
+	unsigned char *tags  = t->tags;                                          \
+	name##_slot   *slots = t->slots;                                         \
+	unsigned long old    = t->size;                                          \
+	unsigned long i;                                                         \
+                                                                             \
+	_##name##_alloc(t, size);                                                \
+	for (i = 0; i < old; i++)                                                \
+		if (HSH_DEF_FULL(tags[i]))                                           \
+			t->slots[_hsh_def_place(t->tags, t->size, &t->deleted,           \
+									hashfn(slots[i].key))] = slots[i];       \
+	xfree(tags);                                                             \
+	xfree(slots);                                                            \
+}                                                                            \
+                                                                             \
+/* Add |key|, which is known to be absent, and return its slot. */           \
+                                                                             \
+HSH_DEF_FUNC name##_slot *_##name##_add(name *t, KeyT key,                   \
+										unsigned long hash)                  \
+{                                                                            \
+	name##_slot *s;                                                          \
+                                                                             \
+	if ((t->entries + t->deleted + 1) * 8 > t->size * 7)                     \
+		_##name##_resize(t, (t->entries + 1) * 16 > t->size * 7              \
+						 ? t->size * 2 : t->size);                           \
+	s      = t->slots + _hsh_def_place(t->tags, t->size, &t->deleted, hash); \
+	s->key = key;                                                            \
+	++t->entries;                                                            \
+	return s;                                                                \
+}                                                                            \
+                                                                             \
+/* Rebuild a table that has become less than a quarter as full as it may     \
+   get, so that it is about half as full as it may get, as |_hsh_shrink|     \
+   does in hash.c. */                                                        \
+                                                                             \
+HSH_DEF_FUNC void _##name##_shrink(name *t)                                  \
+{                                                                            \
+	unsigned long size;                                                      \
+                                                                             \
+	if (t->size <= t->min_size || t->entries * 32 >= t->size * 7) return;    \
+	for (size = t->size;                                                     \
+		 size > t->min_size && t->entries * 16 <= size / 2 * 7;              \
+		 size >>= 1);                                                        \
+	_##name##_resize(t, size);                                               \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC int name##_insert(name *t, KeyT key, ValT value)                \
+{                                                                            \
+	unsigned long hash = hashfn(key);                                        \
+                                                                             \
+	if (_##name##_find(t, key, hash) != t->size) return 1;                   \
+	_##name##_add(t, key, hash)->value = value;                              \
+	return 0;                                                                \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC int name##_replace(name *t, KeyT key, ValT value)               \
+{                                                                            \
+	unsigned long i = _##name##_find(t, key, hashfn(key));                   \
+                                                                             \
+	if (i == t->size) return 1;                                              \
+	t->slots[i].value = value;                                               \
+	return 0;                                                                \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC int name##_upsert(name *t, KeyT key, ValT value)                \
+{                                                                            \
+	unsigned long hash = hashfn(key);                                        \
+	unsigned long i    = _##name##_find(t, key, hash);                       \
+                                                                             \
+	if (i != t->size) {                                                      \
+		t->slots[i].value = value;                                           \
+		return 1;                                                            \
+	}                                                                        \
+	_##name##_add(t, key, hash)->value = value;                              \
+	return 0;                                                                \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC ValT *name##_find_or_insert(name *t, KeyT key, int *inserted)   \
+{                                                                            \
+	unsigned long hash = hashfn(key);                                        \
+	unsigned long i    = _##name##_find(t, key, hash);                       \
+	name##_slot   *s;                                                        \
+                                                                             \
+	if (inserted) *inserted = i == t->size;                                  \
+	if (i != t->size) return &t->slots[i].value;                             \
+	s = _##name##_add(t, key, hash);                                         \
+	memset(&s->value, 0, sizeof(ValT));                                      \
+	return &s->value;                                                        \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC ValT *name##_retrieve(name *t, KeyT key)                        \
+{                                                                            \
+	unsigned long i = _##name##_find(t, key, hashfn(key));                   \
+                                                                             \
+	return i == t->size ? NULL : &t->slots[i].value;                         \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC int name##_delete(name *t, KeyT key)                            \
+{                                                                            \
+	unsigned long i = _##name##_find(t, key, hashfn(key));                   \
+                                                                             \
+	if (i == t->size) return 1;                                              \
+	_hsh_def_erase(t->tags, i, &t->deleted);                                 \
+	--t->entries;                                                            \
+	_##name##_shrink(t);                                                     \
+	return 0;                                                                \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC void name##_reserve(name *t, unsigned long entries)             \
+{                                                                            \
+	unsigned long size;                                                      \
+                                                                             \
+	for (size = HSH_DEF_GROUP; entries * 8 > size * 7; size <<= 1);          \
+	if (size > t->min_size) t->min_size = size;                              \
+	if (size > t->size) _##name##_resize(t, size);                           \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC unsigned long name##_count(name *t)                             \
+{                                                                            \
+	return t->entries;                                                       \
+}                                                                            \
+                                                                             \
+HSH_DEF_FUNC int name##_iterate(name *t,                                     \
+								int (*hsh_iterator)(KeyT key, ValT *value,   \
+													void *arg),              \
+								void *arg)                                   \
+{                                                                            \
+	unsigned long i;                                                         \
+                                                                             \
+	for (i = 0; i < t->size; i++)                                            \
+		if (HSH_DEF_FULL(t->tags[i])                                         \
+			&& hsh_iterator(t->slots[i].key, &t->slots[i].value, arg))       \
+			return 1;                                                        \
+	return 0;                                                                \
+}
+
+#endif
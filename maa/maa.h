@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #ifndef __GNUC__
 #define __attribute__(x)
@@ -46,6 +47,16 @@
 #if MAA_MAGIC
 #define HSH_MAGIC               0x01020304
 #define HSH_MAGIC_FREED         0x10203040
+#define HSH_SHARDED_MAGIC       0x01030507
+#define HSH_SHARDED_MAGIC_FREED 0x10305070
+#define HSH_FROZEN_MAGIC        0x01050709
+#define HSH_FROZEN_MAGIC_FREED  0x10507090
+#define HSH_SNAPSHOT_MAGIC      0x01070b0f
+#define HSH_SNAPSHOT_MAGIC_FREED 0x1070b0f0
+#define HSH_MAPPED_MAGIC        0x0105090d
+#define HSH_MAPPED_MAGIC_FREED  0x105090d0
+#define HSH_INT_MAGIC           0x01060a0e
+#define HSH_INT_MAGIC_FREED     0x1060a0e0
 #define SET_MAGIC               0x02030405
 #define SET_MAGIC_FREED         0x20304050
 #define LST_MAGIC               0x03040506
@@ -107,6 +118,23 @@ extern unsigned long prm_next_prime(unsigned int start);
 
 typedef void *hsh_HashTable;
 typedef void *hsh_Position;
+typedef void *hsh_ShardedTable;
+typedef void *hsh_FrozenTable;
+typedef void *hsh_Snapshot;
+typedef void *hsh_MappedTable;
+typedef void *hsh_IntTable;
+
+#define HSH_OPEN_ADDRESSING    0x0001 /* Flat slot arrays, SIMD tag probing */
+#define HSH_INCREMENTAL_RESIZE 0x0002 /* Spread resizing over insertions */
+#define HSH_POWER_OF_TWO       0x0004 /* No division to find a list */
+#define HSH_CONCURRENT         0x0008 /* Lock-free lookups from any thread */
+#define HSH_SIZED_KEYS         0x0010 /* Byte strings with explicit lengths */
+#define HSH_PROFILE            0x0020 /* Keep the counters of hsh_Profile */
+#define HSH_ORDERED            0x0040 /* Open addressing, insertion order */
+#define HSH_HUGE_PAGES         0x0080 /* Memory from mem_alloc_pages */
+#define HSH_SMALL              0x0100 /* Inline entries until there are 9 */
+#define HSH_RANDOM_SEED        0x0200 /* Default hash with a secret seed */
+#define HSH_SORTED_LISTS       0x0400 /* Binary search of long lists */
 
 typedef struct hsh_Stats {
 	unsigned long size;		 /* Size of table */
@@ -119,15 +147,77 @@ typedef struct hsh_Stats {
 	unsigned long retrievals;	 /* Total number of retrievals */
 	unsigned long hits;		 /* Number of retrievals from top of a list */
 	unsigned long misses;	 /* Number of unsuccessful retrievals */
+
+	unsigned long mapped;	 /* Bytes mapped for HSH_HUGE_PAGES */
+	unsigned long pages;		 /* 4kB pages (TLB entries) spanned by them */
+	unsigned long huge_pages;	 /* 2MB pages spanned by them */
+
+	unsigned long long_chains;	 /* Lookups that walked unexpectedly far */
+	unsigned long sorted_lists;	 /* Lists sorted for HSH_SORTED_LISTS */
 } *hsh_Stats;
 
+#define HSH_PROFILE_WALKS 16
+
+typedef struct hsh_Profile {
+	unsigned long lookups;	 /* Lookups by any operation */
+	unsigned long compares;	 /* Keys compared */
+	unsigned long walks[HSH_PROFILE_WALKS]; /* Lookups by entries examined */
+	unsigned long resizes;	 /* Number of resizings */
+	double        resize_seconds; /* Time spent resizing */
+	unsigned long bytes;	 /* Memory used, apart from keys and data */
+} hsh_Profile;
+
+typedef struct hsh_Options {
+	unsigned long (*hash)(const void *);
+	int           (*compare)(const void *, const void *);
+	int           flags;
+	unsigned long entries;	 /* Expected number of entries */
+	double        max_load;	 /* Entries per list before growing */
+	double        growth;	 /* Factor by which the table grows */
+	unsigned long seed;		 /* Seed for the default hash */
+	void          *(*allocate)(size_t size, void *arg);
+	void          (*deallocate)(void *pt, void *arg);
+	void          *allocator_arg;
+	int           threads;	 /* Threads rebuilding a large table */
+} hsh_Options;
+
 extern hsh_HashTable hsh_create(unsigned long (*hash)(const void *),
 								int (*compare)(const void *, const void *));
+extern hsh_HashTable hsh_create2(unsigned long (*hash)(const void *),
+								 int (*compare)(const void *, const void *),
+								 int flags);
+extern hsh_HashTable hsh_create_ex(const hsh_Options *options);
 extern void          hsh_destroy(hsh_HashTable table);
+extern void          hsh_reserve(hsh_HashTable table, unsigned long entries);
+extern void          hsh_compact(hsh_HashTable table);
+extern unsigned long hsh_bulk_load(hsh_HashTable table, const void **keys,
+								   const void **data, size_t n,
+								   int nthreads);
 extern int           hsh_insert(hsh_HashTable table,
 								const void *key, const void *datum );
 extern int           hsh_delete(hsh_HashTable table, const void *key);
 extern const void    *hsh_retrieve(hsh_HashTable table, const void *key);
+extern int           hsh_insert_n(hsh_HashTable table,
+								  const void *key, size_t length,
+								  const void *datum);
+extern int           hsh_delete_n(hsh_HashTable table,
+								  const void *key, size_t length);
+extern const void    *hsh_retrieve_n(hsh_HashTable table,
+									 const void *key, size_t length);
+extern int           hsh_replace(hsh_HashTable table,
+								 const void *key, const void *datum);
+extern int           hsh_upsert(hsh_HashTable table,
+								const void *key, const void *datum);
+extern const void    **hsh_find_or_insert(hsh_HashTable table,
+										  const void *key, int *inserted);
+extern const void    **hsh_find_or_insert_n(hsh_HashTable table,
+											const void *key, size_t length,
+											int *inserted);
+extern void          hsh_set_key(hsh_HashTable table, const void **slot,
+								 const void *key);
+extern void          hsh_retrieve_batch(hsh_HashTable table,
+										const void **keys, size_t n,
+										const void **out);
 extern int           hsh_iterate(hsh_HashTable table,
 								 int (*iterator)(const void *key,
 												 const void *datum));
@@ -138,8 +228,13 @@ extern int           hsh_iterate_arg(
 	void *arg);
 extern hsh_Stats     hsh_get_stats(hsh_HashTable table);
 extern void          hsh_print_stats(hsh_HashTable table, FILE *stream);
+extern int           hsh_get_profile(hsh_HashTable table,
+									 hsh_Profile *profile);
+extern void          hsh_print_profile(hsh_HashTable table, FILE *stream);
 extern unsigned long hsh_string_hash(const void *key);
 extern unsigned long hsh_pointer_hash(const void *key);
+extern unsigned long hsh_string_hash_fast(const void *key);
+extern unsigned long hsh_pointer_hash_fast(const void *key);
 extern int           hsh_string_compare(const void *key1, const void *key2);
 extern int           hsh_pointer_compare(const void *key1, const void *key2);
 extern void          hsh_key_strings(hsh_HashTable);
@@ -148,7 +243,17 @@ extern hsh_Position  hsh_init_position(hsh_HashTable table);
 extern hsh_Position  hsh_next_position(hsh_HashTable table,
 									   hsh_Position position);
 extern void          *hsh_get_position(hsh_Position position, void **key);
+extern size_t        hsh_get_position_length(hsh_HashTable table,
+											 hsh_Position position);
 extern int           hsh_readonly(hsh_HashTable table, int flag);
+extern int           hsh_shared(hsh_HashTable table, int flag);
+extern hsh_Snapshot  hsh_snapshot(hsh_HashTable table);
+extern int           hsh_snapshot_iterate(
+	hsh_Snapshot snapshot,
+	int (*iterator)(const void *key,
+					const void *datum, void *arg),
+	void *arg);
+extern void          hsh_snapshot_destroy(hsh_Snapshot snapshot);
 
 #define HSH_POSITION_INIT(P,T)  ((P)=hsh_init_position(T))
 #define HSH_POSITION_NEXT(P,T)  ((P)=hsh_next_position(T,P))
@@ -173,6 +278,80 @@ extern int           hsh_readonly(hsh_HashTable table, int flag);
    after complete loops does no harm. */
 #define HSH_ITERATE_END(T) hsh_readonly(T,0)
 
+extern hsh_ShardedTable hsh_sharded_create(
+	unsigned long (*hash)(const void *),
+	int (*compare)(const void *, const void *),
+	int shards,
+	int flags);
+extern void          hsh_sharded_destroy(hsh_ShardedTable table);
+extern int           hsh_sharded_insert(hsh_ShardedTable table,
+										const void *key, const void *datum);
+extern int           hsh_sharded_delete(hsh_ShardedTable table,
+										const void *key);
+extern const void    *hsh_sharded_retrieve(hsh_ShardedTable table,
+										   const void *key);
+extern int           hsh_sharded_iterate(
+	hsh_ShardedTable table,
+	int (*iterator)(const void *key,
+					const void *datum, void *arg),
+	void *arg);
+extern hsh_Stats     hsh_sharded_get_stats(hsh_ShardedTable table);
+extern void          hsh_sharded_print_stats(hsh_ShardedTable table,
+											 FILE *stream);
+
+extern hsh_FrozenTable hsh_freeze(hsh_HashTable table);
+extern void          hsh_frozen_destroy(hsh_FrozenTable table);
+extern const void    *hsh_frozen_retrieve(hsh_FrozenTable table,
+										  const void *key);
+extern const void    *hsh_frozen_retrieve_n(hsh_FrozenTable table,
+											const void *key, size_t length);
+extern int           hsh_frozen_iterate(
+	hsh_FrozenTable table,
+	int (*iterator)(const void *key,
+					const void *datum, void *arg),
+	void *arg);
+extern void          hsh_frozen_print_stats(hsh_FrozenTable table,
+											FILE *stream);
+
+extern void          hsh_save(hsh_HashTable table, const char *filename,
+							  size_t (*datum_length)(const void *datum,
+													 void *arg),
+							  void *arg);
+extern hsh_MappedTable hsh_map(const char *filename);
+extern void          hsh_unmap(hsh_MappedTable table);
+extern const void    *hsh_mapped_retrieve(hsh_MappedTable table,
+										  const void *key);
+extern const void    *hsh_mapped_retrieve_n(hsh_MappedTable table,
+											const void *key, size_t length,
+											size_t *datum_length);
+extern int           hsh_mapped_iterate(
+	hsh_MappedTable table,
+	int (*iterator)(const void *key,
+					const void *datum, void *arg),
+	void *arg);
+
+extern hsh_IntTable  hsh_int_create(void);
+extern void          hsh_int_destroy(hsh_IntTable table);
+extern int           hsh_int_insert(hsh_IntTable table, uint64_t key,
+									uint64_t value);
+extern int           hsh_int_replace(hsh_IntTable table, uint64_t key,
+									 uint64_t value);
+extern int           hsh_int_upsert(hsh_IntTable table, uint64_t key,
+									uint64_t value);
+extern int           hsh_int_delete(hsh_IntTable table, uint64_t key);
+extern int           hsh_int_retrieve(hsh_IntTable table, uint64_t key,
+									  uint64_t *value);
+extern uint64_t      *hsh_int_find_or_insert(hsh_IntTable table,
+											 uint64_t key, int *inserted);
+extern void          hsh_int_reserve(hsh_IntTable table,
+									 unsigned long entries);
+extern unsigned long hsh_int_count(hsh_IntTable table);
+extern int           hsh_int_iterate(
+	hsh_IntTable table,
+	int (*iterator)(uint64_t key, uint64_t *value, void *arg),
+	void *arg);
+extern void          hsh_int_print_stats(hsh_IntTable table, FILE *stream);
+
    
 /* set.c */
 
@@ -190,6 +369,13 @@ typedef struct set_Stats{
 	unsigned long retrievals;	 /* Total number of retrievals */
 	unsigned long hits;		 /* Number of retrievals from top of a list */
 	unsigned long misses;	 /* Number of unsuccessful retrievals */
+
+	unsigned long mapped;	 /* Bytes mapped for HSH_HUGE_PAGES */
+	unsigned long pages;		 /* 4kB pages (TLB entries) spanned by them */
+	unsigned long huge_pages;	 /* 2MB pages spanned by them */
+
+	unsigned long long_chains;	 /* Lookups that walked unexpectedly far */
+	unsigned long sorted_lists;	 /* Lists sorted for HSH_SORTED_LISTS */
 } *set_Stats;
 
 typedef unsigned long (*set_HashFunction)(const void *);
@@ -197,12 +383,19 @@ typedef int           (*set_CompareFunction)(const void *, const void *);
 
 extern set_Set             set_create(set_HashFunction hash,
 									  set_CompareFunction compare);
+extern set_Set             set_create2(set_HashFunction hash,
+									   set_CompareFunction compare,
+									   int flags);
 extern set_HashFunction    set_get_hash(set_Set set);
 extern set_CompareFunction set_get_compare(set_Set set);
 extern void                set_destroy(set_Set set);
+extern void                set_reserve(set_Set set, unsigned long entries);
+extern void                set_compact(set_Set set);
 extern int                 set_insert(set_Set set, const void *elem);
 extern int                 set_delete(set_Set set, const void *elem);
 extern int                 set_member(set_Set set, const void *elem);
+extern void                set_member_batch(set_Set set, const void **elems,
+											size_t n, int *out);
 extern int                 set_iterate(set_Set set,
 									   int (*iterator)(const void *key));
 extern int                 set_iterate_arg(set_Set set,
@@ -352,6 +545,12 @@ extern mem_StringStats mem_get_string_stats(mem_String info);
 extern void            mem_print_string_stats(mem_String info, FILE *stream);
 
 extern mem_Object      mem_create_objects(int size);
+extern mem_Object      mem_create_objects2(int size,
+										   void *(*allocate)(size_t size,
+															 void *arg),
+										   void (*deallocate)(void *pt,
+															  void *arg),
+										   void *arg);
 extern void            mem_destroy_objects(mem_Object info);
 extern void            *mem_get_object(mem_Object info);
 extern void            *mem_get_empty_object(mem_Object info);
@@ -359,6 +558,9 @@ extern void            mem_free_object(mem_Object info, void *obj);
 extern mem_ObjectStats mem_get_object_stats(mem_Object info);
 extern void            mem_print_object_stats(mem_Object info, FILE *stream);
 
+extern void            *mem_alloc_pages(size_t size, void *arg);
+extern void            mem_free_pages(void *pt, void *arg);
+
 /* string.c */
 
 typedef void *str_Pool;
@@ -370,12 +572,15 @@ typedef struct str_Stats {
 	int retrievals;		/* Total number of retrievals */
 	int hits;			/* Number of retrievals from top of a list */
 	int misses;			/* Number of unsuccessful retrievals */
+	int long_chains;		/* Lookups that walked unexpectedly far */
 } *str_Stats;
 
 extern str_Pool   str_pool_create(void);
+extern str_Pool   str_pool_create2(int flags);
 extern void       str_pool_destroy(str_Pool pool);
 extern int        str_pool_exists(str_Pool pool, const char *s);
 extern const char *str_pool_find(str_Pool pool, const char *s);
+extern const char *str_pool_findn(str_Pool pool, const char *s, int length);
 extern const char *str_pool_copy(str_Pool pool, const char *s);
 extern const char *str_pool_copyn(str_Pool pool, const char *s, int length);
 extern void       str_pool_grow(str_Pool pool, const char *s, int length);
@@ -60,6 +60,71 @@
 #define max(a,b) ((a)>(b)?(a):(b))
 #endif
 
+				/* List number for a |hash| value in hash
+				   tables and sets of |size| lists.  A
+				   non-zero |shift| means that |size| is a
+				   power of two, and multiplicative
+				   (Fibonacci) hashing is used instead of
+				   a division. */
+#if SIZEOF_LONG == 8
+#define HSH_GOLDEN 0x9e3779b97f4a7c15UL
+#else
+#define HSH_GOLDEN 0x9e3779b9UL
+#endif
+#define HSH_INDEX(hash,size,shift) \
+	((shift) ? ((hash) * HSH_GOLDEN) >> (shift) : (hash) % (size))
+
+				/* Start loading the cache line at |p|
+				   for reading, without waiting for it */
+#if defined(__GNUC__)
+#define HSH_PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#else
+#define HSH_PREFETCH(p) ((void)(p))
+#endif
+
+				/* Lookups kept in flight by the batch
+				   functions */
+#define HSH_BATCH 16
+
+				/* Small and huge pages, as assumed by
+				   mem_alloc_pages and the statistics of
+				   the tables that use it */
+#define MEM_PAGE      4096UL
+#define MEM_HUGE_PAGE (2UL * 1024 * 1024)
+#define MEM_PAGES(bytes,page) (((bytes) + (page) - 1) / (page))
+
 #include "maa.h"
 
+				/* hash.c and set.c: the |shift| of
+				   HSH_INDEX for a power-of-two |size| */
+static __inline__ int _hsh_shift(unsigned long size)
+{
+	int shift = sizeof(unsigned long) * CHAR_BIT;
+
+	while (size > 1) {
+		size >>= 1;
+		--shift;
+	}
+	return shift;
+}
+
+				/* The number of lists to use for a table
+				   or set created with |flags| that should
+				   have at least |size| lists */
+static __inline__ unsigned long _hsh_next_size(int flags,
+											   unsigned long size)
+{
+	unsigned long next = 2;
+
+	if (!(flags & HSH_POWER_OF_TWO)) return prm_next_prime(size);
+
+	while (next < size) next <<= 1;
+	return next;
+}
+
+				/* hash.c */
+extern unsigned long _hsh_hash_bytes(const void *data, size_t len,
+									 unsigned long seed);
+extern unsigned long _hsh_random_seed(void);
+
 #endif
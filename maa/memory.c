@@ -29,9 +29,15 @@
  * other parts of the \khepera library (e.g., string pools and abstract
  * syntax trees).
  *
+ * Objects of a fixed size are carved out of slabs that hold many objects
+ * each, so that the allocator overhead is paid once per slab rather than
+ * once per object.
+ *
  */
 
 #include "maaP.h"
+#include <sys/mman.h>
+#include <pthread.h>
 
 typedef struct stringInfo {
 #if MAA_MAGIC
@@ -43,6 +49,25 @@ typedef struct stringInfo {
 	stk_Stack      allocated;
 } *stringInfo;
 
+#define MEM_SLAB_FIRST 8	/* Objects in the first slab */
+#define MEM_SLAB_MAX   65536	/* Maximum bytes in a slab, unless an
+				   object is larger */
+
+#define MEM_PAGES_MIN   (64UL * 1024) /* Smaller requests use xmalloc */
+#define MEM_PAGES_CACHE 8	/* Freed mappings kept for reuse */
+#define MEM_PAGE_HEADER 16	/* Bytes before the memory returned */
+
+				/* Slabs from |mem_alloc_pages| fill a
+				   huge page each */
+#define MEM_PAGES_SLAB (MEM_HUGE_PAGE - MEM_PAGE_HEADER)
+
+				/* At the start of each block returned by
+				   |mem_alloc_pages| */
+typedef struct page_header {
+	size_t length;		/* Of the mapping, or zero from xmalloc */
+	size_t hugetlb;		/* Mapped with MAP_HUGETLB */
+} *pageHeader;
+
 typedef struct objectInfo {
 #if MAA_MAGIC
 	int            magic;
@@ -51,8 +76,17 @@ typedef struct objectInfo {
 	int            used;
 	int            reused;
 	int            size;
-	stk_Stack      stack;	/* for free list */
-	stk_Stack      allocated;
+	int            stride;	/* size rounded up for alignment */
+	void           **free;	/* free list */
+	int            free_count;
+	int            free_max;
+	char           *slab;	/* unused part of the newest slab */
+	int            slab_left;	/* objects left in the newest slab */
+	int            slab_objects;	/* objects in the newest slab */
+	stk_Stack      allocated;	/* slabs */
+	void           *(*allocate)(size_t size, void *arg);
+	void           (*deallocate)(void *pt, void *arg);
+	void           *arg;
 } *objectInfo;
 
 
@@ -151,7 +185,8 @@ const char *mem_strncpy(mem_String info,
 	i->growing_size = 0;
 
 	str = xmalloc(len + 1);
-	memcpy(str, string, len + 1);
+	memcpy(str, string, len);
+	str[len] = '\0';
 	stk_push(i->allocated, str);
 
 	return str;
@@ -256,7 +291,22 @@ static void _mem_magic_objects(objectInfo i, const char *function)
 
 mem_Object mem_create_objects(int size)
 {
-	objectInfo info = xmalloc(sizeof (struct objectInfo));
+	return mem_create_objects2(size, NULL, NULL, NULL);
+}
+
+/* \doc |mem_create_objects2| acts like |mem_create_objects|, but the
+   slabs holding the objects are obtained from |allocate(size, arg)| and
+   returned with |deallocate(pointer, arg)|.  If |allocate| is "NULL", the
+   slabs come from |xmalloc|. */
+
+mem_Object mem_create_objects2(
+	int size,
+	void *(*allocate)(size_t size, void *arg),
+	void (*deallocate)(void *pt, void *arg),
+	void *arg)
+{
+	objectInfo info  = xmalloc(sizeof (struct objectInfo));
+	int        align = sizeof(union { long l; double d; void *p; });
 
 #if MAA_MAGIC
 	info->magic   = MEM_OBJECTS_MAGIC;
@@ -265,8 +315,17 @@ mem_Object mem_create_objects(int size)
 	info->used    = 0;
 	info->reused  = 0;
 	info->size    = size;
-	info->stack     = stk_create();
-	info->allocated = stk_create();
+	info->stride  = size > 0 ? (size + align - 1) / align * align : align;
+	info->free         = NULL;
+	info->free_count   = 0;
+	info->free_max     = 0;
+	info->slab         = NULL;
+	info->slab_left    = 0;
+	info->slab_objects = 0;
+	info->allocated    = stk_create();
+	info->allocate     = allocate;
+	info->deallocate   = deallocate;
+	info->arg          = arg;
 
 	return info;
 }
@@ -286,11 +345,12 @@ void mem_destroy_objects(mem_Object info)
 #endif
 
 	while (!stk_isempty(i->allocated)){
-		xfree(stk_pop(i->allocated));
+		if (i->deallocate) i->deallocate(stk_pop(i->allocated), i->arg);
+		else               xfree(stk_pop(i->allocated));
 	}
 
 	stk_destroy(i->allocated);
-	stk_destroy(i->stack);
+	if (i->free) xfree(i->free);
 	xfree(i);			/* terminal */
 }
 
@@ -298,21 +358,44 @@ void mem_destroy_objects(mem_Object info)
    |size| bytes long (as specified in the call to |mem_create_objects|).
    This block is either newly allocated memory, or is memory which was
    previously allocated by |mem_get_object| and subsequently freed by
-   |mem_free_object|. */
+   |mem_free_object|.
+
+   New memory is taken from slabs which hold many objects each.  Each slab
+   is twice as large as the previous one, up to 64kB, or up to a huge page
+   when the slabs come from |mem_alloc_pages|. */
 
 void *mem_get_object(mem_Object info)
 {
 	objectInfo  i   = (objectInfo)info;
-	void       *obj = stk_pop(i->stack);
+	void       *obj;
 
 	_mem_magic_objects(i, __func__);
 
-	if (!obj) {
-		obj = xmalloc(i->size);
-		stk_push(i->allocated, obj);
-		++i->total;
-	} else {
+	if (i->free_count) {
+		obj = i->free[--i->free_count];
 		++i->reused;
+	} else {
+		if (!i->slab_left) {
+			int count = i->slab_objects ? 2 * i->slab_objects : MEM_SLAB_FIRST;
+			int limit = i->allocate == mem_alloc_pages
+				? MEM_PAGES_SLAB : MEM_SLAB_MAX;
+
+			if (count * i->stride > limit)
+				count = max(limit / i->stride, 1);
+
+			if (!i->allocate)
+				i->slab = xmalloc(count * i->stride);
+			else if (!(i->slab = i->allocate(count * i->stride, i->arg)))
+				err_fatal(__func__, "Out of memory for %d objects", count);
+			i->slab_left    = count;
+			i->slab_objects = count;
+			stk_push(i->allocated, i->slab);
+		}
+
+		obj = i->slab;
+		i->slab += i->stride;
+		--i->slab_left;
+		++i->total;
 	}
 
 	++i->used;
@@ -336,7 +419,8 @@ void *mem_get_empty_object(mem_Object info)
 /* \doc |mem_free_object| ``frees'' the object, |obj|, which was previously
    obtained from |mem_get_object|.  The memory associated with the object
    is not actually freed, but the object pointer is stored on a stack, and
-   is available for subsequent calls to |mem_get_object|. */
+   is available for subsequent calls to |mem_get_object|.  The contents of
+   the object are left intact. */
 
 void mem_free_object(mem_Object info, void *obj)
 {
@@ -344,7 +428,11 @@ void mem_free_object(mem_Object info, void *obj)
 
 	_mem_magic_objects(i, __func__);
 
-	stk_push(i->stack, obj);
+	if (i->free_count == i->free_max) {
+		i->free_max = i->free_max ? 2 * i->free_max : MEM_SLAB_FIRST;
+		i->free     = xrealloc(i->free, i->free_max * sizeof(void *));
+	}
+	i->free[i->free_count++] = obj;
 	--i->used;
 }
 
@@ -393,3 +481,136 @@ void mem_print_object_stats(mem_Object info, FILE *stream)
 
 	xfree(s);			/* rare */
 }
+
+/* Large blocks are mapped from the kernel directly, so that they can be
+   backed by huge pages: a random access to a table of tens of gigabytes
+   then needs one TLB entry for every 2MB instead of every 4kB.  Freed
+   mappings are handed back with MADV_FREE, which lets the kernel reclaim
+   their pages when it needs them, and a few are kept for reuse. */
+
+static pthread_mutex_t _mem_pages_lock = PTHREAD_MUTEX_INITIALIZER;
+static pageHeader      _mem_pages_cache[MEM_PAGES_CACHE];
+static int             _mem_pages_cached;
+static int             _mem_hugetlb_failed;
+
+/* Return a mapping of |length| bytes, aligned to a huge page when it is
+   at least that large.  Explicit huge pages are used if the system has
+   reserved some, and transparent huge pages are requested otherwise. */
+
+static pageHeader _mem_map(size_t length)
+{
+	char   *base;
+	size_t lead;
+
+#ifdef MAP_HUGETLB
+	if (length % MEM_HUGE_PAGE == 0 && !_mem_hugetlb_failed) {
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base != MAP_FAILED) {
+			((pageHeader)base)->hugetlb = 1;
+			return (pageHeader)base;
+		}
+		_mem_hugetlb_failed = 1;	/* None reserved: don't retry */
+	}
+#endif
+
+	if (length < MEM_HUGE_PAGE) {
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) return NULL;
+	} else {
+		/* Map a huge page more, and trim both ends to align */
+		base = mmap(NULL, length + MEM_HUGE_PAGE, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) return NULL;
+		lead = (MEM_HUGE_PAGE - (uintptr_t)base % MEM_HUGE_PAGE)
+			% MEM_HUGE_PAGE;
+		if (lead) munmap(base, lead);
+		munmap(base + lead + length, MEM_HUGE_PAGE - lead);
+		base += lead;
+#ifdef MADV_HUGEPAGE
+		madvise(base, length, MADV_HUGEPAGE);
+#endif
+	}
+	((pageHeader)base)->hugetlb = 0;
+	return (pageHeader)base;
+}
+
+/* \doc |mem_alloc_pages| returns |size| bytes of memory, like |xmalloc|,
+   but blocks of 64kB or more are mapped from the kernel directly, and
+   those of 2MB or more are aligned to, and backed by, huge pages when the
+   system provides them.  The memory is not cleared.  If |arg| is not
+   "NULL", it points to an "unsigned long" to which the bytes mapped are
+   added, and from which |mem_free_pages| subtracts them again.
+
+   |mem_alloc_pages| and |mem_free_pages| can be given to
+   |mem_create_objects2| and |hsh_create_ex|; the slabs of a |mem_Object|
+   then grow to a huge page each.  |HSH_HUGE_PAGES| tables and sets use
+   them for all of their memory. */
+
+void *mem_alloc_pages(size_t size, void *arg)
+{
+	size_t     length = size + MEM_PAGE_HEADER;
+	pageHeader h      = NULL;
+	int        i;
+
+	if (length < MEM_PAGES_MIN) {
+		h         = xmalloc(length);
+		h->length = 0;
+		return (char *)h + MEM_PAGE_HEADER;
+	}
+
+	if (length >= MEM_HUGE_PAGE)
+		length = MEM_PAGES(length, MEM_HUGE_PAGE) * MEM_HUGE_PAGE;
+	else
+		length = MEM_PAGES(length, MEM_PAGE) * MEM_PAGE;
+
+	pthread_mutex_lock(&_mem_pages_lock);
+	for (i = 0; i < _mem_pages_cached; i++) {
+		pageHeader c = _mem_pages_cache[i];
+
+		if (c->length >= length && c->length / 2 <= length) {
+			h = c;
+			_mem_pages_cache[i] = _mem_pages_cache[--_mem_pages_cached];
+			break;
+		}
+	}
+	if (!h && (h = _mem_map(length))) h->length = length;
+	if (h && arg) *(unsigned long *)arg += h->length;
+	pthread_mutex_unlock(&_mem_pages_lock);
+
+	if (!h)
+		err_fatal_errno(__func__, "Cannot map %lu bytes",
+						(unsigned long)length);
+	return (char *)h + MEM_PAGE_HEADER;
+}
+
+/* \doc |mem_free_pages| frees memory returned by |mem_alloc_pages|.  The
+   pages of a freed mapping are given back to the kernel with MADV_FREE,
+   and a few such mappings are kept for later calls to |mem_alloc_pages|;
+   the others are unmapped. */
+
+void mem_free_pages(void *pt, void *arg)
+{
+	pageHeader h = (pageHeader)((char *)pt - MEM_PAGE_HEADER);
+
+	if (!h->length) {
+		xfree(h);
+		return;
+	}
+
+	pthread_mutex_lock(&_mem_pages_lock);
+	if (arg) *(unsigned long *)arg -= h->length;
+	if (h->hugetlb || _mem_pages_cached == MEM_PAGES_CACHE) {
+		munmap(h, h->length);
+	} else {
+		/* The header stays in the page that MADV_FREE leaves alone */
+#ifdef MADV_FREE
+		madvise((char *)h + MEM_PAGE, h->length - MEM_PAGE, MADV_FREE);
+#else
+		madvise((char *)h + MEM_PAGE, h->length - MEM_PAGE, MADV_DONTNEED);
+#endif
+		_mem_pages_cache[_mem_pages_cached++] = h;
+	}
+	pthread_mutex_unlock(&_mem_pages_lock);
+}
@@ -45,6 +45,14 @@ typedef struct bucket {
 	struct bucket *next;
 } *bucketType;
 
+				/* The index of a long list of an
+				   HSH_SORTED_LISTS set, as in hash.c */
+typedef struct sorted {
+	unsigned long count;
+	unsigned long room;
+	bucketType    nodes[1];
+} *sortedType;
+
 typedef struct set {
 #if MAA_MAGIC
 	int           magic;
@@ -58,9 +66,33 @@ typedef struct set {
 	unsigned long misses;
 	unsigned long (*hash)(const void *);
 	int           (*compare)(const void *, const void *);
+	unsigned long seed;		/* HSH_RANDOM_SEED only */
 	int           readonly;
+	mem_Object    nodes;		/* Buckets are allocated from here */
+	int           flags;
+	int           shift;		/* See HSH_INDEX */
+	unsigned long min_size;	/* Never shrink below this many lists */
+	unsigned long mapped;		/* HSH_HUGE_PAGES: bytes of mappings */
+	bucketType    small;		/* HSH_SMALL: inline buckets, while used */
+	bucketType    small_free;	/* HSH_SMALL: inline buckets not in use */
+	bucketType    small_list;	/* HSH_SMALL: the one list, while used */
+	unsigned long long_chains;	/* See SET_LONG_CHAIN */
+	sortedType    *sorted;		/* HSH_SORTED_LISTS: index of each list */
 } *setType;
 
+				/* An HSH_SMALL set keeps up to SET_SMALL
+				   elements in one list of buckets that
+				   follow the set in memory */
+#define SET_SMALL 8
+
+				/* Lookups examining more elements of a
+				   list are counted in |long_chains| */
+#define SET_LONG_CHAIN 32
+
+				/* HSH_SORTED_LISTS sorts lists this long,
+				   and unsorts them below half of it */
+#define SET_SORTED_MIN 16
+
 static void _set_check(setType t, const char *function)
 {
 	if (!t) err_internal(function, "set is null");
@@ -73,30 +105,85 @@ static void _set_check(setType t, const char *function)
 #endif
 }
 
+/* The arrays and buckets of an HSH_HUGE_PAGES set come from
+   |mem_alloc_pages|. */
+
+static void *_set_alloc(setType t, size_t size)
+{
+	if (t->flags & HSH_HUGE_PAGES) return mem_alloc_pages(size, &t->mapped);
+	return xmalloc(size);
+}
+
+static void _set_free(setType t, void *pt)
+{
+	if (t->flags & HSH_HUGE_PAGES) mem_free_pages(pt, &t->mapped);
+	else                           xfree(pt);
+}
+
+static unsigned long _set_hash(setType t, const void *elem)
+{
+	if (!t->seed) return t->hash(elem);
+	if (!elem) err_internal(__func__, "String-valued elements may not be NULL");
+	return _hsh_hash_bytes(elem, strlen((const char *)elem), t->seed);
+}
+
+static mem_Object _set_nodes(setType t)
+{
+	if (t->flags & HSH_HUGE_PAGES)
+		return mem_create_objects2(sizeof(struct bucket), mem_alloc_pages,
+								   mem_free_pages, &t->mapped);
+	return mem_create_objects(sizeof(struct bucket));
+}
+
 static set_Set _set_create(unsigned long seed,
 						   set_HashFunction hash,
-						   set_CompareFunction compare)
+						   set_CompareFunction compare,
+						   int flags)
 {
 	setType       t;
 	unsigned long i;
-	unsigned long prime = prm_next_prime(seed);
+	unsigned long prime = _hsh_next_size(flags, seed);
+	int           small = flags & HSH_SMALL;
+
+	if (flags & ~(HSH_POWER_OF_TWO | HSH_HUGE_PAGES | HSH_SMALL
+				  | HSH_RANDOM_SEED | HSH_SORTED_LISTS))
+		err_fatal(__func__, "Unsupported flags for a set: 0x%x", flags);
+	if ((flags & HSH_RANDOM_SEED) && hash)
+		err_fatal(__func__, "HSH_RANDOM_SEED requires the default hash");
 
-	t               = xmalloc(sizeof(struct set));
+	t               = xmalloc(sizeof(struct set)
+							  + (small ? SET_SMALL * sizeof(struct bucket) : 0));
 #if MAA_MAGIC
 	t->magic        = SET_MAGIC;
 #endif
-	t->prime        = prime;
+	t->flags        = flags;
+	t->mapped       = 0;
+	t->prime        = small ? 1 : prime;
 	t->entries      = 0;
-	t->buckets      = xmalloc(t->prime * sizeof(struct bucket));
+	t->buckets      = small ? &t->small_list
+		: _set_alloc(t, t->prime * sizeof(bucketType));
 	t->resizings    = 0;
 	t->retrievals   = 0;
 	t->hits         = 0;
 	t->misses       = 0;
-	t->hash         = hash ? hash : hsh_string_hash;
+	t->hash         = hash ? hash : hsh_string_hash_fast;
 	t->compare      = compare ? compare : hsh_string_compare;
+	t->seed         = flags & HSH_RANDOM_SEED ? _hsh_random_seed() : 0;
 	t->readonly     = 0;
+	t->nodes        = small ? NULL : _set_nodes(t);
+	t->shift        = !small && (flags & HSH_POWER_OF_TWO)
+		? _hsh_shift(prime) : 0;
+	t->min_size     = t->prime;
+	t->small        = small ? (bucketType)(t + 1) : NULL;
+	t->small_free   = NULL;
+	t->long_chains  = 0;
+	t->sorted       = NULL;
 
 	for (i = 0; i < t->prime; i++) t->buckets[i] = NULL;
+	for (i = 0; small && i < SET_SMALL; i++) {
+		t->small[i].next = t->small_free;
+		t->small_free    = &t->small[i];
+	}
 
 	return t;
 }
@@ -109,8 +196,8 @@ static set_Set _set_create(unsigned long seed,
 
    The |hash| function should take a pointer to a |elem| and return an
    "unsigned int".  If |hash| is "NULL", then the |elem| is assumed to be a
-   pointer to a null-terminated string, and the function shown in
-   \grindref{fig:hshstringhash} will be used for |hash|.
+   pointer to a null-terminated string, and |hsh_string_hash_fast| will be
+   used for |hash|.
 
    The |compare| function should take a pair of pointers to elements and
    return zero if the elements are the same and non-zero if they are
@@ -125,7 +212,25 @@ static set_Set _set_create(unsigned long seed,
 
 set_Set set_create(set_HashFunction hash, set_CompareFunction compare)
 {
-	return _set_create(0, hash, compare);
+	return _set_create(0, hash, compare, 0);
+}
+
+/* \doc |set_create2| acts like |set_create|, but the internal
+   representation of the set is selected by |flags|, as for
+   |hsh_create2|.  Only |HSH_POWER_OF_TWO|, |HSH_HUGE_PAGES|, |HSH_SMALL|,
+   |HSH_RANDOM_SEED| and |HSH_SORTED_LISTS| are supported for sets.  A set created with
+   |HSH_SMALL| keeps its first 8 elements in a single list of buckets that
+   are part of its own allocation, and moves to an array of lists at its
+   9th.  A set created with |HSH_SORTED_LISTS| sorts and indexes its long
+   lists, as a table does.  A set created with |HSH_RANDOM_SEED| (and a
+   "NULL" |hash|) hashes its strings with a seed of its own, which
+   |set_get_hash| does not reflect. */
+
+set_Set set_create2(set_HashFunction hash,
+					set_CompareFunction compare,
+					int flags)
+{
+	return _set_create(0, hash, compare, flags);
 }
 
 set_HashFunction set_get_hash(set_Set set)
@@ -144,24 +249,151 @@ set_CompareFunction set_get_compare(set_Set set)
 	return t->compare;
 }
 
-static void _set_destroy_buckets(set_Set set)
+/* Sorted lists of HSH_SORTED_LISTS sets, see hash.c.  The elements are
+   compared only when their hash values are equal. */
+
+static int _set_sortable(setType t, unsigned long walked)
+{
+	return walked >= SET_SORTED_MIN && (t->flags & HSH_SORTED_LISTS)
+		&& !t->readonly;
+}
+
+static sortedType _set_sorted_alloc(setType t, unsigned long room)
+{
+	sortedType s = _set_alloc(t, sizeof(struct sorted)
+							  + (room - 1) * sizeof(bucketType));
+
+	s->count = 0;
+	s->room  = room;
+	return s;
+}
+
+static int _set_sorted_compare(const void *a, const void *b)
+{
+	unsigned long x = (*(const bucketType *)a)->hash;
+	unsigned long y = (*(const bucketType *)b)->hash;
+
+	return x < y ? -1 : x > y;
+}
+
+static void _set_sort_list(setType t, unsigned long h)
 {
+	sortedType    s;
+	bucketType    pt;
+	unsigned long n;
 	unsigned long i;
-	setType       t = (setType)set;
 
-	_set_check(t, __func__);
-	for (i = 0; i < t->prime; i++) {
-		bucketType b = t->buckets[i];
+	if (!t->sorted) {
+		t->sorted = _set_alloc(t, t->prime * sizeof(sortedType));
+		memset(t->sorted, 0, t->prime * sizeof(sortedType));
+	}
 
-		while (b) {
-			bucketType next = b->next;
-	 
-			xfree(b);		/* terminal */
-			b = next;
+	for (n = 0, pt = t->buckets[h]; pt; pt = pt->next) ++n;
+	s        = _set_sorted_alloc(t, 2 * n);
+	s->count = n;
+	for (i = 0, pt = t->buckets[h]; pt; pt = pt->next) s->nodes[i++] = pt;
+	qsort(s->nodes, n, sizeof(bucketType), _set_sorted_compare);
+
+	for (i = 0; i + 1 < n; i++) s->nodes[i]->next = s->nodes[i + 1];
+	s->nodes[n - 1]->next = NULL;
+	t->buckets[h] = s->nodes[0];
+	t->sorted[h]  = s;
+}
+
+static unsigned long _set_sorted_bound(sortedType s, unsigned long hash)
+{
+	unsigned long lo = 0;
+	unsigned long hi = s->count;
+
+	while (lo < hi) {
+		unsigned long mid = lo + (hi - lo) / 2;
+
+		if (s->nodes[mid]->hash < hash) lo = mid + 1;
+		else                            hi = mid;
+	}
+	return lo;
+}
+
+/* Return the index in |s| of the bucket of |elem|, or |s->count|. */
+
+static unsigned long _set_sorted_find(
+	setType t,
+	sortedType s,
+	unsigned long hash,
+	const void *elem)
+{
+	unsigned long first = _set_sorted_bound(s, hash);
+	unsigned long i;
+
+	for (i = first; i < s->count && s->nodes[i]->hash == hash; i++)
+		if (!t->compare(s->nodes[i]->elem, elem)) {
+			if (i - first + 1 > SET_LONG_CHAIN) ++t->long_chains;
+			return i;
 		}
+	if (i - first > SET_LONG_CHAIN) ++t->long_chains;
+	return s->count;
+}
+
+static void _set_sorted_link(setType t, unsigned long h, bucketType b)
+{
+	sortedType    s = t->sorted[h];
+	unsigned long i = _set_sorted_bound(s, b->hash);
+
+	if (s->count == s->room) {
+		sortedType bigger = _set_sorted_alloc(t, 2 * s->room);
+
+		bigger->count = s->count;
+		memcpy(bigger->nodes, s->nodes, s->count * sizeof(bucketType));
+		_set_free(t, s);
+		t->sorted[h] = s = bigger;
 	}
 
-	xfree(t->buckets);		/* terminal */
+	b->next = i < s->count ? s->nodes[i] : NULL;
+	if (i) s->nodes[i - 1]->next = b;
+	else   t->buckets[h]         = b;
+	memmove(s->nodes + i + 1, s->nodes + i,
+			(s->count - i) * sizeof(bucketType));
+	s->nodes[i] = b;
+	++s->count;
+}
+
+static bucketType _set_sorted_unlink(setType t, unsigned long h,
+									 unsigned long i)
+{
+	sortedType s = t->sorted[h];
+	bucketType b = s->nodes[i];
+
+	if (i) s->nodes[i - 1]->next = b->next;
+	else   t->buckets[h]         = b->next;
+	memmove(s->nodes + i, s->nodes + i + 1,
+			(s->count - i - 1) * sizeof(bucketType));
+	if (--s->count < SET_SORTED_MIN / 2) {
+		_set_free(t, s);
+		t->sorted[h] = NULL;
+	}
+	return b;
+}
+
+static void _set_sorted_drop(setType t)
+{
+	unsigned long i;
+
+	if (!t->sorted) return;
+	for (i = 0; i < t->prime; i++)
+		if (t->sorted[i]) _set_free(t, t->sorted[i]);
+	_set_free(t, t->sorted);
+	t->sorted = NULL;
+}
+
+static void _set_destroy_buckets(set_Set set)
+{
+	setType       t = (setType)set;
+
+	_set_check(t, __func__);
+	_set_sorted_drop(t);
+	if (t->nodes) mem_destroy_objects(t->nodes); /* terminal */
+	if (!t->small) _set_free(t, t->buckets);     /* terminal */
+	t->nodes   = NULL;
 	t->buckets = NULL;
 }
 
@@ -199,34 +431,171 @@ void set_destroy(set_Set set)
 static void _set_insert(set_Set set, unsigned long hash, const void *elem)
 {
 	setType       t = (setType)set;
-	unsigned long h = hash % t->prime;
+	unsigned long h = HSH_INDEX(hash, t->prime, t->shift);
 	bucketType    b;
 
 	_set_check(t, __func__);
    
-	b        = xmalloc(sizeof(struct bucket));
+	if (t->small) {
+		b             = t->small_free;
+		t->small_free = b->next;
+	} else {
+		b = mem_get_object(t->nodes);
+	}
 	b->hash  = hash;
 	b->elem  = elem;
 	b->next  = NULL;
    
-	if (t->buckets[h]) b->next = t->buckets[h];
-	t->buckets[h] = b;
+	if (t->sorted && t->sorted[h]) {
+		_set_sorted_link(t, h, b);
+	} else {
+		if (t->buckets[h]) b->next = t->buckets[h];
+		t->buckets[h] = b;
+	}
 	++t->entries;
 }
 
+/* Move all of the buckets to a new array of |prime| lists (which should
+   come from |_hsh_next_size|).  The buckets themselves are relinked, not
+   copied. */
+
+static void _set_resize(setType t, unsigned long prime)
+{
+	bucketType    *buckets = _set_alloc(t, prime * sizeof(bucketType));
+	int           shift    = t->shift ? _hsh_shift(prime) : 0;
+	unsigned long i;
+
+	_set_sorted_drop(t);
+	for (i = 0; i < prime; i++) buckets[i] = NULL;
+
+	for (i = 0; i < t->prime; i++) {
+		bucketType pt;
+		bucketType next;
+
+		for (pt = t->buckets[i]; pt; pt = next) {
+			unsigned long h = HSH_INDEX(pt->hash, prime, shift);
+
+			next        = pt->next;
+			pt->next    = buckets[h];
+			buckets[h]  = pt;
+		}
+	}
+
+	_set_free(t, t->buckets);
+	t->prime   = prime;
+	t->shift   = shift;
+	t->buckets = buckets;
+	++t->resizings;
+}
+
+/* Move the elements of |t| to a new array of |prime| lists and a fresh
+   pool of buckets.  The buckets of a small set leave its inline ones. */
+
+static void _set_rebuild(setType t, unsigned long prime)
+{
+	int           shift   = (t->flags & HSH_POWER_OF_TWO) ? _hsh_shift(prime) : 0;
+	bucketType    *buckets = _set_alloc(t, prime * sizeof(bucketType));
+	mem_Object    nodes    = _set_nodes(t);
+	unsigned long i;
+	bucketType    pt;
+
+	_set_sorted_drop(t);
+	for (i = 0; i < prime; i++) buckets[i] = NULL;
+
+	for (i = 0; i < t->prime; i++)
+		for (pt = t->buckets[i]; pt; pt = pt->next) {
+			unsigned long h = HSH_INDEX(pt->hash, prime, shift);
+			bucketType    b = mem_get_object(nodes);
+
+			*b         = *pt;
+			b->next    = buckets[h];
+			buckets[h] = b;
+		}
+
+	if (t->small) {
+		t->small      = NULL;
+		t->small_free = NULL;
+	} else {
+		mem_destroy_objects(t->nodes);
+		_set_free(t, t->buckets);
+	}
+	t->nodes   = nodes;
+	t->buckets = buckets;
+	t->prime   = prime;
+	t->shift   = shift;
+	++t->resizings;
+}
+
+/* Shrink a set that has become less than 1/8 full, so that it is about
+   1/4 full.  It grows again only when it is more than half full. */
+
+static void _set_shrink(setType t)
+{
+	unsigned long prime;
+
+	if (t->entries * 8 >= t->prime || t->prime <= t->min_size) return;
+
+	prime = max(t->min_size, _hsh_next_size(t->flags, 4 * t->entries + 1));
+	if (prime < t->prime) _set_resize(t, prime);
+}
+
+/* \doc |set_reserve| grows the |set|, if necessary, so that it can hold
+   |entries| elements without growing again. */
+
+void set_reserve(set_Set set, unsigned long entries)
+{
+	setType       t = (setType)set;
+	unsigned long prime;
+
+	_set_check(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to resize readonly set");
+
+	prime = _hsh_next_size(t->flags, 2 * entries + 1);
+	if (t->small) {
+		if (entries <= SET_SMALL) return;
+		t->min_size = prime;
+		_set_rebuild(t, prime);
+		return;
+	}
+
+	t->min_size = max(t->min_size, prime);
+	if (prime > t->prime) _set_resize(t, prime);
+}
+
+/* \doc |set_compact| rebuilds the |set| at the size that its current
+   elements call for, and copies its buckets to a fresh pool, so that the
+   memory left over by deletions is given back.  As with |hsh_compact|,
+   deletions shrink a set automatically once it is less than a quarter as
+   full as it may get, but never below the size requested with
+   |set_reserve|, which |set_compact| forgets. */
+
+void set_compact(set_Set set)
+{
+	setType t = (setType)set;
+
+	_set_check(t, __func__);
+	if (t->readonly)
+		err_internal(__func__, "Attempt to compact readonly set");
+	if (t->small) return;
+
+	t->min_size = _hsh_next_size(t->flags, 0);
+	_set_rebuild(t, _hsh_next_size(t->flags, 4 * t->entries + 1));
+}
+
 /* \doc |set_insert| inserts a new |elem| into the |set|.  If the insertion
    is successful, zero is returned.  If the |elem| already exists, 1 is
    returned.
 
    If the internal representation of the set becomes more than half full,
    its size is increased automatically.  At present, this requires that all
-   of the element pointers are copied into a new set.  Rehashing is not
+   of the buckets are relinked into a new array of lists.  Rehashing is not
    required, however, since the hash values are stored for each element. */
 
 int set_insert(set_Set set, const void *elem)
 {
 	setType       t         = (setType)set;
-	unsigned long hashValue = t->hash(elem);
+	unsigned long hashValue = _set_hash(t, elem);
 	unsigned long h;
 
 	_set_check(t, __func__);
@@ -234,34 +603,32 @@ int set_insert(set_Set set, const void *elem)
 		err_internal(__func__, "Attempt to insert into readonly set");
    
 	/* Keep table less than half full */
-	if (t->entries * 2 > t->prime) {
-		setType       new = _set_create(t->prime * 3, t->hash, t->compare);
-		unsigned long i;
-
-		for (i = 0; i < t->prime; i++) {
-			if (t->buckets[i]) {
-				bucketType pt;
-
-				for (pt = t->buckets[i]; pt; pt = pt->next)
-					_set_insert(new, pt->hash, pt->elem);
-			}
+	if (t->small) {
+		if (t->entries == SET_SMALL) {
+			t->min_size = _hsh_next_size(t->flags, 0);
+			_set_rebuild(t, _hsh_next_size(t->flags, 3 * SET_SMALL));
 		}
-
-		/* fixup values */
-		_set_destroy_buckets(t);
-		t->prime = new->prime;
-		t->buckets = new->buckets;
-		_set_destroy_table(new);
-		++t->resizings;
+	} else if (t->entries * 2 > t->prime) {
+		_set_resize(t, _hsh_next_size(t->flags, t->prime * 3));
 	}
    
-	h = hashValue % t->prime;
+	h = HSH_INDEX(hashValue, t->prime, t->shift);
 
-	if (t->buckets[h]) {		/* Assert uniqueness */
-		bucketType pt;
+	if (t->sorted && t->sorted[h]) { /* Assert uniqueness */
+		sortedType s = t->sorted[h];
+
+		if (_set_sorted_find(t, s, hashValue, elem) < s->count) return 1;
+	} else if (t->buckets[h]) {
+		bucketType    pt;
+		unsigned long n;
 	  
-		for (pt = t->buckets[h]; pt; pt = pt->next)
-			if (!t->compare(pt->elem, elem)) return 1;
+		for (n = 1, pt = t->buckets[h]; pt; pt = pt->next, n++)
+			if (!t->compare(pt->elem, elem)) {
+				if (n > SET_LONG_CHAIN) ++t->long_chains;
+				return 1;
+			}
+		if (n > SET_LONG_CHAIN + 1) ++t->long_chains;
+		if (_set_sortable(t, n - 1)) _set_sort_list(t, h);
 	}
 
 	_set_insert(t, hashValue, elem);
@@ -269,31 +636,54 @@ int set_insert(set_Set set, const void *elem)
 }
 
 /* \doc |set_delete| removes an |elem| from the |set|.  Zero is returned if
-   the |elem| was present.  Otherwise, 1 is returned. */
+   the |elem| was present.  Otherwise, 1 is returned.  The internal
+   representation shrinks again when the set becomes less than an eighth
+   full. */
 
 int set_delete(set_Set set, const void *elem)
 {
-	setType       t = (setType)set;
-	unsigned long h = t->hash(elem) % t->prime;
+	setType       t    = (setType)set;
+	unsigned long hash = _set_hash(t, elem);
+	unsigned long h    = HSH_INDEX(hash, t->prime, t->shift);
 
 	_set_check(t, __func__);
 	if (t->readonly)
 		err_internal(__func__, "Attempt to delete from readonly set");
    
+	if (t->sorted && t->sorted[h]) {
+		unsigned long i = _set_sorted_find(t, t->sorted[h], hash, elem);
+
+		if (i == t->sorted[h]->count) return 1;
+		mem_free_object(t->nodes, _set_sorted_unlink(t, h, i));
+		--t->entries;
+		_set_shrink(t);
+		return 0;
+	}
 	if (t->buckets[h]) {
-		bucketType pt;
-		bucketType prev;
+		bucketType    pt;
+		bucketType    prev;
+		unsigned long n;
 	  
-		for (prev = NULL, pt = t->buckets[h]; pt; prev = pt, pt = pt->next)
+		for (n = 1, prev = NULL, pt = t->buckets[h];
+			 pt;
+			 n++, prev = pt, pt = pt->next)
 			if (!t->compare(pt->elem, elem)) {
+				if (n > SET_LONG_CHAIN) ++t->long_chains;
 				--t->entries;
 	       
 				if (!prev) t->buckets[h] = pt->next;
 				else       prev->next = pt->next;
 	       
-				xfree(pt);
+				if (t->small) {
+					pt->next      = t->small_free;
+					t->small_free = pt;
+				} else {
+					mem_free_object(t->nodes, pt);
+				}
+				_set_shrink(t);
 				return 0;
 			}
+		if (n > SET_LONG_CHAIN + 1) ++t->long_chains;
 	}
    
 	return 1;
@@ -304,18 +694,31 @@ int set_delete(set_Set set, const void *elem)
 
 int set_member(set_Set set, const void *elem)
 {
-	setType       t = (setType)set;
-	unsigned long h = t->hash(elem) % t->prime;
+	setType       t    = (setType)set;
+	unsigned long hash = _set_hash(t, elem);
+	unsigned long h    = HSH_INDEX(hash, t->prime, t->shift);
 
 	_set_check(t, __func__);
    
 	++t->retrievals;
-	if (t->buckets[h]) {
-		bucketType pt;
-		bucketType prev;
+	if (t->sorted && t->sorted[h]) {
+		sortedType    s = t->sorted[h];
+		unsigned long i = _set_sorted_find(t, s, hash, elem);
+
+		if (i < s->count) {
+			if (s->nodes[i] == t->buckets[h]) ++t->hits;
+			return 1;
+		}
+	} else if (t->buckets[h]) {
+		bucketType    pt;
+		bucketType    prev;
+		unsigned long n;
 	  
-		for (prev = NULL, pt = t->buckets[h]; pt; prev = pt, pt = pt->next)
+		for (n = 1, prev = NULL, pt = t->buckets[h];
+			 pt;
+			 n++, prev = pt, pt = pt->next)
 			if (!t->compare(pt->elem, elem)) {
+				if (n > SET_LONG_CHAIN) ++t->long_chains;
 				if (!prev) {
 					++t->hits;
 				} else if (!t->readonly) {
@@ -324,14 +727,91 @@ int set_member(set_Set set, const void *elem)
 					pt->next      = t->buckets[h];
 					t->buckets[h] = pt;
 				}
+				if (_set_sortable(t, n)) _set_sort_list(t, h);
 				return 1;
 			}
+		if (n > SET_LONG_CHAIN + 1) ++t->long_chains;
+		if (_set_sortable(t, n - 1)) _set_sort_list(t, h);
 	}
 
 	++t->misses;
 	return 0;
 }
 
+/* A membership test in flight in |set_member_batch|, see
+   |hsh_retrieve_batch|. */
+
+typedef struct lookup {
+	enum { SET_IDLE, SET_HEAD, SET_WALK } state;
+	size_t        i;		/* Index into |elems| */
+	unsigned long hash;
+	bucketType    *head;
+	bucketType    pt;
+} *lookupType;
+
+/* \doc |set_member_batch| tests each of the |n| elements of |elems| for
+   membership in |set|, and stores the results, as |set_member| would
+   return them, in the corresponding elements of |out|.  As with
+   |hsh_retrieve_batch|, the tests are interleaved so that their memory
+   accesses overlap, and the lists are not self-organized. */
+
+void set_member_batch(set_Set set, const void **elems, size_t n, int *out)
+{
+	setType       t = (setType)set;
+	struct lookup lookups[HSH_BATCH];
+	size_t        next = 0;
+	size_t        done = 0;
+	int           j;
+
+	_set_check(t, __func__);
+	for (j = 0; j < HSH_BATCH; j++) lookups[j].state = SET_IDLE;
+
+	while (done < n) {
+		for (j = 0; j < HSH_BATCH; j++) {
+			lookupType l = lookups + j;
+
+			switch (l->state) {
+			case SET_IDLE:
+				if (next == n) break;
+				l->i     = next++;
+				l->hash  = _set_hash(t, elems[l->i]);
+				l->head  = &t->buckets[HSH_INDEX(l->hash, t->prime, t->shift)];
+				l->state = SET_HEAD;
+				HSH_PREFETCH(l->head);
+				++t->retrievals;
+				break;
+			case SET_HEAD:
+				l->pt    = *l->head;
+				l->state = SET_WALK;
+				if (l->pt) {
+					HSH_PREFETCH(l->pt);
+					break;
+				}
+				/* FALLTHROUGH */
+			case SET_WALK:
+				if (l->pt
+					&& (l->pt->hash != l->hash
+						|| t->compare(l->pt->elem, elems[l->i]))) {
+					l->pt = l->pt->next;
+					if (l->pt) {
+						HSH_PREFETCH(l->pt);
+						break;
+					}
+				}
+				if (l->pt) {
+					if (l->pt == *l->head) ++t->hits;
+				} else {
+					++t->misses;
+				}
+				out[l->i] = l->pt != NULL;
+				l->state  = SET_IDLE;
+				++done;
+				break;
+			}
+		}
+	}
+}
+
 /* \doc |set_iterate| is used to iterate a function over every |elem| in
    the |set|.  The function, |iterator|, is passed each |elem|.  If
    |iterator| returns a non-zero value, the iterations stop, and
@@ -440,7 +920,8 @@ set_Position set_next_position(set_Set set, set_Position position)
    
 	if (b->next) return b->next;
 
-	for (h = b->hash % t->prime, i = h + 1; i < t->prime; i++)
+	h = HSH_INDEX(b->hash, t->prime, t->shift);
+	for (i = h + 1; i < t->prime; i++)
 		if (t->buckets[i]) return t->buckets[i];
 
 	t->readonly = 0;
@@ -749,6 +1230,13 @@ set_Stats set_get_stats(set_Set set)
 	s->retrievals     = t->retrievals;
 	s->hits           = t->hits;
 	s->misses         = t->misses;
+	s->mapped         = t->mapped;
+	s->pages          = MEM_PAGES(t->mapped, MEM_PAGE);
+	s->huge_pages     = MEM_PAGES(t->mapped, MEM_HUGE_PAGE);
+	s->long_chains    = t->long_chains;
+	s->sorted_lists   = 0;
+	for (i = 0; t->sorted && i < t->prime; i++)
+		if (t->sorted[i]) ++s->sorted_lists;
    
 	for (i = 0; i < t->prime; i++) {
 		if (t->buckets[i]) {
@@ -795,6 +1283,15 @@ void set_print_stats(set_Set set, FILE *stream)
 		fprintf(str, "\n");
 	fprintf(str, "   %lu retrievals (%lu from top, %lu failed)\n",
 			s->retrievals, s->hits, s->misses);
+	if (s->mapped)
+		fprintf(str, "   %lu bytes mapped (%lu huge pages, not %lu small)\n",
+				s->mapped, s->huge_pages, s->pages);
+	if (s->long_chains)
+		fprintf(str, "   %lu lookups walked unexpectedly far"
+				" (colliding elements or a poor hash)\n", s->long_chains);
+	if (s->sorted_lists)
+		fprintf(str, "   %lu long lists sorted for binary search\n",
+				s->sorted_lists);
 
 	xfree(s);			/* rare */
 }
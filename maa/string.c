@@ -46,11 +46,21 @@ typedef struct poolInfo {
 /* \doc |str_pool_create| initialized a string pool object. */
 
 str_Pool str_pool_create( void )
+{
+	return str_pool_create2( 0 );
+}
+
+/* \doc |str_pool_create2| acts like |str_pool_create|, but |flags| are
+   passed to |hsh_create2| for the table that indexes the strings, which
+   always has |HSH_SIZED_KEYS|.  |HSH_RANDOM_SEED| is useful for a pool
+   that holds strings read from untrusted input. */
+
+str_Pool str_pool_create2( int flags )
 {
 	poolInfo pool = xmalloc( sizeof( struct poolInfo ) );
 
 	pool->string = mem_create_strings();
-	pool->hash   = hsh_create( NULL, NULL );
+	pool->hash   = hsh_create2( NULL, NULL, HSH_SIZED_KEYS | flags );
 
 	return pool;
 }
@@ -90,14 +100,38 @@ int str_pool_exists( str_Pool pool, const char *s )
 
 const char *str_pool_find( str_Pool pool, const char *s )
 {
-	const char *datum;
+	const void **datum;
+	int        inserted;
 	poolInfo   p = (poolInfo)pool;
    
-	if ((datum = hsh_retrieve( p->hash, s ))) return datum;
-	datum = mem_strcpy( p->string, s );
-	hsh_insert( p->hash, datum, datum );
+	datum = hsh_find_or_insert( p->hash, s, &inserted );
+	if (inserted) {
+		*datum = mem_strcpy( p->string, s );
+		hsh_set_key( p->hash, datum, *datum );
+	}
 
-	return datum;
+	return *datum;
+}
+
+/* \doc |str_pool_findn| acts like |str_pool_find|, except that the
+   length of the string is specified, and the string does not have to be
+   "NULL" terminated.  The string is copied only if it is not found. */
+
+const char *str_pool_findn( str_Pool pool, const char *s, int length )
+{
+	const void **datum;
+	int        inserted;
+	const char *end = memchr( s, 0, length );
+	poolInfo   p    = (poolInfo)pool;
+
+	if (end) length = end - s;
+	datum = hsh_find_or_insert_n( p->hash, s, length, &inserted );
+	if (inserted) {
+		*datum = mem_strncpy( p->string, s, length );
+		hsh_set_key( p->hash, datum, *datum );
+	}
+
+	return *datum;
 }
 
 /* \doc |str_pool_iterate| is used to iterate a function over every
@@ -246,6 +280,7 @@ str_Stats str_pool_get_stats( str_Pool pool )
 		s->retrievals = h->retrievals;
 		s->hits       = h->hits;
 		s->misses     = h->misses;
+		s->long_chains = h->long_chains;
 	  
 		xfree( h );		/* rare */
 		xfree( m );		/* rare */
@@ -255,6 +290,7 @@ str_Stats str_pool_get_stats( str_Pool pool )
 		s->retrievals = 0;
 		s->hits       = 0;
 		s->misses     = 0;
+		s->long_chains = 0;
 	}
 
 	return s;
@@ -274,6 +310,9 @@ void str_pool_print_stats( str_Pool pool, FILE *stream )
 	fprintf( str, "   %d strings using %d bytes\n", s->count, s->bytes );
 	fprintf( str, "   %d retrievals (%d from top, %d failed)\n",
 			 s->retrievals, s->hits, s->misses );
+	if (s->long_chains)
+		fprintf( str, "   %d lookups walked unexpectedly far\n",
+				 s->long_chains );
 	xfree( s );			/* rare */
 }
 
@@ -308,13 +347,8 @@ const char *str_find( const char *s )
 
 const char *str_findn( const char *s, int length )
 {
-	char *tmp = alloca( sizeof( char ) * (length + 1) );
-
 	_str_check_global();
-	strncpy( tmp, s, length);
-	tmp [ length ] = 0;
-
-	return str_pool_find( global, tmp );
+	return str_pool_findn( global, s, length );
 }
 
 /* \doc |str_copy| acts like |str_pool_copy|, except the global string pool
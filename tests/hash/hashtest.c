@@ -25,6 +25,11 @@
  */
 
 #include "maaP.h"
+#include "hshdef.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 #if 1
 #  define INT2PTR(x) ((void *)x)
@@ -251,6 +256,1448 @@ static void test_hsh_integers(int count)
 	hsh_destroy(t);
 }
 
+static int counter(const void *key, const void *datum, void *arg)
+{
+	++*(int *)arg;
+	return 0;
+}
+
+static int counted;
+
+static int counter_noarg(const void *key, const void *datum)
+{
+	++counted;
+	return 0;
+}
+
+static void test_hsh_flags(const char *name, int flags, int count)
+{
+	hsh_HashTable t;
+	hsh_Stats     s;
+	hsh_Position  hsh_pos;
+	void          *hsh_key;
+	void          *hsh_data;
+	int           i;
+	int           n;
+
+	printf("=== %s ===\n", name);
+	t = hsh_create2(NULL, NULL, flags);
+
+	for (i = 0; i < count * 10; i++)
+		hsh_insert(t, get_key(i), get_datum(i));
+
+	printf("duplicate insert: %d\n", hsh_insert(t, "key7", "datum"));
+
+	for (i = count * 10 + 1; i >= -2; i--) {
+		const char *pt = hsh_retrieve(t, get_static_key(i));
+		const char *datum = get_static_datum(i);
+
+		if (!pt || strcmp(pt, datum))
+			printf("Expected \"%s\", got \"%s\"\n",
+					datum, pt ? pt : "(null)");
+	}
+
+	/* Delete every third item */
+	for (i = 0; i < count * 10; i += 3) {
+		char *key = get_static_key(i);
+		void *datum = __UNCONST(hsh_retrieve(t, key));
+
+		if (hsh_delete(t, key))
+			printf("Cannot delete \"%s\"\n", key);
+		xfree(datum);
+		xfree(key);
+	}
+	printf("second delete: %d\n", hsh_delete(t, "key0"));
+
+	for (i = 0; i < count * 10; i++) {
+		const char *pt = hsh_retrieve(t, get_static_key(i));
+
+		if ((pt != NULL) != (i % 3 != 0))
+			printf("Unexpected \"%s\" for key%d\n", pt ? pt : "(null)", i);
+	}
+
+	{
+		const void **keys = xmalloc(count * 10 * sizeof(void *));
+		const void **out  = xmalloc(count * 10 * sizeof(void *));
+
+		for (i = 0; i < count * 10; i++) keys[i] = get_static_key(i);
+		hsh_retrieve_batch(t, keys, count * 10, out);
+		for (i = n = 0; i < count * 10; i++) {
+			if (out[i] != hsh_retrieve(t, keys[i]))
+				printf("Batched retrieval of key%d differs\n", i);
+			if (out[i]) ++n;
+			xfree(__UNCONST(keys[i]));
+		}
+		printf("hsh_retrieve_batch: %d found\n", n);
+		xfree(out);
+		xfree(keys);
+	}
+
+	n = 0;
+	hsh_iterate_arg(t, counter, &n);
+	printf("hsh_iterate_arg: %d entries\n", n);
+
+	n = 0;
+	HSH_ITERATE(t, hsh_pos, hsh_key, hsh_data){
+		if (strcmp((const char *)hsh_retrieve(t, hsh_key), hsh_data))
+			printf("Bad datum for \"%s\"\n", (const char *)hsh_key);
+		++n;
+	}
+	printf("HSH_ITERATE: %d entries\n", n);
+
+	s = hsh_get_stats(t);
+	printf("hsh_get_stats: %lu entries\n", s->entries);
+	xfree(s);
+
+	hsh_iterate(t, freer);
+	hsh_destroy(t);
+
+	if (flags & HSH_SIZED_KEYS) return;
+
+	/* Integer keys, hash values with poor low bits */
+	t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare, flags);
+	for (i = 1; i <= count * 10; i++) {
+		long key = (long)i << 12;
+
+		hsh_insert(t, INT2PTR(key), get_datum(i));
+	}
+	for (i = 1; i <= count * 10; i++) {
+		long        key = (long)i << 12;
+		const char *pt  = hsh_retrieve(t, INT2PTR(key));
+
+		if (!pt || strcmp(pt, get_static_datum(i)))
+			printf("Bad datum for %ld\n", key);
+	}
+	hsh_iterate(t, free_data);
+	hsh_destroy(t);
+}
+
+#define READERS 4
+
+static hsh_HashTable concurrent_table;
+static int           concurrent_count;
+static int           concurrent_done;
+
+/* Even keys stay in the table, odd keys come and go */
+static void *concurrent_reader(void *arg)
+{
+	long missing = 0;
+
+	while (!__atomic_load_n(&concurrent_done, __ATOMIC_ACQUIRE)) {
+		long i;
+
+		for (i = 2; i <= concurrent_count * 10; i += 2)
+			if (hsh_retrieve(concurrent_table, INT2PTR(i)) != INT2PTR(i))
+				++missing;
+	}
+	return INT2PTR(missing);
+}
+
+static void test_hsh_concurrent(int count)
+{
+	pthread_t readers[READERS];
+	long      missing = 0;
+	long      i;
+	int       round;
+	int       n       = 0;
+
+	printf("=== concurrent readers ===\n");
+	concurrent_table = hsh_create2(hsh_pointer_hash, hsh_pointer_compare,
+								   HSH_CONCURRENT);
+	concurrent_count = count;
+	for (i = 2; i <= count * 10; i += 2)
+		hsh_insert(concurrent_table, INT2PTR(i), INT2PTR(i));
+
+	for (i = 0; i < READERS; i++)
+		pthread_create(&readers[i], NULL, concurrent_reader, NULL);
+
+	for (round = 0; round < 20; round++) {
+		for (i = 1; i <= count * 10 * (round + 1); i += 2)
+			hsh_insert(concurrent_table, INT2PTR(i), INT2PTR(i));
+		for (i = 1; i <= count * 10 * (round + 1); i += 2)
+			hsh_delete(concurrent_table, INT2PTR(i));
+	}
+	__atomic_store_n(&concurrent_done, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < READERS; i++) {
+		void *result;
+
+		pthread_join(readers[i], &result);
+		missing += (long)result;
+	}
+	printf("missing: %ld\n", missing);
+	hsh_iterate_arg(concurrent_table, counter, &n);
+	printf("entries: %d\n", n);
+	hsh_destroy(concurrent_table);
+}
+
+#define WRITERS 4
+
+static hsh_ShardedTable sharded_table;
+
+/* Writer |arg| owns the keys congruent to |arg| modulo WRITERS */
+static void *sharded_writer(void *arg)
+{
+	long first = (long)arg;
+	long i;
+
+	for (i = first + 1; i <= concurrent_count * 10; i += WRITERS)
+		hsh_sharded_insert(sharded_table, INT2PTR(i), INT2PTR(i));
+	for (i = first + 1; i <= concurrent_count * 10; i += 2 * WRITERS)
+		hsh_sharded_delete(sharded_table, INT2PTR(i));
+	return NULL;
+}
+
+static void test_hsh_sharded(int count, int flags)
+{
+	pthread_t writers[WRITERS];
+	hsh_Stats s;
+	long      i;
+	int       n = 0;
+
+	printf("=== sharded ===\n");
+	sharded_table = hsh_sharded_create(hsh_pointer_hash, hsh_pointer_compare,
+									   16, flags);
+	concurrent_count = count;
+
+	for (i = 0; i < WRITERS; i++)
+		pthread_create(&writers[i], NULL, sharded_writer, INT2PTR(i));
+	for (i = 0; i < WRITERS; i++)
+		pthread_join(writers[i], NULL);
+
+	for (i = 1; i <= count * 10; i++) {
+		int expected = (i - 1) % (2 * WRITERS) >= WRITERS;
+
+		if ((hsh_sharded_retrieve(sharded_table, INT2PTR(i)) != NULL)
+			!= expected)
+			printf("Unexpected retrieval for %ld\n", i);
+	}
+
+	hsh_sharded_iterate(sharded_table, counter, &n);
+	printf("hsh_sharded_iterate: %d entries\n", n);
+	s = hsh_sharded_get_stats(sharded_table);
+	printf("hsh_sharded_get_stats: %lu entries, %lu retrievals\n",
+		   s->entries, s->retrievals);
+	xfree(s);
+	hsh_sharded_destroy(sharded_table);
+}
+
+static void test_hsh_fast_hashes(void)
+{
+	char          buf[128];
+	char          copy[130];
+	hsh_HashTable t = hsh_create(hsh_pointer_hash_fast, hsh_pointer_compare);
+	int           i;
+	int           distinct = 0;
+
+	printf("=== fast hashes ===\n");
+	memset(buf, 0, sizeof(buf));
+	for (i = 0; i < 100; i++) {
+		unsigned long h;
+
+		buf[i] = 'a' + i % 26;
+		h = hsh_string_hash_fast(buf);
+
+		/* Same string at an odd address */
+		strcpy(copy + 1, buf);
+		if (hsh_string_hash_fast(copy + 1) != h)
+			printf("Unaligned hash differs for length %d\n", i + 1);
+
+		if (!hsh_insert(t, INT2PTR(h), NULL)) ++distinct;
+	}
+	printf("hsh_string_hash_fast: %d distinct values of 100\n", distinct);
+	printf("empty string: %s\n",
+		   hsh_string_hash_fast("") == hsh_string_hash_fast("a")
+		   ? "collides" : "ok");
+	hsh_destroy(t);
+}
+
+static void test_hsh_sized_keys(void)
+{
+	const char    *buf = "alpha,beta,gamma,alphabet";
+	hsh_HashTable t    = hsh_create2(NULL, NULL, HSH_SIZED_KEYS);
+	hsh_Position  hsh_pos;
+	void          *hsh_key;
+	void          *hsh_data;
+
+	printf("=== sized key slices ===\n");
+	hsh_insert_n(t, buf, 5, "1");		/* alpha */
+	hsh_insert_n(t, buf + 6, 4, "2");	/* beta */
+	hsh_insert_n(t, buf + 17, 8, "3");	/* alphabet */
+	printf("duplicate insert: %d\n", hsh_insert_n(t, "alpha", 5, "4"));
+	printf("insert gamma: %d\n", hsh_insert(t, "gamma", "5"));
+
+	printf("alpha: %s\n", (const char *)hsh_retrieve_n(t, buf + 17, 5));
+	printf("alphabet: %s\n", (const char *)hsh_retrieve(t, "alphabet"));
+	printf("gamma: %s\n", (const char *)hsh_retrieve_n(t, buf + 11, 5));
+	printf("alph: %s\n", (const char *)hsh_retrieve_n(t, buf, 4));
+	printf("empty: %s\n", (const char *)hsh_retrieve_n(t, buf, 0));
+
+	printf("delete beta: %d\n", hsh_delete_n(t, "beta,", 4));
+	printf("delete beta again: %d\n", hsh_delete(t, "beta"));
+
+	HSH_ITERATE(t, hsh_pos, hsh_key, hsh_data) {
+		size_t length = hsh_get_position_length(t, hsh_pos);
+
+		if (hsh_retrieve_n(t, hsh_key, length) != hsh_data)
+			printf("Bad datum for \"%.*s\"\n", (int)length,
+				   (const char *)hsh_key);
+	}
+	counted = 0;
+	hsh_iterate(t, counter_noarg);
+	printf("entries: %d\n", counted);
+	hsh_destroy(t);
+}
+
+static long allocated;
+
+static void *test_allocate(size_t size, void *arg)
+{
+	++*(long *)arg;
+	++allocated;
+	return xmalloc(size);
+}
+
+static void test_deallocate(void *pt, void *arg)
+{
+	--allocated;
+	xfree(pt);
+}
+
+static unsigned long resizings(hsh_HashTable t)
+{
+	hsh_Stats     s = hsh_get_stats(t);
+	unsigned long r = s->resizings;
+
+	xfree(s);
+	return r;
+}
+
+static void test_hsh_options(int count)
+{
+	static const int flags[] = { 0, HSH_OPEN_ADDRESSING,
+								 HSH_INCREMENTAL_RESIZE, HSH_CONCURRENT };
+	char          **keys = xmalloc(count * sizeof(char *));
+	hsh_Options   o;
+	hsh_HashTable t;
+	hsh_Stats     s;
+	long          calls = 0;
+	int           i;
+	int           f;
+
+	printf("=== options ===\n");
+	for (i = 0; i < count; i++) {
+		char buf[32];
+
+		sprintf(buf, "key%d", i);
+		keys[i] = xstrdup(buf);
+	}
+
+	for (f = 0; f < (int)(sizeof(flags) / sizeof(flags[0])); f++) {
+		unsigned long before;
+
+		memset(&o, 0, sizeof(o));
+		o.flags   = flags[f];
+		o.entries = count;
+		t = hsh_create_ex(&o);
+		for (i = 0; i < count; i++) hsh_insert(t, keys[i], keys[i]);
+		printf("flags %d, entries hint: %lu resizings\n",
+			   flags[f], resizings(t));
+		hsh_destroy(t);
+
+		t = hsh_create2(NULL, NULL, flags[f]);
+		hsh_reserve(t, count);
+		before = resizings(t);
+		for (i = 0; i < count; i++) hsh_insert(t, keys[i], keys[i]);
+		hsh_reserve(t, count / 2);
+		printf("flags %d, hsh_reserve: %lu resizings\n",
+			   flags[f], resizings(t) - before);
+		hsh_destroy(t);
+	}
+
+	memset(&o, 0, sizeof(o));
+	o.max_load      = 2;
+	o.growth        = 2;
+	o.seed          = 42;
+	o.allocate      = test_allocate;
+	o.deallocate    = test_deallocate;
+	o.allocator_arg = &calls;
+	t = hsh_create_ex(&o);
+	for (i = 0; i < count; i++) hsh_insert(t, keys[i], keys[i]);
+	for (i = 0; i < count; i++)
+		if (hsh_retrieve(t, keys[i]) != keys[i])
+			printf("Seeded table lost \"%s\"\n", keys[i]);
+	s = hsh_get_stats(t);
+	printf("max_load 2: %s\n",
+		   s->entries <= 2 * s->size ? "ok" : "overloaded");
+	xfree(s);
+	hsh_destroy(t);
+	printf("allocator: %s, %s\n", calls ? "used" : "unused",
+		   allocated ? "leaked" : "balanced");
+
+	for (i = 0; i < count; i++) xfree(keys[i]);
+	xfree(keys);
+}
+
+static unsigned long weak_hash(const void *key)
+{
+	return (unsigned long)((const char *)key - (const char *)NULL) % 7;
+}
+
+static void test_hsh_frozen(int count)
+{
+	char            **keys = xmalloc(count * sizeof(char *));
+	hsh_Options     o;
+	hsh_HashTable   t;
+	hsh_FrozenTable f;
+	long            i;
+	long            j;
+	int             bad;
+
+	printf("=== frozen ===\n");
+	for (i = 0; i < count; i++) {
+		char buf[32];
+
+		sprintf(buf, "key%ld", i);
+		keys[i] = xstrdup(buf);
+	}
+
+	memset(&o, 0, sizeof(o));
+	for (o.seed = 0; o.seed < 2; o.seed++) {
+		t = hsh_create_ex(&o);
+		for (i = 0, j = 1; i < count; i++, j++)
+			hsh_insert(t, keys[i], INT2PTR(j));
+		f = hsh_freeze(t);
+		hsh_destroy(t);
+		for (i = bad = 0, j = 1; i < count; i++, j++)
+			if (hsh_frozen_retrieve(f, keys[i]) != INT2PTR(j)) ++bad;
+		printf("seed %lu: %d bad, \"nokey\" %s, ", o.seed, bad,
+			   hsh_frozen_retrieve(f, "nokey") ? "found" : "missing");
+		counted = 0;
+		hsh_frozen_iterate(f, counter, &counted);
+		printf("%d iterated\n", counted);
+		hsh_frozen_destroy(f);
+	}
+
+	/* Keys sharing hash values */
+	t = hsh_create(weak_hash, hsh_pointer_compare);
+	for (i = 1, j = -1; i <= count; i++, j--)
+		hsh_insert(t, INT2PTR(i), INT2PTR(j));
+	hsh_readonly(t, 1);
+	f = hsh_freeze(t);
+	printf("readonly table: %s\n", hsh_readonly(t, 0) ? "kept" : "lost");
+	hsh_destroy(t);
+	for (i = 1, j = -1, bad = 0; i <= count + 10; i++, j--)
+		if (hsh_frozen_retrieve(f, INT2PTR(i)) != (i <= count ? INT2PTR(j) : NULL))
+			++bad;
+	counted = 0;
+	hsh_frozen_iterate(f, counter, &counted);
+	printf("weak hash: %d bad, %d iterated\n", bad, counted);
+	hsh_frozen_destroy(f);
+
+	/* Sized keys */
+	t = hsh_create2(NULL, NULL, HSH_SIZED_KEYS);
+	hsh_insert_n(t, "alphabet", 5, "1");
+	hsh_insert_n(t, "alphabet", 8, "2");
+	f = hsh_freeze(t);
+	hsh_destroy(t);
+	printf("sized: %s %s %s %s\n",
+		   (const char *)hsh_frozen_retrieve_n(f, "alphabetic", 5),
+		   (const char *)hsh_frozen_retrieve_n(f, "alphabetic", 8),
+		   (const char *)hsh_frozen_retrieve(f, "alphabet"),
+		   (const char *)hsh_frozen_retrieve_n(f, "alphabet", 4));
+	hsh_frozen_destroy(f);
+
+	/* Empty */
+	t = hsh_create(NULL, NULL);
+	f = hsh_freeze(t);
+	hsh_destroy(t);
+	printf("empty: %s\n", hsh_frozen_retrieve(f, "key0") ? "found" : "missing");
+	hsh_frozen_destroy(f);
+
+	for (i = 0; i < count; i++) xfree(keys[i]);
+	xfree(keys);
+}
+
+static size_t long_length(const void *datum, void *arg)
+{
+	return sizeof(long);
+}
+
+/* Header fields of a file written by hsh_save, by offset */
+#define MAP_SEED    24
+#define MAP_COUNT   40
+#define MAP_SIZE    48
+#define MAP_BUCKETS 56
+#define MAP_PILOTS  80
+#define MAP_REMAP   88
+#define MAP_ENTRIES 96
+
+static uint64_t map_get(const char *image, long offset)
+{
+	uint64_t value;
+
+	memcpy(&value, image + offset, sizeof(value));
+	return value;
+}
+
+/* Return the bytes of the file written by hsh_save, and their number in
+   |*length| */
+
+static char *map_read(long *length)
+{
+	FILE *str  = fopen("hashtest.map", "rb");
+	char *image;
+
+	fseek(str, 0, SEEK_END);
+	*length = ftell(str);
+	image   = xmalloc(*length);
+	rewind(str);
+	if (fread(image, 1, *length, str) != (size_t)*length)
+		printf("short read\n");
+	fclose(str);
+	return image;
+}
+
+/* Map a copy of the |length| bytes of |image| in which |size| bytes at
+   |offset| are replaced by |value|, and report whether it is rejected */
+
+static const char *map_corrupted(const char *image, long length,
+								 long offset, uint64_t value, size_t size)
+{
+	hsh_MappedTable p;
+	FILE            *str = fopen("hashtest.map", "wb");
+
+	fwrite(image, 1, offset, str);
+	fwrite(&value, 1, size, str);
+	fwrite(image + offset + size, 1, length - offset - size, str);
+	fclose(str);
+	if ((p = hsh_map("hashtest.map"))) hsh_unmap(p);
+	return !p && errno == EINVAL ? "rejected" : "accepted";
+}
+
+static void test_hsh_mapped(int count)
+{
+	char            **keys = xmalloc(count * sizeof(char *));
+	hsh_HashTable   t;
+	hsh_MappedTable p;
+	const char      *datum;
+	size_t          length;
+	long            values[2] = { 1234567, -7654321 };
+	hsh_Options     o;
+	long            i;
+	int             bad;
+	FILE            *str;
+	char            *image;
+	long            size;
+
+	printf("=== mapped ===\n");
+	for (i = 0; i < count; i++) {
+		char buf[32];
+
+		sprintf(buf, "key%ld", i);
+		keys[i] = xstrdup(buf);
+	}
+
+	t = hsh_create(NULL, NULL);
+	for (i = 0; i < count; i++) hsh_insert(t, keys[i], keys[count - 1 - i]);
+	hsh_insert(t, "null", NULL);
+	hsh_save(t, "hashtest.map", NULL, NULL);
+	hsh_destroy(t);
+
+	p = hsh_map("hashtest.map");
+	for (i = bad = 0; i < count; i++) {
+		datum = hsh_mapped_retrieve(p, keys[i]);
+		if (!datum || strcmp(datum, keys[count - 1 - i])) ++bad;
+	}
+	printf("strings: %d bad, \"nokey\" %s, \"null\" %s\n", bad,
+		   hsh_mapped_retrieve(p, "nokey") ? "found" : "missing",
+		   hsh_mapped_retrieve(p, "null") ? "found" : "missing");
+	datum = hsh_mapped_retrieve_n(p, "key10x", 5, &length);
+	printf("key10: %s, %lu bytes\n", datum, (unsigned long)length);
+	counted = 0;
+	hsh_mapped_iterate(p, counter, &counted);
+	printf("%d iterated\n", counted);
+	hsh_unmap(p);
+
+	image = map_read(&size);
+	printf("no buckets: %s\n",
+		   map_corrupted(image, size, MAP_BUCKETS, 0, 8));
+	printf("overflowing pilots: %s\n",
+		   map_corrupted(image, size, MAP_PILOTS, -(uint64_t)8, 8));
+	printf("remapped out of range: %s\n",
+		   map_get(image, MAP_SIZE) > map_get(image, MAP_COUNT)
+		   ? map_corrupted(image, size, map_get(image, MAP_REMAP),
+						   map_get(image, MAP_COUNT), 4)
+		   : "rejected");
+	printf("key out of range: %s\n",
+		   map_corrupted(image, size, map_get(image, MAP_ENTRIES) + 8,
+						 size, 8));
+	printf("datum out of range: %s\n",
+		   map_corrupted(image, size, map_get(image, MAP_ENTRIES) + 32,
+						 -(uint64_t)1, 8));
+	xfree(image);
+
+	t = hsh_create2(NULL, NULL, HSH_SIZED_KEYS);
+	hsh_insert_n(t, "alphabet", 5, &values[0]);
+	hsh_insert_n(t, "alphabet", 8, &values[1]);
+	hsh_save(t, "hashtest.map", long_length, NULL);
+	hsh_destroy(t);
+
+	p = hsh_map("hashtest.map");
+	datum = hsh_mapped_retrieve_n(p, "alphabetic", 5, &length);
+	printf("sized: %ld (%lu bytes), %ld, %s\n", *(const long *)datum,
+		   (unsigned long)length,
+		   *(const long *)hsh_mapped_retrieve(p, "alphabet"),
+		   hsh_mapped_retrieve_n(p, "alpha", 4, NULL) ? "found" : "missing");
+	hsh_unmap(p);
+
+	/* The secret seed of HSH_RANDOM_SEED is written to the file */
+	memset(&o, 0, sizeof(o));
+	o.flags = HSH_RANDOM_SEED;
+	o.seed  = 987654321;
+	t       = hsh_create_ex(&o);
+	for (i = 0; i < count; i++) hsh_insert(t, keys[i], keys[i]);
+	hsh_save(t, "hashtest.map", NULL, NULL);
+	hsh_destroy(t);
+
+	p = hsh_map("hashtest.map");
+	for (i = bad = 0; i < count; i++) {
+		datum = hsh_mapped_retrieve(p, keys[i]);
+		if (!datum || strcmp(datum, keys[i])) ++bad;
+	}
+	hsh_unmap(p);
+	image = map_read(&size);
+	printf("random seed: %d bad, seed %s\n", bad,
+		   map_get(image, MAP_SEED) == o.seed ? "saved" : "not saved");
+	xfree(image);
+
+	str = fopen("hashtest.map", "w");
+	fprintf(str, "This is not a table, but is long enough to be mistaken for"
+			" the header of one if only the size were checked.\n");
+	fclose(str);
+	p = hsh_map("hashtest.map");
+	printf("bad file: %s\n", !p && errno == EINVAL ? "rejected" : "accepted");
+	unlink("hashtest.map");
+	p = hsh_map("hashtest.map");
+	printf("no file: %s\n", !p && errno == ENOENT ? "rejected" : "accepted");
+
+	for (i = 0; i < count; i++) xfree(keys[i]);
+	xfree(keys);
+}
+
+static void test_hsh_upsert(const char *name, int flags, int count)
+{
+	hsh_HashTable t = hsh_create2(NULL, NULL, flags);
+	char          **keys = xmalloc(count * sizeof(char *));
+	long          i;
+	int           inserted = 0;
+	int           bad = 0;
+
+	printf("=== upsert, %s ===\n", name);
+	for (i = 0; i < count; i++) {
+		char buf[32];
+
+		sprintf(buf, "word%ld", i % 7);
+		keys[i] = xstrdup(buf);
+	}
+
+	if (!(flags & HSH_CONCURRENT)) {
+		for (i = 0; i < count; i++) {
+			int        new;
+			const void **slot = hsh_find_or_insert(t, keys[i], &new);
+
+			if (new) {
+				++inserted;
+				hsh_set_key(t, slot, keys[i]);
+			}
+			*slot = (const char *)*slot + 1;
+		}
+		for (i = 0; i < 7; i++)
+			if ((const char *)hsh_retrieve(t, keys[i]) - (const char *)NULL
+				!= count / 7 + (i < count % 7))
+				++bad;
+		printf("hsh_find_or_insert: %d inserted, %d bad counts\n",
+			   inserted, bad);
+	}
+
+	printf("hsh_replace missing: %d\n", hsh_replace(t, "missing", "x"));
+	printf("hsh_upsert missing: %d\n", hsh_upsert(t, "missing", "y"));
+	printf("hsh_upsert present: %d\n", hsh_upsert(t, "missing", "z"));
+	printf("hsh_replace present: %d\n", hsh_replace(t, "missing", "w"));
+	printf("missing: %s\n", (const char *)hsh_retrieve(t, "missing"));
+	printf("hsh_insert present: %d, still %s\n",
+		   hsh_insert(t, "missing", "v"),
+		   (const char *)hsh_retrieve(t, "missing"));
+
+	hsh_destroy(t);
+	for (i = 0; i < count; i++) xfree(keys[i]);
+	xfree(keys);
+}
+
+static void test_hsh_profile(const char *name, int flags, int count)
+{
+	hsh_HashTable t = hsh_create2(weak_hash, hsh_pointer_compare,
+								  flags | HSH_PROFILE);
+	hsh_HashTable plain = hsh_create(NULL, NULL);
+	hsh_Profile   p;
+	unsigned long walks = 0;
+	unsigned long long_walks = 0;
+	long          i;
+
+	printf("=== profile, %s ===\n", name);
+	for (i = 1; i <= count; i++)
+		hsh_insert(t, (char *)NULL + i, (char *)NULL + i);
+	for (i = 1; i <= 2 * count; i++)
+		hsh_retrieve(t, (char *)NULL + i);
+	for (i = 1; i <= count; i += 2)
+		hsh_delete(t, (char *)NULL + i);
+
+	printf("hsh_get_profile: %d\n", hsh_get_profile(t, &p));
+	for (i = 0; i < HSH_PROFILE_WALKS; i++) {
+		walks += p.walks[i];
+		if (i > 1) long_walks += p.walks[i];
+	}
+	printf("lookups: %lu, in histogram: %lu\n", p.lookups, walks);
+	printf("long walks: %s\n", long_walks ? "yes" : "no");
+	printf("compares >= hits: %s\n",
+		   p.compares >= (unsigned long)count * 2 ? "yes" : "no");
+	printf("resized: %s\n", p.resizes ? "yes" : "no");
+	printf("bytes: %s\n", p.bytes ? "yes" : "no");
+	printf("without HSH_PROFILE: %d\n", hsh_get_profile(plain, &p));
+
+	hsh_destroy(plain);
+	hsh_destroy(t);
+}
+
+static void test_hsh_ordered(int count)
+{
+	hsh_HashTable t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare,
+								  HSH_ORDERED);
+	hsh_Position  p;
+	void          *key;
+	long          i;
+	long          previous = 0;
+	int           n = 0;
+	int           sorted = 1;
+
+	printf("=== ordered ===\n");
+	/* Descending keys, so that the order of insertion differs from the
+	   order of the hash values */
+	for (i = count * 10; i > 0; i--)
+		hsh_insert(t, (char *)NULL + i, (char *)NULL + i);
+	for (i = 1; i <= count * 10; i += 2)
+		hsh_delete(t, (char *)NULL + i);
+	for (i = 1; i <= 5; i++)
+		hsh_insert(t, (char *)NULL + i * 2 - 1, (char *)NULL + i);
+
+	printf("first keys:");
+	HSH_ITERATE_KEYS(t, p, key) {
+		long k = (const char *)key - (const char *)NULL;
+
+		if (n++ < 5) printf(" %ld", k);
+		if (n <= count * 5 && previous && k > previous) sorted = 0;
+		previous = k;
+	}
+	printf("\nHSH_ITERATE: %d entries, %sin insertion order\n",
+		   n, sorted ? "" : "not ");
+
+	printf("last keys:");
+	for (p = hsh_init_position(t), i = 0; p; p = hsh_next_position(t, p))
+		if (++i > n - 5) {
+			hsh_get_position(p, &key);
+			printf(" %ld", (long)((const char *)key - (const char *)NULL));
+		}
+	printf("\n");
+
+	hsh_destroy(t);
+}
+
+HSH_DEFINE(long_table, long, long, HSH_DEF_INTEGER_HASH, HSH_DEF_INTEGER_EQUAL)
+HSH_DEFINE(word_table, const char *, int,
+		   HSH_DEF_STRING_HASH, HSH_DEF_STRING_EQUAL)
+
+static int long_summer(long key, long *value, void *arg)
+{
+	*(long *)arg += *value - key;
+	return 0;
+}
+
+static int word_freer(const char *key, int *value, void *arg)
+{
+	xfree(__UNCONST(key));
+	return 0;
+}
+
+static void test_hsh_define(int count)
+{
+	long_table *t = long_table_create();
+	word_table *w = word_table_create();
+	long       i;
+	long       sum  = 0;
+	int        bad  = 0;
+	int        seen = 0;
+	char       buf[32];
+
+	printf("=== HSH_DEFINE ===\n");
+	/* Keys with poor low bits */
+	for (i = 1; i <= count * 10; i++)
+		if (long_table_insert(t, i << 12, i << 12 | 1)) ++bad;
+	printf("duplicate insert: %d\n", long_table_insert(t, 1 << 12, 0));
+	for (i = 1; i <= count * 10; i += 3)
+		if (long_table_delete(t, i << 12)) ++bad;
+	printf("second delete: %d\n", long_table_delete(t, 1 << 12));
+	for (i = 0; i <= count * 10 + 1; i++) {
+		long *v = long_table_retrieve(t, i << 12);
+
+		if (i < 1 || i > count * 10 || i % 3 == 1 ? v != NULL
+			: !v || *v != (i << 12 | 1))
+			++bad;
+	}
+	printf("replace missing: %d\n", long_table_replace(t, -1, 1));
+	printf("upsert missing: %d\n", long_table_upsert(t, -1, 2));
+	printf("upsert present: %d\n", long_table_upsert(t, -1, 3));
+	printf("replace present: %d\n", long_table_replace(t, -1, 4));
+	printf("value: %ld\n", *long_table_retrieve(t, -1));
+	long_table_delete(t, -1);
+	long_table_reserve(t, count * 100);
+	long_table_iterate(t, long_summer, &sum);
+	printf("entries: %lu, sum: %ld, bad: %d\n",
+		   long_table_count(t), sum, bad);
+	long_table_destroy(t);
+
+	for (i = 0; i < count; i++) {
+		int inserted;
+
+		sprintf(buf, "word%ld", i % 7);
+		if (!word_table_retrieve(w, buf)) {
+			++*word_table_find_or_insert(w, xstrdup(buf), &inserted);
+			seen += inserted;
+		} else {
+			++*word_table_find_or_insert(w, buf, &inserted);
+		}
+	}
+	printf("words: %d inserted, word3 counted %d times\n",
+		   seen, *word_table_retrieve(w, "word3"));
+	word_table_iterate(w, word_freer, NULL);
+	word_table_destroy(w);
+}
+
+#define WEAK_HASH(key) ((unsigned long)(key) % 7)
+
+HSH_DEFINE(weak_table, long, long, WEAK_HASH, HSH_DEF_INTEGER_EQUAL)
+
+/* hash.c's HSH_OPEN_ADDRESSING tables and the HSH_DEFINE tables share
+   their probing scheme, so run both through the same inserts and deletes
+   of keys that share 7 hash values, which fills groups, leaves deleted
+   slots behind and makes the probes cross many groups. */
+
+static void test_hsh_probing(int count)
+{
+	hsh_HashTable t      = hsh_create2(weak_hash, hsh_pointer_compare,
+									   HSH_OPEN_ADDRESSING);
+	weak_table    *w     = weak_table_create();
+	hsh_Stats     s;
+	long          i;
+	int           differ = 0;
+
+	printf("=== open addressing and HSH_DEFINE ===\n");
+	for (i = 0; i < count * 50; i++) {
+		long key = i * 7919 % (count * 5) + 1;
+
+		switch (i % 3) {
+		case 0:
+		case 1:
+			if (!hsh_insert(t, INT2PTR(key), INT2PTR(key)) !=
+				!weak_table_insert(w, key, key))
+				++differ;
+			break;
+		case 2:
+			if (!hsh_delete(t, INT2PTR(key)) != !weak_table_delete(w, key))
+				++differ;
+			break;
+		}
+	}
+	for (i = 0; i <= count * 5 + 1; i++) {
+		long *v = weak_table_retrieve(w, i);
+
+		if (!hsh_retrieve(t, INT2PTR(i)) != !v || (v && *v != i)) ++differ;
+	}
+	s = hsh_get_stats(t);
+	printf("entries: %lu and %lu, %d differences\n",
+		   s->entries, weak_table_count(w), differ);
+	xfree(s);
+	hsh_destroy(t);
+	weak_table_destroy(w);
+}
+
+static int int_summer(uint64_t key, uint64_t *value, void *arg)
+{
+	*(uint64_t *)arg += *value;
+	return 0;
+}
+
+static void test_hsh_int(int count)
+{
+	hsh_IntTable t = hsh_int_create();
+	uint64_t     i;
+	uint64_t     value;
+	uint64_t     sum = 0;
+	int          bad = 0;
+	int          inserted;
+
+	printf("=== integer tables ===\n");
+	/* Full 64-bit keys, and keys with poor low bits */
+	for (i = 1; i <= (uint64_t)count * 10; i++) {
+		if (hsh_int_insert(t, i << 40, i)) ++bad;
+		if (hsh_int_insert(t, ~i, i)) ++bad;
+	}
+	printf("duplicate insert: %d\n", hsh_int_insert(t, 1ULL << 40, 0));
+	for (i = 1; i <= (uint64_t)count * 10; i += 2)
+		if (hsh_int_delete(t, ~i)) ++bad;
+	printf("second delete: %d\n", hsh_int_delete(t, ~(uint64_t)1));
+	for (i = 0; i <= (uint64_t)count * 10 + 1; i++) {
+		int present = i >= 1 && i <= (uint64_t)count * 10;
+
+		if (hsh_int_retrieve(t, i << 40, &value) != !present
+			|| (present && value != i))
+			++bad;
+		if (hsh_int_retrieve(t, ~i, NULL) != !(present && i % 2 == 0))
+			++bad;
+	}
+	printf("retrieve missing: %d\n", hsh_int_retrieve(t, 0, &value));
+	printf("replace missing: %d\n", hsh_int_replace(t, 0, 1));
+	printf("upsert missing: %d\n", hsh_int_upsert(t, 0, 2));
+	printf("upsert present: %d\n", hsh_int_upsert(t, 0, 3));
+	*hsh_int_find_or_insert(t, 0, &inserted) += 10;
+	printf("find_or_insert present: %d\n", inserted);
+	hsh_int_retrieve(t, 0, &value);
+	printf("value: %lu\n", (unsigned long)value);
+	hsh_int_delete(t, 0);
+	printf("find_or_insert missing: %lu",
+		   (unsigned long)*hsh_int_find_or_insert(t, 0, &inserted));
+	printf(", %d\n", inserted);
+	hsh_int_delete(t, 0);
+
+	hsh_int_iterate(t, int_summer, &sum);
+	printf("entries: %lu, sum: %lu, bad: %d\n",
+		   hsh_int_count(t), (unsigned long)sum, bad);
+	hsh_int_print_stats(t, stdout);
+	hsh_int_reserve(t, count * 100);
+	printf("reserved: %lu entries\n", hsh_int_count(t));
+	hsh_int_destroy(t);
+
+	/* Deletions shrink the table, but not below a reserved size */
+	t = hsh_int_create();
+	for (i = 0; i < (uint64_t)count * 100; i++) hsh_int_insert(t, i, i);
+	hsh_int_print_stats(t, stdout);
+	for (i = count; i < (uint64_t)count * 100; i++) hsh_int_delete(t, i);
+	for (i = 0; i < (uint64_t)count * 100; i++)
+		if (hsh_int_retrieve(t, i, &value) != (i >= (uint64_t)count)
+			|| (i < (uint64_t)count && value != i))
+			++bad;
+	printf("after deletions: %d bad\n", bad);
+	hsh_int_print_stats(t, stdout);
+	hsh_int_reserve(t, count * 100);
+	for (i = 0; i < (uint64_t)count; i++) hsh_int_delete(t, i);
+	hsh_int_print_stats(t, stdout);
+	hsh_int_destroy(t);
+}
+
+static void test_hsh_bulk(const char *name, int flags, int count)
+{
+	hsh_Options   o;
+	hsh_HashTable t;
+	const void    **keys = xmalloc(count * sizeof(void *));
+	long          i;
+	long          n;
+	int           bad = 0;
+	hsh_Stats     s;
+	hsh_HashTable ref;
+	hsh_Stats     s2;
+	hsh_Profile   p;
+	unsigned long resizes;
+	unsigned long expected;
+	unsigned long present;
+
+	printf("=== bulk load, %s ===\n", name);
+	/* Every fourth key is repeated */
+	for (i = 0; i < count; i++)
+		keys[i] = get_key(i % 4 ? i : i / 4);
+
+	memset(&o, 0, sizeof(o));
+	o.flags   = flags;
+	o.threads = 4;
+	t = hsh_create_ex(&o);
+	hsh_insert(t, keys[1], "first");
+	printf("already present: %lu\n",
+		   hsh_bulk_load(t, keys, keys, count, 4));
+	for (i = 0; i < count; i++) {
+		const char *datum = hsh_retrieve(t, keys[i]);
+
+		if (!datum || strcmp(datum, strcmp(keys[i], "key1") ? keys[i]
+							 : "first"))
+			++bad;
+	}
+	s = hsh_get_stats(t);
+	printf("hsh_get_stats: %lu entries, bad: %d\n", s->entries, bad);
+	xfree(s);
+	hsh_destroy(t);
+
+	/* Loading keys of which some are present, inserted one by one until
+	   the table has just been resized, so that an incrementally resized
+	   one still has lists to migrate.  |ref| tells which are present. */
+	t   = hsh_create_ex(&o);
+	ref = hsh_create(NULL, NULL);
+	for (i = 0, resizes = 0; i < count; i++) {
+		hsh_insert(t, keys[i], keys[i]);
+		hsh_insert(ref, keys[i], keys[i]);
+		hsh_get_profile(t, &p);
+		if (p.resizes != resizes && i >= count * 2 / 5) break;
+		resizes = p.resizes;
+	}
+	n = count * 7 / 10;
+	for (i = 0, expected = 0; i < n; i++)
+		expected += hsh_insert(ref, keys[i], keys[i]);
+	present = hsh_bulk_load(t, keys, keys, n, 4);
+	s       = hsh_get_stats(t);
+	s2      = hsh_get_stats(ref);
+	printf("partly loaded: present as expected: %s, entries: %s\n",
+		   present == expected ? "yes" : "no",
+		   s->entries == s2->entries ? "right" : "wrong");
+	xfree(s2);
+	xfree(s);
+	hsh_destroy(ref);
+	hsh_destroy(t);
+
+	for (i = 0; i < count; i++) xfree(__UNCONST(keys[i]));
+	xfree(keys);
+}
+
+static unsigned long table_size(hsh_HashTable t)
+{
+	hsh_Stats     s    = hsh_get_stats(t);
+	unsigned long size = s->size;
+
+	xfree(s);
+	return size;
+}
+
+static int deleter(const void *key, const void *datum, void *arg)
+{
+	return hsh_delete(arg, key);
+}
+
+static void test_hsh_shrink(const char *name, int flags, int count)
+{
+	hsh_HashTable t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare,
+								  flags);
+	unsigned long full;
+	unsigned long size;
+	long          i;
+	int           bad = 0;
+	hsh_Stats     s;
+
+	printf("=== shrink and compact, %s ===\n", name);
+	for (i = 1; i <= count; i++) hsh_insert(t, (void *)i, (void *)-i);
+	full = table_size(t);
+
+	for (i = 1; i <= count; i++)
+		if (i % 100) bad += hsh_delete(t, (void *)i);
+	for (i = 1; i <= count; i++)
+		if (hsh_retrieve(t, (void *)i) != (i % 100 ? NULL : (void *)-i))
+			++bad;
+	size = table_size(t);
+	printf("%lu -> %lu, shrank: %d, bad: %d\n",
+		   full, size, size * 8 <= full, bad);
+
+	/* The iterator deletes every entry, without shrinking the table */
+	printf("hsh_iterate_arg: %d, ", hsh_iterate_arg(t, deleter, t));
+	printf("unchanged: %d, ", table_size(t) == size);
+	s = hsh_get_stats(t);
+	printf("entries: %lu\n", s->entries);
+	xfree(s);
+
+	hsh_reserve(t, count);
+	size = table_size(t);
+	for (i = 1; i <= count; i++) hsh_insert(t, (void *)i, (void *)-i);
+	for (i = 1; i <= count; i++) hsh_delete(t, (void *)i);
+	printf("reserved: %lu, kept: %d\n", size, table_size(t) == size);
+
+	for (i = 1; i <= 10; i++) hsh_insert(t, (void *)i, (void *)-i);
+	hsh_compact(t);
+	for (i = 1; i <= 10; i++)
+		if (hsh_retrieve(t, (void *)i) != (void *)-i) ++bad;
+	printf("hsh_compact: %lu, bad: %d\n", table_size(t), bad);
+	hsh_destroy(t);
+}
+
+static void test_hsh_huge_pages(const char *name, int flags, int count)
+{
+	hsh_HashTable t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare,
+								  flags | HSH_HUGE_PAGES);
+	set_Set       set;
+	long          i;
+	int           bad = 0;
+	hsh_Stats     s;
+	set_Stats     ss;
+
+	printf("=== huge pages, %s ===\n", name);
+	for (i = 1; i <= count; i++) hsh_insert(t, (void *)i, (void *)-i);
+	for (i = 1; i <= count; i++)
+		if (hsh_retrieve(t, (void *)i) != (void *)-i) ++bad;
+	for (i = 1; i <= count; i += 2) hsh_delete(t, (void *)i);
+	hsh_compact(t);
+	for (i = 1; i <= count; i++)
+		if (hsh_retrieve(t, (void *)i) != (i % 2 ? NULL : (void *)-i))
+			++bad;
+	s = hsh_get_stats(t);
+	printf("mapped: %d, fewer huge pages: %d, bad: %d\n",
+		   s->mapped > 0, s->huge_pages < s->pages, bad);
+	xfree(s);
+	hsh_destroy(t);
+
+	set = set_create2(hsh_pointer_hash, hsh_pointer_compare,
+					  HSH_HUGE_PAGES);
+	for (i = 1; i <= count; i++) set_insert(set, (void *)i);
+	for (i = bad = 0; i <= count + 1; i++)
+		if (set_member(set, (void *)i) != (i >= 1 && i <= count)) ++bad;
+	ss = set_get_stats(set);
+	printf("set mapped: %d, bad: %d\n", ss->mapped > 0, bad);
+	xfree(ss);
+	set_destroy(set);
+}
+
+static int small_printer(const void *key, const void *datum)
+{
+	printf(" %ld", (long)key);
+	return 0;
+}
+
+static void test_hsh_small(const char *name, int flags)
+{
+	hsh_HashTable t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare,
+								  flags | HSH_SMALL);
+	hsh_Position  p;
+	void          *k;
+	void          *d;
+	long          i;
+	int           bad = 0;
+	int           n   = 0;
+
+	printf("=== small, %s ===\n", name);
+	for (i = 1; i <= 8; i++) hsh_insert(t, (void *)i, (void *)-i);
+
+	/* Churn without ever holding more than 8 entries */
+	for (i = 9; i <= 40; i++) {
+		hsh_delete(t, (void *)(i - 8));
+		hsh_insert(t, (void *)i, (void *)-i);
+	}
+	for (i = 1; i <= 41; i++)
+		if (hsh_retrieve(t, (void *)i) != (i > 32 && i <= 40
+										   ? (void *)-i : NULL))
+			++bad;
+	HSH_ITERATE(t, p, k, d) if (d == (void *)-(long)k) ++n;
+	printf("8 entries: size %lu, iterated %d, bad: %d\n",
+		   table_size(t), n, bad);
+
+	hsh_insert(t, (void *)41, (void *)-41);
+	printf("9 entries: size %lu, order:", table_size(t));
+	hsh_iterate(t, small_printer);
+	printf("\n");
+	hsh_destroy(t);
+
+	t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare, flags | HSH_SMALL);
+	hsh_insert(t, (void *)1, (void *)-1);
+	hsh_reserve(t, 1000);
+	for (i = 2; i <= 1000; i++) hsh_insert(t, (void *)i, (void *)-i);
+	for (i = 1, bad = 0; i <= 1000; i++)
+		if (hsh_retrieve(t, (void *)i) != (void *)-i) ++bad;
+	printf("reserved: size %lu, bad: %d\n", table_size(t), bad);
+	hsh_destroy(t);
+}
+
+static unsigned long colliding_hash(const void *key)
+{
+	return 42;
+}
+
+static unsigned long long_chains(hsh_HashTable t)
+{
+	hsh_Stats     s = hsh_get_stats(t);
+	unsigned long n = s->long_chains;
+
+	xfree(s);
+	return n;
+}
+
+static void test_hsh_seeded(const char *name, int flags, int count)
+{
+	hsh_HashTable t  = hsh_create2(colliding_hash, hsh_pointer_compare, flags);
+	hsh_HashTable t2;
+	hsh_Position  p;
+	hsh_Position  p2;
+	void          *k;
+	void          *k2;
+	char          buf[100];
+	char          **keys = xmalloc(count * sizeof(char *));
+	long          i;
+	int           bad    = 0;
+	int           differ = 0;
+
+	printf("=== seeded, %s ===\n", name);
+	for (i = 1; i <= count; i++) hsh_insert(t, (void *)i, (void *)-i);
+	printf("colliding keys: long chains reported: %s\n",
+		   long_chains(t) ? "yes" : "no");
+	hsh_destroy(t);
+
+	t  = hsh_create2(NULL, NULL, flags | HSH_RANDOM_SEED);
+	t2 = hsh_create2(NULL, NULL, flags | HSH_RANDOM_SEED);
+	for (i = 0; i < count; i++) {
+		sprintf(buf, "key%ld", i);
+		keys[i] = xstrdup(buf);
+		hsh_insert(t, keys[i], keys[i]);
+		hsh_insert(t2, keys[i], keys[i]);
+	}
+	for (i = 0; i < count; i++) {
+		sprintf(buf, "key%ld", i);
+		if (hsh_retrieve(t, buf) != keys[i]) ++bad;
+		if (hsh_retrieve(t2, buf) != keys[i]) ++bad;
+	}
+	for (p = hsh_init_position(t), p2 = hsh_init_position(t2);
+		 p && p2;
+		 p = hsh_next_position(t, p), p2 = hsh_next_position(t2, p2)) {
+		hsh_get_position(p, &k);
+		hsh_get_position(p2, &k2);
+		if (k != k2) ++differ;
+	}
+	printf("random seeds: bad: %d, long chains: %lu, orders differ: %s\n",
+		   bad, long_chains(t) + long_chains(t2), differ ? "yes" : "no");
+	hsh_destroy(t);
+	hsh_destroy(t2);
+
+	for (i = 0; i < count; i++) xfree(keys[i]);
+	xfree(keys);
+}
+
+static unsigned long sorted_prime;
+
+/* Distinct hash values that all fall into the first list */
+
+static unsigned long first_list_hash(const void *key)
+{
+	return (unsigned long)key * sorted_prime;
+}
+
+static void test_hsh_sorted(const char *name, int flags, int count)
+{
+	hsh_Options   o;
+	hsh_HashTable t;
+	hsh_Stats     s;
+	long          i;
+	int           bad = 0;
+
+	printf("=== sorted lists, %s ===\n", name);
+	memset(&o, 0, sizeof(o));
+	o.hash    = first_list_hash;
+	o.compare = hsh_pointer_compare;
+	o.flags   = flags | HSH_SORTED_LISTS;
+	o.entries = count;
+	t         = hsh_create_ex(&o);
+	s         = hsh_get_stats(t);
+	sorted_prime = s->size;
+	xfree(s);
+
+	for (i = count; i > 0; i--) hsh_insert(t, (void *)i, (void *)-i);
+	for (i = 1; i <= count + 10; i++)
+		if (hsh_retrieve(t, (void *)i) != (i <= count ? (void *)-i : NULL))
+			++bad;
+	s = hsh_get_stats(t);
+	printf("%lu entries, maximum list length %lu, %lu sorted, bad: %d\n",
+		   s->entries, s->maximum_length, s->sorted_lists, bad);
+	xfree(s);
+
+	for (i = 1; i <= count; i += 2) hsh_delete(t, (void *)i);
+	for (i = 1, bad = 0; i <= count; i++)
+		if (hsh_retrieve(t, (void *)i) != (i % 2 ? NULL : (void *)-i)) ++bad;
+	s = hsh_get_stats(t);
+	printf("%lu entries after deletions, %lu sorted, bad: %d\n",
+		   s->entries, s->sorted_lists, bad);
+	xfree(s);
+
+	for (i = 2; i <= count - 8; i += 2) hsh_delete(t, (void *)i);
+	s = hsh_get_stats(t);
+	printf("%lu entries left, %lu sorted\n", s->entries, s->sorted_lists);
+	xfree(s);
+	hsh_destroy(t);
+}
+
+static unsigned long shared_retrievals(hsh_HashTable t)
+{
+	hsh_Stats     s = hsh_get_stats(t);
+	unsigned long n = s->retrievals;
+
+	xfree(s);
+	return n;
+}
+
+static void test_hsh_shared(const char *name, int flags, int count)
+{
+	hsh_HashTable t = hsh_create2(NULL, NULL, flags);
+	hsh_Profile   p;
+	char          buf[100];
+	char          **keys = xmalloc(count * sizeof(char *));
+	unsigned long before;
+	long          i;
+	int           bad = 0;
+	int           status;
+	pid_t         pid;
+
+	printf("=== shared, %s ===\n", name);
+	for (i = 0; i < count; i++) {
+		sprintf(buf, "key%ld", i);
+		keys[i] = xstrdup(buf);
+		hsh_insert(t, keys[i], keys[i]);
+	}
+
+	printf("hsh_shared: %d\n", hsh_shared(t, 1));
+	printf("hsh_shared again: %d\n", hsh_shared(t, 1));
+	printf("hsh_readonly: %d\n", hsh_readonly(t, 1));
+	before = shared_retrievals(t);
+	for (i = 0; i < count; i++) {
+		sprintf(buf, "key%ld", i);
+		if (hsh_retrieve(t, buf) != keys[i]) ++bad;
+	}
+	if (hsh_retrieve(t, "absent")) ++bad;
+	printf("retrievals counted: %lu, bad: %d\n",
+		   shared_retrievals(t) - before, bad);
+
+	fflush(stdout);
+	if (!(pid = fork())) {
+		for (i = 0, bad = 0; i < count; i++)
+			if (hsh_retrieve(t, keys[i]) != keys[i]) ++bad;
+		_exit(bad || shared_retrievals(t) != before + 2 * count + 1);
+	}
+	before = shared_retrievals(t);
+	waitpid(pid, &status, 0);
+	printf("child: %s, parent retrievals unchanged: %s\n",
+		   WIFEXITED(status) && !WEXITSTATUS(status) ? "ok" : "failed",
+		   shared_retrievals(t) == before ? "yes" : "no");
+
+	printf("hsh_shared off: %d\n", hsh_shared(t, 0));
+	printf("retrievals kept: %s\n",
+		   shared_retrievals(t) == before ? "yes" : "no");
+	hsh_insert(t, "new", "new");
+	printf("inserted: %s\n", hsh_retrieve(t, "new") ? "yes" : "no");
+	if (flags & HSH_PROFILE)
+		printf("profiled lookups: %lu\n",
+			   (hsh_get_profile(t, &p), p.lookups));
+
+	hsh_shared(t, 1);
+	hsh_destroy(t);
+	for (i = 0; i < count; i++) xfree(keys[i]);
+	xfree(keys);
+}
+
+typedef struct snapshot_check {
+	long          count;
+	char          *seen;
+	int           bad;
+	hsh_HashTable table;		/* Changed while iterating, if not NULL */
+} *snapshotCheckType;
+
+/* Check that the entry is one of keys 1 to |count|, with its datum
+   unchanged, seen once */
+
+static int snapshot_entry(const void *key, const void *datum, void *arg)
+{
+	snapshotCheckType c = (snapshotCheckType)arg;
+	long              k = (long)key;
+
+	if (k < 1 || k > c->count || datum != key || c->seen[k]++) ++c->bad;
+	if (c->table) {
+		hsh_delete(c->table, key);
+		hsh_insert(c->table, INT2PTR((k + 10 * c->count)), NULL);
+	}
+	return 0;
+}
+
+static int snapshot_check(hsh_Snapshot s, long count, hsh_HashTable table)
+{
+	struct snapshot_check c;
+	long                  i;
+
+	c.count = count;
+	c.seen  = xcalloc(count + 1, 1);
+	c.bad   = 0;
+	c.table = table;
+	hsh_snapshot_iterate(s, snapshot_entry, &c);
+	for (i = 1; i <= count; i++) if (!c.seen[i]) ++c.bad;
+	xfree(c.seen);
+	return c.bad;
+}
+
+static void *snapshot_reader(void *arg)
+{
+	return (void *)(long)snapshot_check(arg, concurrent_count, NULL);
+}
+
+static void test_hsh_snapshot(const char *name, int flags, int count)
+{
+	hsh_HashTable t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare,
+								  flags);
+	hsh_Snapshot  s;
+	hsh_Snapshot  s2;
+	pthread_t     reader;
+	void          *result;
+	long          i;
+	int           n = 0;
+
+	printf("=== snapshot, %s ===\n", name);
+	for (i = 1; i <= count; i++) hsh_insert(t, INT2PTR(i), INT2PTR(i));
+
+	s = hsh_snapshot(t);
+	for (i = 1; i <= count; i += 2) hsh_delete(t, INT2PTR(i));
+	for (i = 2; i <= count; i += 4) hsh_replace(t, INT2PTR(i), NULL);
+	if (!(flags & HSH_CONCURRENT))
+		for (i = 4; i <= count; i += 4)
+			*hsh_find_or_insert(t, INT2PTR(i), NULL) = NULL;
+	printf("after changes: bad: %d\n", snapshot_check(s, count, NULL));
+
+	s2 = hsh_snapshot(t);
+	for (i = count + 1; i <= 4 * count; i++)
+		hsh_insert(t, INT2PTR(i), INT2PTR(i));
+	printf("after growth: bad: %d\n", snapshot_check(s, count, NULL));
+	hsh_snapshot_destroy(s2);
+	hsh_snapshot_destroy(s);
+
+	hsh_destroy(t);
+	t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare, flags);
+	for (i = 1; i <= count; i++) hsh_insert(t, INT2PTR(i), INT2PTR(i));
+	s = hsh_snapshot(t);
+	printf("changed while iterating: bad: %d\n", snapshot_check(s, count, t));
+	hsh_iterate_arg(t, counter, &n);
+	printf("entries: %d\n", n);
+	hsh_snapshot_destroy(s);
+
+	hsh_destroy(t);
+	t = hsh_create2(hsh_pointer_hash, hsh_pointer_compare, flags);
+	for (i = 1; i <= count; i++) hsh_insert(t, INT2PTR(i), INT2PTR(i));
+	s                = hsh_snapshot(t);
+	concurrent_count = count;
+	pthread_create(&reader, NULL, snapshot_reader, s);
+	for (i = 1; i <= count; i++) {
+		hsh_delete(t, INT2PTR(i));
+		hsh_insert(t, INT2PTR((i + count)), NULL);
+	}
+	pthread_join(reader, &result);
+	printf("read by a thread: bad: %ld\n", (long)result);
+
+	hsh_destroy(t);
+	printf("table destroyed: bad: %d\n", snapshot_check(s, count, NULL));
+	hsh_snapshot_destroy(s);
+}
+
 static void test_hsh_pointer_compare(void)
 {
 	/* hsh_pointer_compare */
@@ -280,6 +1727,69 @@ int main(int argc, char **argv)
 	test_hsh_strings(count);
 	test_hsh_integers(count);
 	test_hsh_pointer_compare();
+	test_hsh_flags("open addressing", HSH_OPEN_ADDRESSING, count);
+	test_hsh_flags("incremental resize", HSH_INCREMENTAL_RESIZE, count);
+	test_hsh_flags("power of two", HSH_POWER_OF_TWO, count);
+	test_hsh_flags("power of two, incremental resize",
+				   HSH_POWER_OF_TWO | HSH_INCREMENTAL_RESIZE, count);
+	test_hsh_flags("concurrent", HSH_CONCURRENT, count);
+	test_hsh_concurrent(count);
+	test_hsh_sharded(count, 0);
+	test_hsh_sharded(count, HSH_CONCURRENT);
+	test_hsh_fast_hashes();
+	test_hsh_flags("sized keys", HSH_SIZED_KEYS, count);
+	test_hsh_flags("ordered", HSH_ORDERED, count);
+	test_hsh_ordered(count);
+	test_hsh_define(count);
+	test_hsh_probing(count);
+	test_hsh_int(count);
+	test_hsh_bulk("lists", 0, count * 1000);
+	test_hsh_bulk("open addressing", HSH_OPEN_ADDRESSING, count * 1000);
+	test_hsh_bulk("incremental resize", HSH_INCREMENTAL_RESIZE, count * 1000);
+	test_hsh_sized_keys();
+	test_hsh_options(count);
+	test_hsh_frozen(count * 10);
+	test_hsh_mapped(count * 10);
+	test_hsh_upsert("lists", 0, count);
+	test_hsh_upsert("open addressing", HSH_OPEN_ADDRESSING, count);
+	test_hsh_upsert("incremental resize", HSH_INCREMENTAL_RESIZE, count);
+	test_hsh_upsert("concurrent", HSH_CONCURRENT, count);
+	test_hsh_upsert("sized keys", HSH_SIZED_KEYS, count);
+	test_hsh_profile("lists", 0, count);
+	test_hsh_profile("open addressing", HSH_OPEN_ADDRESSING, count);
+	test_hsh_profile("incremental resize", HSH_INCREMENTAL_RESIZE, count);
+	test_hsh_shrink("lists", 0, count * 100);
+	test_hsh_shrink("power of two", HSH_POWER_OF_TWO, count * 100);
+	test_hsh_shrink("open addressing", HSH_OPEN_ADDRESSING, count * 100);
+	test_hsh_shrink("ordered", HSH_ORDERED, count * 100);
+	test_hsh_shrink("incremental resize", HSH_INCREMENTAL_RESIZE, count * 100);
+	test_hsh_shrink("concurrent", HSH_CONCURRENT, count * 100);
+	test_hsh_small("lists", 0);
+	test_hsh_small("power of two", HSH_POWER_OF_TWO);
+	test_hsh_small("open addressing", HSH_OPEN_ADDRESSING);
+	test_hsh_small("ordered", HSH_ORDERED);
+	test_hsh_small("incremental resize", HSH_INCREMENTAL_RESIZE);
+	test_hsh_huge_pages("lists", 0, count * 1000);
+	test_hsh_huge_pages("open addressing", HSH_OPEN_ADDRESSING, count * 1000);
+	test_hsh_huge_pages("concurrent", HSH_CONCURRENT, count * 1000);
+	test_hsh_seeded("lists", 0, count * 10);
+	test_hsh_seeded("open addressing", HSH_OPEN_ADDRESSING, count * 10);
+	test_hsh_seeded("incremental resize", HSH_INCREMENTAL_RESIZE, count * 10);
+	test_hsh_seeded("small", HSH_SMALL, count * 10);
+	test_hsh_sorted("lists", 0, count * 10);
+	test_hsh_sorted("incremental resize", HSH_INCREMENTAL_RESIZE, count * 10);
+	test_hsh_shared("lists", 0, count * 10);
+	test_hsh_shared("open addressing", HSH_OPEN_ADDRESSING, count * 10);
+	test_hsh_shared("sorted lists", HSH_SORTED_LISTS, count * 10);
+	test_hsh_shared("profile", HSH_PROFILE, count * 10);
+	test_hsh_snapshot("lists", 0, count * 10);
+	test_hsh_snapshot("open addressing", HSH_OPEN_ADDRESSING, count * 10);
+	test_hsh_snapshot("incremental resize", HSH_INCREMENTAL_RESIZE,
+					  count * 10);
+	test_hsh_snapshot("sorted lists", HSH_SORTED_LISTS, count * 10);
+	test_hsh_snapshot("ordered", HSH_ORDERED, count * 10);
+	test_hsh_snapshot("small", HSH_SMALL, 6);
+	test_hsh_snapshot("concurrent", HSH_CONCURRENT, count * 10);
 
 	return 0;
 }
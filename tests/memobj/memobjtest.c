@@ -76,6 +76,50 @@ int main(int argc, char** argv)
 
 	mem_destroy_objects(objects);
 
+	/* Objects spanning several slabs */
+	objects = mem_create_objects(3);
+	{
+		char *objs[1000];
+		int  i;
+
+		for (i = 0; i < 1000; ++i) {
+			objs[i] = (char *) mem_get_object(objects);
+			memset(objs[i], i & 0x7f, 3);
+		}
+		for (i = 0; i < 1000; ++i) {
+			if (objs[i][0] != (i & 0x7f) || objs[i][2] != (i & 0x7f))
+				printf("obj%d was overwritten\n", i);
+		}
+		for (i = 0; i < 1000; i += 2)
+			mem_free_object(objects, objs[i]);
+		mem_print_object_stats(objects, stdout);
+
+		for (i = 0; i < 1000; i += 2)
+			objs[i] = (char *) mem_get_empty_object(objects);
+		mem_print_object_stats(objects, stdout);
+	}
+	mem_destroy_objects(objects);
+
+	/* Slabs from mapped pages */
+	{
+		unsigned long mapped = 0;
+		long          *objs[100000];
+		long          i;
+		int           bad = 0;
+
+		objects = mem_create_objects2(sizeof(long), mem_alloc_pages,
+									  mem_free_pages, &mapped);
+		for (i = 0; i < 100000; ++i) {
+			objs[i]  = (long *) mem_get_object(objects);
+			*objs[i] = i;
+		}
+		for (i = 0; i < 100000; ++i)
+			if (*objs[i] != i) ++bad;
+		printf("mapped pages: %d, bad: %d\n", mapped >= 800000, bad);
+		mem_destroy_objects(objects);
+		printf("unmapped: %d\n", mapped == 0);
+	}
+
 	maa_shutdown();
 	return 0;
 }
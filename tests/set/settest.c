@@ -46,6 +46,18 @@ static unsigned long hsh_string_hash_32bit(const void *key)
 	return hsh_string_hash(key) & 0xFFFFFFFFul;
 }
 
+static unsigned long colliding_hash(const void *key)
+{
+	return 42;
+}
+
+static unsigned long sorted_prime;
+
+static unsigned long sorted_hash(const void *key)
+{
+	return (unsigned long)key * sorted_prime;
+}
+
 int main(int argc, char **argv)
 {
 	set_Set      t;
@@ -196,5 +208,194 @@ int main(int argc, char **argv)
 	set_destroy(t1);
 	set_destroy(t2);
 
+	/* Test power-of-two sets */
+	printf("\nPower of two:\n");
+	t = set_create2(hsh_pointer_hash, hsh_pointer_compare, HSH_POWER_OF_TWO);
+	for (i = 1; i <= count * 10; i++)
+		set_insert(t, (void *)((long)i << 12));
+	for (i = 1; i <= count * 10; i += 2)
+		set_delete(t, (void *)((long)i << 12));
+	for (i = 0; i <= count * 10 + 1; i++) {
+		int expected = i > 0 && i <= count * 10 && i % 2 == 0;
+
+		if (set_member(t, (void *)((long)i << 12)) != expected)
+			printf("Unexpected membership of %d\n", i);
+	}
+	printf("%d elements\n", set_count(t));
+	j = 0;
+	SET_ITERATE(t,p,k) ++j;
+	printf("%d elements iterated\n", j);
+
+	/* Test batched membership */
+	{
+		const void **elems = xmalloc((count * 10 + 2) * sizeof(void *));
+		int        *out    = xmalloc((count * 10 + 2) * sizeof(int));
+
+		for (i = 0; i <= count * 10 + 1; i++)
+			elems[i] = (void *)((long)i << 12);
+		set_member_batch(t, elems, count * 10 + 2, out);
+		for (i = j = 0; i <= count * 10 + 1; i++) {
+			if (out[i] != set_member(t, elems[i]))
+				printf("Batched membership of %d differs\n", i);
+			j += out[i];
+		}
+		printf("%d members in batch\n", j);
+		xfree(out);
+		xfree(elems);
+	}
+	set_destroy(t);
+
+	/* Test pre-sizing */
+	printf("\nReserved:\n");
+	t = set_create(hsh_pointer_hash, hsh_pointer_compare);
+	set_reserve(t, count * 10);
+	{
+		set_Stats s = set_get_stats(t);
+		unsigned long before = s->resizings;
+
+		xfree(s);
+		for (i = 1; i <= count * 10; i++)
+			set_insert(t, (void *)((long)i << 12));
+		s = set_get_stats(t);
+		printf("%d elements, %lu resizings\n",
+			   set_count(t), s->resizings - before);
+		xfree(s);
+	}
+	set_destroy(t);
+
+	/* Test small sets */
+	printf("\nSmall:\n");
+	t = set_create2(hsh_pointer_hash, hsh_pointer_compare, HSH_SMALL);
+	{
+		set_Stats s;
+
+		for (i = 1; i <= 8; i++) set_insert(t, (void *)((long)i << 12));
+		for (i = 1; i <= 4; i++) set_delete(t, (void *)((long)i << 12));
+		for (i = 9; i <= 12; i++) set_insert(t, (void *)((long)i << 12));
+		s = set_get_stats(t);
+		printf("%d elements in %lu list\n", set_count(t), s->size);
+		xfree(s);
+		set_insert(t, (void *)(13L << 12));
+		for (i = j = 0; i <= 14; i++)
+			j += set_member(t, (void *)((long)i << 12));
+		s = set_get_stats(t);
+		printf("%d members in %lu lists\n", j, s->size);
+		xfree(s);
+	}
+	set_destroy(t);
+
+	/* Test random seeds and colliding elements */
+	printf("\nSeeded:\n");
+	t = set_create2(NULL, NULL, HSH_RANDOM_SEED);
+	{
+		set_Stats s;
+		char      buf[100];
+		char      **elems = xmalloc(count * sizeof(char *));
+
+		for (i = 0; i < count; i++) {
+			sprintf(buf, "elem%d", i);
+			elems[i] = xstrdup(buf);
+			set_insert(t, elems[i]);
+		}
+		for (i = j = 0; i < count; i++) {
+			sprintf(buf, "elem%d", i);
+			j += set_member(t, buf);
+		}
+		s = set_get_stats(t);
+		printf("%d members, long chains: %lu\n", j, s->long_chains);
+		xfree(s);
+		set_destroy(t);
+
+		t = set_create(colliding_hash, hsh_pointer_compare);
+		for (i = 0; i < count; i++) set_insert(t, elems[i]);
+		s = set_get_stats(t);
+		printf("colliding elements: long chains reported: %s\n",
+			   s->long_chains ? "yes" : "no");
+		xfree(s);
+
+		for (i = 0; i < count; i++) xfree(elems[i]);
+		xfree(elems);
+	}
+	set_destroy(t);
+
+	/* Test a list one element longer than a long chain: only the miss
+	   and the hit on its last element examine more than 32 elements */
+	for (j = 0; j < 2; j++) {
+		set_Stats s;
+
+		t = set_create2(colliding_hash, hsh_pointer_compare,
+						j ? HSH_SORTED_LISTS : 0);
+		for (i = 1; i <= 33; i++) set_insert(t, (void *)((long)i << 12));
+		set_readonly(t, 1);
+		for (i = 0; i <= 33; i++) set_member(t, (void *)((long)i << 12));
+		s = set_get_stats(t);
+		printf("%s list of 33: %lu long chains\n",
+			   j ? "sorted" : "unsorted", s->long_chains);
+		xfree(s);
+		set_readonly(t, 0);
+		set_destroy(t);
+	}
+
+	/* Test sorted lists */
+	printf("\nSorted:\n");
+	t = set_create2(colliding_hash, hsh_pointer_compare, HSH_SORTED_LISTS);
+	{
+		set_Stats s;
+
+		for (i = 1; i <= count; i++) set_insert(t, (void *)((long)i << 12));
+		for (i = j = 0; i <= count + 1; i++)
+			j += set_member(t, (void *)((long)i << 12));
+		s = set_get_stats(t);
+		printf("%d members, %lu sorted lists\n", j, s->sorted_lists);
+		xfree(s);
+	}
+	set_destroy(t);
+	t = set_create2(sorted_hash, hsh_pointer_compare, HSH_SORTED_LISTS);
+	{
+		set_Stats s;
+
+		set_reserve(t, count);
+		s = set_get_stats(t);
+		sorted_prime = s->size;
+		xfree(s);
+		for (i = 1; i <= count; i++) set_insert(t, (void *)(long)i);
+		for (i = 1; i <= count; i += 2) set_delete(t, (void *)(long)i);
+		for (i = j = 0; i <= count + 1; i++)
+			j += set_member(t, (void *)(long)i);
+		s = set_get_stats(t);
+		printf("%d members in a list of %lu, %lu sorted lists\n",
+			   j, s->maximum_length, s->sorted_lists);
+		xfree(s);
+	}
+	set_destroy(t);
+
+	/* Test shrinking and compaction */
+	printf("\nShrunk:\n");
+	t = set_create(hsh_pointer_hash, hsh_pointer_compare);
+	{
+		set_Stats     s;
+		unsigned long full;
+
+		for (i = 1; i <= count * 10; i++)
+			set_insert(t, (void *)((long)i << 12));
+		s    = set_get_stats(t);
+		full = s->size;
+		xfree(s);
+		for (i = 1; i <= count * 10; i++)
+			if (i % 50) set_delete(t, (void *)((long)i << 12));
+		s = set_get_stats(t);
+		printf("%d elements, shrank: %d\n",
+			   set_count(t), s->size * 8 <= full);
+		xfree(s);
+
+		set_compact(t);
+		for (i = j = 0; i <= count * 10; i++)
+			j += set_member(t, (void *)((long)i << 12));
+		s = set_get_stats(t);
+		printf("compacted to %lu, %d members\n", s->size, j);
+		xfree(s);
+	}
+	set_destroy(t);
+
 	return 0;
 }
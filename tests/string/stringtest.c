@@ -67,6 +67,37 @@ int main(int argc, char **argv)
 					this);
 	}
 
+	/* Slices of a larger buffer, without copying */
+	strcpy(buf, "key12key3");
+	printf("str_findn(\"key12\"): %s\n",
+		   str_findn(buf, 5) == orig[12] ? "same" : "different");
+	printf("str_findn(\"key3\"): %s\n",
+		   str_findn(buf + 5, 4) == orig[3] ? "same" : "different");
+	printf("str_findn(\"key\"): %s\n", str_findn(buf, 3));
+	printf("str_findn past a NUL: %s\n",
+		   str_findn("key4\0xyz", 8) == orig[4] ? "same" : "different");
+
+	/* A pool hashing its strings with a random seed */
+	{
+		str_Pool  pool = str_pool_create2(HSH_RANDOM_SEED);
+		str_Stats s;
+		int       same = 0;
+
+		for (i = 0; i < count; i++) {
+			sprintf(buf, "key%d", i);
+			orig[i] = str_pool_find(pool, buf);
+		}
+		for (i = 0; i < count; i++) {
+			sprintf(buf, "key%d", i);
+			if (str_pool_find(pool, buf) == orig[i]) ++same;
+		}
+		s = str_pool_get_stats(pool);
+		printf("seeded pool: %d of %d found again, %d strings\n",
+			   same, count, s->count);
+		xfree(s);
+		str_pool_destroy(pool);
+	}
+
 	xfree(orig);
 
 	printf("Done.\n");